@@ -2,6 +2,7 @@
 
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/rotate_vector.hpp>
+#include <iostream>
 #include <memory>
 
 #include "Random.hpp"
@@ -72,7 +73,7 @@ std::vector<GeometryVertex> DEBUG_CUBE_VERTICES = {
 };
 // clang-format on
 
-MainWindow::MainWindow() : Window{"UnnamedMinecraftClone", 10, 10} {
+MainWindow::MainWindow() : Window{"UnnamedMinecraftClone", 10} {
     atlas = AtlasManager::create();
     world = World::create(atlas);
     hudManager = HudManager::create(atlas);
@@ -92,8 +93,7 @@ MainWindow::MainWindow() : Window{"UnnamedMinecraftClone", 10, 10} {
 }
 
 void MainWindow::onFrame(InputState& input) {
-    models.clear();
-    uiModels.clear();
+    renderQueue.clear();
 
     // Spawn mucchine as needed
     if (mucchine.size() < 50) {
@@ -108,7 +108,7 @@ void MainWindow::onFrame(InputState& input) {
         mucchina.teleport(pos);
         mucchina.unstuck(*world);
 
-        mucchine.push_back(mucchina);
+        mucchine.push_back(std::move(mucchina));
     }
 
     if (caprette.size() < 50) {
@@ -123,10 +123,10 @@ void MainWindow::onFrame(InputState& input) {
         capretta.teleport(pos);
         capretta.unstuck(*world);
 
-        caprette.push_back(capretta);
+        caprette.push_back(std::move(capretta));
     }
 
-    while ((input.time - simulatedTime) > 0.005f) {
+    while ((input.time - simulatedTime) > PHYSICS_STEP) {
         // Run physics at 100Hz
         playerController.update(*world, input);
         for (auto& mucchina : mucchine) {
@@ -135,7 +135,7 @@ void MainWindow::onFrame(InputState& input) {
         for (auto& capretta : caprette) {
             capretta.update(*world);
         }
-        simulatedTime += 0.005f;
+        simulatedTime += PHYSICS_STEP;
     }
 
     // Destroy mucchine that are too far to be seen
@@ -163,13 +163,21 @@ void MainWindow::onFrame(InputState& input) {
 
     auto dayNightState = logic::getDayNightState(input.time);
 
+    // Speed is in blocks per physics step
+    world->updateLoadQueue(playerController.getCamera(),
+                           playerController.getSpeed() / PHYSICS_STEP);
+    world->processLoadQueue(CHUNK_LOAD_BUDGET);
+
+    world->updateVisibility(playerController.getCamera(), 3);
     world->getChunkInArea(playerController.getPos(), 3,
                           [this](glm::ivec3 pos, Chunk& chunk) {
-                              models.push_back(chunk.getModel(pos));
+                              GeometryModel model = chunk.getModel(pos);
+                              model.shadowOnly = !world->isChunkVisible(pos);
+                              renderQueue.push(model);
                           });
 
-    for (auto& mucchina : mucchine) mucchina.addToModelList(models);
-    for (auto& capretta : caprette) capretta.addToModelList(models);
+    mucchinaBlueprint->addToRenderQueue(renderQueue);
+    caprettaBlueprint->addToRenderQueue(renderQueue);
 
     hudManager->setSelectedBlock(input.selected_block);
 
@@ -180,15 +188,59 @@ void MainWindow::onFrame(InputState& input) {
     skybox.lightDir = dayNightState.sunDir;
     skybox.blend = dayNightState.skyboxFade;
 
-    hudManager->addToModelList(uiModels);
+    hudManager->addToRenderQueue(renderQueue);
 
-    renderer->render(playerController.getCamera(), skybox, lights, models,
-                     uiModels, windowResized);
+    renderer->setDepthPrepass(input.depthPrepass);
+    renderer->setOverdrawView(input.overdrawView);
+    renderer->render(playerController.getCamera(), skybox, lights, renderQueue,
+                     windowResized);
     windowResized = false;
+
+    logRenderStats(input.time);
 }
 
 void MainWindow::onResize(int width, int height) { windowResized = true; }
 
+void MainWindow::logRenderStats(float time) {
+    if (time - statsLoggedAt < STATS_PERIOD) return;
+    statsLoggedAt = time;
+
+    // Redraws out of updates of each cascade, since the last log
+    auto cacheStats = renderer->getShadowCacheStats();
+    std::cout << "[INFO] Shadow static layer redraws:";
+    for (uint32_t i = 0; i < ShadowPass::CASCADE_COUNT; i++)
+        std::cout << " " << cacheStats.redraws[i] - lastCacheStats.redraws[i]
+                  << "/" << cacheStats.updates[i] - lastCacheStats.updates[i];
+    std::cout << std::endl;
+    lastCacheStats = cacheStats;
+
+    // The others are of the last frame
+    CullingStats forward = renderer->getForwardCullingStats();
+    CullingStats shadow = renderer->getShadowCullingStats();
+    std::cout << "[INFO] Culling: forward " << forward.visible << " visible, "
+              << forward.culled << " culled, " << forward.occluded
+              << " occluded; shadow " << shadow.visible << " visible, "
+              << shadow.culled << " culled" << std::endl;
+
+    auto record = renderer->getGeometryRecordStats();
+    std::cout << "[INFO] Geometry: " << record.draws << " draws ("
+              << record.indirectDraws << " indirect), "
+              << record.descriptorBinds << " descriptor binds, "
+              << record.bufferBinds << " buffer binds, " << record.recordMs
+              << " ms to record" << std::endl;
+
+    // Counts indirect draws before GPU culling, and terrain only when the
+    // static layer was redrawn
+    auto fetch = renderer->getShadowFetchStats();
+    std::cout << "[INFO] Shadow fetch: " << fetch.vertices << " vertices, "
+              << fetch.bytes / 1024 << " KiB instead of "
+              << fetch.fullBytes / 1024 << " KiB"
+              << (renderer->wasShadowStaticLayerRedrawn()
+                      ? ", static layer redrawn"
+                      : "")
+              << std::endl;
+}
+
 void MainWindow::pushDebugCube(glm::vec3 pos, glm::quat rot) {
-    models.push_back(GeometryModel{debugCubeMesh, debugTexture, pos, rot});
+    renderQueue.push(GeometryModel{&debugCubeMesh, &debugTexture, pos, rot});
 }
\ No newline at end of file
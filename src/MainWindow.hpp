@@ -14,6 +14,13 @@
 
 class MainWindow : public render::Window {
 public:
+    // Physics time step, in seconds
+    static constexpr float PHYSICS_STEP = 0.005f;
+    // Chunks generated per frame at most
+    static constexpr int CHUNK_LOAD_BUDGET = 2;
+    // Seconds between two logs of the render stats
+    static constexpr float STATS_PERIOD = 5.0f;
+
     MainWindow();
 
 protected:
@@ -22,6 +29,7 @@ protected:
 
 private:
     void pushDebugCube(glm::vec3 pos, glm::quat rot);
+    void logRenderStats(float time);
 
     bool windowResized{false};
 
@@ -33,6 +41,8 @@ private:
 
     std::unique_ptr<render::Renderer> renderer;
     render::Skybox skybox;
+    float statsLoggedAt = 0.0f;
+    render::ShadowPass::CacheStats lastCacheStats;
 
     render::GeometryMesh debugCubeMesh;
     render::UiMesh uiMesh;
@@ -50,6 +60,5 @@ private:
     std::list<world::Capretta> caprette;
 
     // Per frame stuff
-    std::list<render::GeometryModel> models;
-    std::list<render::UiModel> uiModels;
+    render::RenderQueue renderQueue;
 };
\ No newline at end of file
@@ -0,0 +1,157 @@
+// Headless world pregeneration tool. Generates a square area of chunks around
+// the origin on all cores and reports generation throughput. It only links the
+// terrain generator, so it runs on machines without a GPU or a display.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+// windows.h must come first
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "world/TerrainGenerator.hpp"
+
+using namespace world;
+
+// Peak resident set size in bytes, 0 if unknown
+static size_t getPeakRss() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters{};
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters,
+                              sizeof(counters)))
+        return 0;
+    return counters.PeakWorkingSetSize;
+#else
+    struct rusage usage {};
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+static void printStage(const char *name, double seconds, size_t chunks) {
+    std::cout << "  " << std::left << std::setw(10) << name << std::right
+              << std::setw(10) << std::fixed << std::setprecision(3)
+              << seconds * 1e3 << " ms" << std::setw(10)
+              << std::setprecision(2) << seconds * 1e6 / chunks
+              << " us/chunk" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 3) {
+        std::cerr << "usage: " << argv[0] << " [radius] [threads]" << std::endl;
+        return 1;
+    }
+
+    int radius = argc > 1 ? std::atoi(argv[1]) : 32;
+    // hardware_concurrency() gives 0 when it can't tell
+    int threads = argc > 2 ? std::atoi(argv[2])
+                           : std::max<int>(std::thread::hardware_concurrency(),
+                                           1);
+
+    if (radius <= 0) {
+        std::cerr << "radius must be positive" << std::endl;
+        return 1;
+    }
+    if (threads <= 0) {
+        std::cerr << "threads must be positive" << std::endl;
+        return 1;
+    }
+    unsigned threadCount = static_cast<unsigned>(threads);
+
+    auto generator = TerrainGenerator::create();
+
+    std::vector<glm::ivec3> positions;
+    for (int x = -radius; x < radius; x++) {
+        for (int z = -radius; z < radius; z++) {
+            for (int y = 0; y < TerrainGenerator::HEIGHT; y++) {
+                positions.push_back({x, y, z});
+            }
+        }
+    }
+
+    std::cout << "[INFO] Generating " << positions.size() << " chunks ("
+              << radius * 2 << "x" << radius * 2 << " columns) on "
+              << threadCount << " threads" << std::endl;
+
+    std::atomic<size_t> next{0};
+    std::vector<TerrainGenerator::Timings> timings(threadCount);
+    std::vector<size_t> solidBlocks(threadCount, 0);
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < threadCount; i++) {
+        workers.emplace_back([&, i]() {
+            TerrainGenerator::Blocks blocks;
+            // Kept local, neighbouring slots of the shared vectors would
+            // share cache lines between the threads
+            TerrainGenerator::Timings localTimings;
+            size_t localSolid = 0;
+
+            size_t index;
+            while ((index = next.fetch_add(1)) < positions.size()) {
+                generator->generate(positions[index], blocks, &localTimings);
+
+                // Counting the solid blocks keeps the work from being
+                // optimized away
+                for (auto &plane : blocks)
+                    for (auto &row : plane)
+                        for (auto block : row)
+                            if (block != Block::AIR) localSolid++;
+            }
+
+            timings[i] = localTimings;
+            solidBlocks[i] = localSolid;
+        });
+    }
+
+    for (auto &worker : workers) worker.join();
+
+    double wall = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+
+    TerrainGenerator::Timings total;
+    size_t solid = 0;
+    for (unsigned i = 0; i < threadCount; i++) {
+        total += timings[i];
+        solid += solidBlocks[i];
+    }
+
+    size_t chunks = positions.size();
+
+    std::cout << "[INFO] Done in " << std::fixed << std::setprecision(3)
+              << wall << " s, " << std::setprecision(1) << chunks / wall
+              << " chunks/s, " << solid << " solid blocks" << std::endl;
+
+    std::cout << "[INFO] Time per stage (summed over threads):" << std::endl;
+    printStage("climate", total.climate, chunks);
+    printStage("heightmap", total.heightmap, chunks);
+    printStage("density", total.density, chunks);
+    printStage("fill", total.fill, chunks);
+    printStage("decorate", total.decorate, chunks);
+
+    size_t peakRss = getPeakRss();
+    if (peakRss != 0) {
+        std::cout << "[INFO] Peak RSS: " << std::setprecision(1)
+                  << peakRss / (1024.0 * 1024.0) << " MiB" << std::endl;
+    } else {
+        std::cout << "[INFO] Peak RSS: unknown" << std::endl;
+    }
+
+    return 0;
+}
@@ -135,7 +135,7 @@ bool SimulatedBoxCollider::checkCollision(const BlockRange &range,
                                           World &world) {
     bool willCollide = false;
     range.visit([&](glm::ivec3 pos) {
-        if (world.getBlock(pos) != Block::AIR) {
+        if (isSolid(world.getBlock(pos))) {
             willCollide = true;
             return false;
         } else {
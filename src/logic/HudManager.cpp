@@ -9,7 +9,8 @@ using namespace logic;
 HudManager::HudManager(std::shared_ptr<AtlasManager> atlas) : atlas{atlas} {
     selected_block = 0;
 
-    for (int i = 1; i < 8; i++) {
+    // One slot per block, air excluded
+    for (int i = 1; i < BLOCK_COUNT; i++) {
         std::vector<uint16_t> indices = {0, 1, 2, 3, 2, 1,  4, 5,  6,
                                          4, 6, 7, 8, 9, 10, 8, 10, 11};
         std::vector<UiVertex> vertices;
@@ -52,45 +53,18 @@ HudManager::HudManager(std::shared_ptr<AtlasManager> atlas) : atlas{atlas} {
         "assets/cursor.png", VK_FORMAT_R8G8B8A8_SRGB);
 }
 
-void HudManager::addToModelList(std::list<render::UiModel>& uiModels) {
+void HudManager::addToRenderQueue(render::RenderQueue& queue) {
     glm::vec2 center = {0, 0};
-    uiModels.push_back(UiModel{pointerMesh, pointerTexture, center, CENTER});
+    queue.push(UiModel{&pointerMesh, &pointerTexture, center, CENTER});
 
     glm::vec2 pos = {-585, -200};
     for (auto const& mesh : uiCubeMeshes) {
-        uiModels.push_back(
-            UiModel{mesh, atlas->getAtlas(), pos, BOTTOM_CENTER});
+        queue.push(UiModel{&mesh, &atlas->getAtlas(), pos, BOTTOM_CENTER});
         pos.x = pos.x + 200;
     }
 
-    pos = {-585, -100};
-
-    if (selected_block == 1) {
-        uiModels.push_back(
-            UiModel{pointerMesh, cursorTexture, pos, BOTTOM_CENTER});
-    } else if (selected_block == 2) {
-        pos = {-385, -100};
-        uiModels.push_back(
-            UiModel{pointerMesh, cursorTexture, pos, BOTTOM_CENTER});
-    } else if (selected_block == 3) {
-        pos = {-185, -100};
-        uiModels.push_back(
-            UiModel{pointerMesh, cursorTexture, pos, BOTTOM_CENTER});
-    } else if (selected_block == 4) {
-        pos = {15, -100};
-        uiModels.push_back(
-            UiModel{pointerMesh, cursorTexture, pos, BOTTOM_CENTER});
-    } else if (selected_block == 5) {
-        pos = {215, -100};
-        uiModels.push_back(
-            UiModel{pointerMesh, cursorTexture, pos, BOTTOM_CENTER});
-    } else if (selected_block == 6) {
-        pos = {415, -100};
-        uiModels.push_back(
-            UiModel{pointerMesh, cursorTexture, pos, BOTTOM_CENTER});
-    } else if (selected_block == 7) {
-        pos = {615, -100};
-        uiModels.push_back(
-            UiModel{pointerMesh, cursorTexture, pos, BOTTOM_CENTER});
+    if (selected_block >= 1 && selected_block < BLOCK_COUNT) {
+        pos = {-585 + 200 * (selected_block - 1), -100};
+        queue.push(UiModel{&pointerMesh, &cursorTexture, pos, BOTTOM_CENTER});
     }
 }
\ No newline at end of file
@@ -14,7 +14,7 @@ public:
         return std::make_unique<HudManager>(atlas);
     }
     HudManager(std::shared_ptr<world::AtlasManager> atlas);
-    void addToModelList(std::list<render::UiModel>& uiModels);
+    void addToRenderQueue(render::RenderQueue& queue);
     void setSelectedBlock(int block) { selected_block = block; }
 
 private:
@@ -60,17 +60,17 @@ void PlayerController::update(World &world, const Window::InputState &input) {
 
     Camera camera = getCamera();
 
-    Block block_map[10] = {Block::AIR,         Block::GRASS,    Block::DIRT,
-                           Block::COBBLESTONE, Block::WOOD_LOG, Block::LEAF,
-                           Block::CHERRY_LEAF, Block::DIAMOND,  Block::AIR,
-                           Block::AIR};
+    // Hotbar slots map straight to blocks, empty slots place nothing
+    Block selected = input.selected_block < BLOCK_COUNT
+                         ? static_cast<Block>(input.selected_block)
+                         : Block::AIR;
 
     VoxelRaytracer tracer(camera.pos, camera.computeViewDir());
     for (int i = 0; i < MAX_RAY_DISTANCE; i++) {
         auto hit = tracer.getNextHit();
         auto block = world.getBlock(hit.pos);
 
-        if (block != Block::AIR) {
+        if (isSolid(block)) {
             // We hit something
             if (input.destroy && actionTimer == 0) {
                 world.updateBlock(hit.pos, Block::AIR);
@@ -81,7 +81,7 @@ void PlayerController::update(World &world, const Window::InputState &input) {
                 auto pos = hit.pos + hit.dir;
                 if (!collider.getCollider().getBlockRange().isInside(pos)) {
                     actionTimer = ACTION_TIMER_REFILL;
-                    world.updateBlock(pos, block_map[input.selected_block]);
+                    world.updateBlock(pos, selected);
                 }
             }
 
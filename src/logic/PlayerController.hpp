@@ -31,6 +31,7 @@ public:
     void unstuck(world::World &world) { collider.unstuck(world); }
 
     glm::vec3 getPos() const { return collider.getPos(); }
+    glm::vec3 getSpeed() const { return collider.getSpeed(); }
 
     render::Camera getCamera() const {
         return render::Camera{
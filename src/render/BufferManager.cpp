@@ -3,8 +3,10 @@
 #include <stb_image.h>
 #include <vulkan/vulkan_core.h>
 
+#include <algorithm>
 #include <cstring>
 #include <stdexcept>
+#include <utility>
 
 #include "Context.hpp"
 #include "Managed.hpp"
@@ -14,23 +16,69 @@ using namespace render;
 
 std::unique_ptr<BufferManager> BufferManager::INSTANCE;
 
-BufferManager::BufferManager(size_t uboPoolSize, size_t texturePoolSize) {
+BufferManager::BufferManager(size_t uboPoolSize) {
     createCommandPool();
     createCommandBuffer();
     createSyncObjects();
 
+    uploader = std::make_unique<Uploader>(createBuffer(
+        Uploader::STAGING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VMA_MEMORY_USAGE_AUTO,
+        VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT));
+
+    // Defragmentation copies within the heap buffers, so they are both
+    // sources and destinations of transfers
+    VkBufferUsageFlags heapUsage =
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    VkDeviceSize vertexSize = GeometryHeap::VERTEX_BUFFER_SIZE;
+    VkDeviceSize indexSize =
+        GeometryHeap::INDEX_CAPACITY * GeometryHeap::INDEX_STRIDE;
+    geometryHeap = std::make_unique<GeometryHeap>(
+        createBuffer(vertexSize, heapUsage | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                     VMA_MEMORY_USAGE_AUTO, 0, true),
+        createBuffer(indexSize, heapUsage | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                     VMA_MEMORY_USAGE_AUTO, 0, true));
+
     // Create ubo stuff
     createUboLayout();
     createUboDescriptorPool(uboPoolSize);
     createUboDescriptorSets(uboPoolSize);
 
     // Create texture stuff
+    textureCapacity = std::min(
+        MAX_TEXTURES, Context::get().getDeviceInfo().maxTextureTableSize);
     createTextureLayout();
-    createTextureDescriptorPool(texturePoolSize);
-    createTextureDescriptorSets(texturePoolSize);
+    createTextureDescriptorPool();
+    createTextureTable();
 }
 
-void BufferManager::performDeferOps() { meshDefer.clear(); }
+void BufferManager::performDeferOps(uint32_t frameInFlight) {
+    // A mesh may be dropped before its upload is done, the copy still
+    // writes into it. Those stay until the next time around.
+    uint64_t completedBatch = uploader->getCompletedBatch();
+
+    auto& meshes = meshDefer[frameInFlight];
+    for (size_t i = meshes.size(); i-- > 0;) {
+        if (isUploaded(meshes[i])) {
+            if (meshes[i].isInHeap())
+                geometryHeap->free(meshes[i].heap.index, completedBatch);
+
+            std::swap(meshes[i], meshes.back());
+            meshes.pop_back();
+        }
+    }
+
+    // The last frame that could sample these textures is done, so their
+    // slots can be written again
+    auto& textures = textureDefer[frameInFlight];
+    for (const auto& texture : textures) freeTextures.push_back(texture.index);
+    textures.clear();
+
+    deferFrame = frameInFlight;
+
+    geometryHeap->performDeferOps(frameInFlight, completedBatch);
+    geometryHeap->defragment(*uploader, completedBatch);
+}
 
 BaseMesh BufferManager::allocateMeshInner(
     const void* indicesData, size_t indicesDataSize, size_t indicesCount,
@@ -40,39 +88,121 @@ BaseMesh BufferManager::allocateMeshInner(
     VkDeviceSize vertexOffset = 0;
     VkDeviceSize indicesOffset = vertexDataSize;
 
-    // First create and fill up staging buffer
-    ManagedBuffer stagingBuffer = createBuffer(
-        bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_AUTO,
-        VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
-
-    void* data;
-    vmaMapMemory(Context::get().getVma(), stagingBuffer.getMemory(), &data);
+    ManagedBuffer buffer = createBuffer(
+        bufferSize,
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VMA_MEMORY_USAGE_AUTO, 0, true);
 
-    std::memcpy(reinterpret_cast<uint8_t*>(data) + vertexOffset, vertexData,
-                vertexDataSize);
-    std::memcpy(reinterpret_cast<uint8_t*>(data) + indicesOffset, indicesData,
-                indicesDataSize);
+    // The two halves end up in different batches if the staging ring fills
+    // up in between, the mesh is ready when the last one is done
+    uint64_t vertexBatch =
+        uploader->upload(*buffer, vertexOffset, vertexData, vertexDataSize);
+    uint64_t indicesBatch =
+        uploader->upload(*buffer, indicesOffset, indicesData, indicesDataSize);
 
-    vmaUnmapMemory(Context::get().getVma(), stagingBuffer.getMemory());
+    uint64_t uploadBatch = std::max(vertexBatch, indicesBatch);
 
-    // Then create actual buffer
-    ManagedBuffer buffer = createBuffer(bufferSize,
-                                        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
-                                            VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
-                                            VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-                                        VMA_MEMORY_USAGE_AUTO, 0);
+    return {std::move(buffer), vertexOffset, indicesOffset, vertexCount,
+            indicesCount, uploadBatch};
+}
 
-    // Finally copy the buffer and transfer to graphics queue
-    startRecording();
-    copyBuffer(*stagingBuffer, *buffer, bufferSize);
-    submitAndWait();
+GeometryMesh BufferManager::allocateGeometryMesh(
+    const std::vector<uint16_t>& indices,
+    const std::vector<GeometryVertex>& vertices) {
+    std::vector<DepthVertex> depth;
+    std::vector<SurfaceVertex> surface;
+    GeometryMesh::splitVertices(vertices, depth, surface);
+
+    // One after the other, in front of the indices
+    size_t depthSize = depth.size() * sizeof(DepthVertex);
+    size_t surfaceSize = surface.size() * sizeof(SurfaceVertex);
+    std::vector<uint8_t> streams(depthSize + surfaceSize);
+    if (depthSize > 0) std::memcpy(streams.data(), depth.data(), depthSize);
+    if (surfaceSize > 0)
+        std::memcpy(streams.data() + depthSize, surface.data(), surfaceSize);
+
+    GeometryMesh mesh{allocateMeshInner(
+        indices.data(), indices.size() * sizeof(uint16_t), indices.size(),
+        streams.data(), streams.size(), vertices.size())};
+    mesh.surfaceOffset = mesh.vertexOffset + depthSize;
+
+    // Needed for culling
+    mesh.computeBounds(vertices);
+
+    return mesh;
+}
 
-    return {std::move(buffer), vertexOffset, indicesOffset, vertexCount,
-            indicesCount};
+GeometryMesh BufferManager::allocateHeapMesh(
+    const std::vector<uint16_t>& indices,
+    const std::vector<GeometryVertex>& vertices) {
+    uint32_t handle = geometryHeap->allocate(vertices.size(), indices.size());
+    if (handle == HeapHandle::NONE)
+        return allocateMesh<GeometryMesh>(indices, vertices);
+
+    const auto& allocation = geometryHeap->get(handle);
+
+    std::vector<DepthVertex> depth;
+    std::vector<SurfaceVertex> surface;
+    GeometryMesh::splitVertices(vertices, depth, surface);
+
+    uint64_t depthBatch = uploader->upload(
+        geometryHeap->getVertexBuffer(),
+        GeometryHeap::DEPTH_BASE +
+            allocation.vertexOffset * GeometryHeap::DEPTH_STRIDE,
+        depth.data(), depth.size() * sizeof(DepthVertex));
+    uint64_t surfaceBatch = uploader->upload(
+        geometryHeap->getVertexBuffer(),
+        GeometryHeap::SURFACE_BASE +
+            allocation.vertexOffset * GeometryHeap::SURFACE_STRIDE,
+        surface.data(), surface.size() * sizeof(SurfaceVertex));
+    uint64_t indicesBatch = uploader->upload(
+        geometryHeap->getIndexBuffer(),
+        allocation.indexOffset * GeometryHeap::INDEX_STRIDE, indices.data(),
+        indices.size() * sizeof(uint16_t));
+
+    GeometryMesh mesh;
+    mesh.heap = HeapHandle{handle};
+    mesh.vertexCount = vertices.size();
+    mesh.indexCount = indices.size();
+    mesh.uploadBatch = std::max({depthBatch, surfaceBatch, indicesBatch});
+    geometryHeap->setUploadBatch(handle, mesh.uploadBatch);
+
+    // Needed for culling
+    mesh.computeBounds(vertices);
+
+    return mesh;
 }
 
 void BufferManager::deallocateMeshDefer(BaseMesh&& mesh) {
-    meshDefer.push_back(std::move(mesh));
+    meshDefer[deferFrame].push_back(std::move(mesh));
+}
+
+void BufferManager::deallocateTextureDefer(Texture&& texture) {
+    if (texture.image.image.isNull()) return;
+    textureDefer[deferFrame].push_back(
+        {std::move(texture.image.image), std::move(texture.image.view),
+         std::move(texture.sampler), texture.index});
+}
+
+Texture& Texture::operator=(Texture&& other) {
+    if (this == &other) return *this;
+
+    if (!image.image.isNull())
+        BufferManager::get().deallocateTextureDefer(std::move(*this));
+    image = std::move(other.image);
+    sampler = std::move(other.sampler);
+    index = other.index;
+    return *this;
+}
+
+Texture::~Texture() {
+    if (!image.image.isNull())
+        BufferManager::get().deallocateTextureDefer(std::move(*this));
+}
+
+bool BufferManager::isUploaded(const BaseMesh& mesh) const {
+    return mesh.uploadBatch <= uploader->getCompletedBatch();
 }
 
 Ubo BufferManager::allocateUbo(size_t size) {
@@ -108,13 +238,35 @@ Ubo BufferManager::allocateUbo(size_t size) {
     return {std::move(buffer), descriptor, ptr, size};
 }
 
-Image BufferManager::allocateDepthImage(uint32_t width, uint32_t height) {
+HostBuffer BufferManager::allocateHostBuffer(VkDeviceSize size,
+                                             VkBufferUsageFlags usage,
+                                             bool readback) {
+    // Sequential write memory may be uncached, awful to read from
+    VmaAllocationCreateFlags flags =
+        readback ? VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT
+                 : VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+    ManagedBuffer buffer =
+        createBuffer(size, usage, VMA_MEMORY_USAGE_AUTO, flags);
+
+    void* ptr;
+    vmaMapMemory(Context::get().getVma(), buffer.getMemory(), &ptr);
+
+    return {std::move(buffer), ptr, size};
+}
+
+ManagedBuffer BufferManager::allocateDeviceBuffer(VkDeviceSize size,
+                                                 VkBufferUsageFlags usage) {
+    return createBuffer(size, usage, VMA_MEMORY_USAGE_AUTO, 0);
+}
+
+Image BufferManager::allocateDepthImage(uint32_t width, uint32_t height,
+                                        VkImageUsageFlags usage) {
     VkFormat format = Context::get().getDeviceInfo().depthFormat;
 
     ManagedImage image =
         createImage(width, height, format,
                     VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
-                        VK_IMAGE_USAGE_SAMPLED_BIT,
+                        VK_IMAGE_USAGE_SAMPLED_BIT | usage,
                     VMA_MEMORY_USAGE_AUTO, 0);
 
     startRecording();
@@ -184,6 +336,26 @@ Image BufferManager::allocateImage(const uint8_t* pixels, uint32_t height,
     return {std::move(image), std::move(imageView), width, height, format};
 }
 
+Image BufferManager::allocateStorageImage(uint32_t width, uint32_t height,
+                                          uint32_t mipLevels, VkFormat format) {
+    ManagedImage image = createImage(
+        width, height, format,
+        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        VMA_MEMORY_USAGE_AUTO, 0, mipLevels);
+
+    ManagedImageView imageView = createImageView(
+        *image, format, VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels);
+
+    return {std::move(image), std::move(imageView), width, height, format,
+            mipLevels};
+}
+
+ManagedImageView BufferManager::allocateMipView(const Image& image,
+                                                uint32_t level) {
+    return createImageView(*image.image, image.format,
+                           VK_IMAGE_ASPECT_COLOR_BIT, level, 1);
+}
+
 Texture BufferManager::allocateTexture(const std::string& path,
                                        VkFormat format) {
     Image image = allocateImage(path, format);
@@ -213,36 +385,15 @@ Texture BufferManager::allocateTexture(const std::string& path,
                         &*sampler) != VK_SUCCESS)
         throw std::runtime_error{"failed to create texture sampler!"};
 
-    if (textureDescriptorSets.size() == 0)
-        throw std::runtime_error{"not enough descriptor sets!"};
-
-    VkDescriptorSet descriptor = textureDescriptorSets.back();
-    textureDescriptorSets.pop_back();
-
-    VkDescriptorImageInfo imageInfo{};
-    imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    imageInfo.imageView = *image.view;
-    imageInfo.sampler = *sampler;
+    uint32_t index = addToTextureTable(
+        *image.view, *sampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
-    VkWriteDescriptorSet descriptorWrite{};
-    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    descriptorWrite.dstSet = descriptor;
-    descriptorWrite.dstBinding = 0;
-    descriptorWrite.dstArrayElement = 0;
-    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    descriptorWrite.descriptorCount = 1;
-    descriptorWrite.pBufferInfo = nullptr;
-    descriptorWrite.pImageInfo = &imageInfo;
-    descriptorWrite.pTexelBufferView = nullptr;
-
-    vkUpdateDescriptorSets(Context::get().getDevice(), 1, &descriptorWrite, 0,
-                           nullptr);
-
-    return {std::move(image), std::move(sampler), descriptor};
+    return {std::move(image), std::move(sampler), index};
 }
 
-Texture BufferManager::allocateDepthTexture(uint32_t width, uint32_t height) {
-    Image image = allocateDepthImage(width, height);
+Texture BufferManager::allocateDepthTexture(uint32_t width, uint32_t height,
+                                            VkImageUsageFlags usage) {
+    Image image = allocateDepthImage(width, height, usage);
 
     VkSamplerCreateInfo createInfo{};
     createInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
@@ -269,32 +420,11 @@ Texture BufferManager::allocateDepthTexture(uint32_t width, uint32_t height) {
                         &*sampler) != VK_SUCCESS)
         throw std::runtime_error{"failed to create texture sampler!"};
 
-    if (textureDescriptorSets.size() == 0)
-        throw std::runtime_error{"not enough descriptor sets!"};
-
-    VkDescriptorSet descriptor = textureDescriptorSets.back();
-    textureDescriptorSets.pop_back();
-
-    VkDescriptorImageInfo imageInfo{};
-    imageInfo.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
-    imageInfo.imageView = *image.view;
-    imageInfo.sampler = *sampler;
-
-    VkWriteDescriptorSet descriptorWrite{};
-    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    descriptorWrite.dstSet = descriptor;
-    descriptorWrite.dstBinding = 0;
-    descriptorWrite.dstArrayElement = 0;
-    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    descriptorWrite.descriptorCount = 1;
-    descriptorWrite.pBufferInfo = nullptr;
-    descriptorWrite.pImageInfo = &imageInfo;
-    descriptorWrite.pTexelBufferView = nullptr;
-
-    vkUpdateDescriptorSets(Context::get().getDevice(), 1, &descriptorWrite, 0,
-                           nullptr);
+    uint32_t index =
+        addToTextureTable(*image.view, *sampler,
+                          VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
 
-    return {std::move(image), std::move(sampler), descriptor};
+    return {std::move(image), std::move(sampler), index};
 }
 
 void BufferManager::createCommandPool() {
@@ -388,15 +518,31 @@ void BufferManager::createUboDescriptorSets(uint32_t size) {
 void BufferManager::createTextureLayout() {
     VkDescriptorSetLayoutBinding samplerLayoutBinding{};
     samplerLayoutBinding.binding = 0;
-    samplerLayoutBinding.descriptorCount = 1;
+    samplerLayoutBinding.descriptorCount = textureCapacity;
     samplerLayoutBinding.descriptorType =
         VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
     samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
     samplerLayoutBinding.pImmutableSamplers = nullptr;
 
+    // Slots are filled as textures are allocated, while the table is bound
+    // in frames still in flight
+    VkDescriptorBindingFlagsEXT bindingFlags =
+        VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT |
+        VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT |
+        VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT;
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo{};
+    bindingFlagsInfo.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+    bindingFlagsInfo.bindingCount = 1;
+    bindingFlagsInfo.pBindingFlags = &bindingFlags;
+
     VkDescriptorSetLayoutCreateInfo descriptorSetLayoutInfo{};
     descriptorSetLayoutInfo.sType =
         VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descriptorSetLayoutInfo.pNext = &bindingFlagsInfo;
+    descriptorSetLayoutInfo.flags =
+        VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
     descriptorSetLayoutInfo.bindingCount = 1;
     descriptorSetLayoutInfo.pBindings = &samplerLayoutBinding;
 
@@ -407,51 +553,95 @@ void BufferManager::createTextureLayout() {
             "failed to create descriptor set layout info!"};
 }
 
-void BufferManager::createTextureDescriptorPool(uint32_t size) {
+void BufferManager::createTextureDescriptorPool() {
     VkDescriptorPoolSize combinedSamplerPoolSize{};
     combinedSamplerPoolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    combinedSamplerPoolSize.descriptorCount = size;
+    combinedSamplerPoolSize.descriptorCount = textureCapacity;
 
     VkDescriptorPoolCreateInfo poolInfo{};
     poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
     poolInfo.poolSizeCount = 1;
     poolInfo.pPoolSizes = &combinedSamplerPoolSize;
-    poolInfo.maxSets = size;
+    poolInfo.maxSets = 1;
 
     if (vkCreateDescriptorPool(Context::get().getDevice(), &poolInfo, nullptr,
                                &*textureDescriptorPool) != VK_SUCCESS)
         throw std::runtime_error{"failed to create descriptor pool!"};
 }
 
-void BufferManager::createTextureDescriptorSets(uint32_t size) {
-    std::vector<VkDescriptorSetLayout> layouts;
-    layouts.resize(size, *textureLayout);
-
-    textureDescriptorSets.resize(size);
+void BufferManager::createTextureTable() {
+    VkDescriptorSetLayout layout = *textureLayout;
 
     VkDescriptorSetAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
     allocInfo.descriptorPool = *textureDescriptorPool;
-    allocInfo.descriptorSetCount = size;
-    allocInfo.pSetLayouts = layouts.data();
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &layout;
 
     if (vkAllocateDescriptorSets(Context::get().getDevice(), &allocInfo,
-                                 textureDescriptorSets.data()) != VK_SUCCESS)
+                                 &textureTable) != VK_SUCCESS)
         throw std::runtime_error{"failed to create descriptor set!"};
 }
 
+uint32_t BufferManager::addToTextureTable(VkImageView view, VkSampler sampler,
+                                          VkImageLayout layout) {
+    uint32_t index;
+    if (!freeTextures.empty()) {
+        index = freeTextures.back();
+        freeTextures.pop_back();
+    } else if (textureCount < textureCapacity) {
+        index = textureCount++;
+    } else {
+        throw std::runtime_error{"texture table is full!"};
+    }
+
+    VkDescriptorImageInfo imageInfo{};
+    imageInfo.imageLayout = layout;
+    imageInfo.imageView = view;
+    imageInfo.sampler = sampler;
+
+    VkWriteDescriptorSet descriptorWrite{};
+    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet = textureTable;
+    descriptorWrite.dstBinding = 0;
+    descriptorWrite.dstArrayElement = index;
+    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.pBufferInfo = nullptr;
+    descriptorWrite.pImageInfo = &imageInfo;
+    descriptorWrite.pTexelBufferView = nullptr;
+
+    vkUpdateDescriptorSets(Context::get().getDevice(), 1, &descriptorWrite, 0,
+                           nullptr);
+
+    return index;
+}
+
 ManagedBuffer BufferManager::createBuffer(VkDeviceSize size,
                                           VkBufferUsageFlags usage,
                                           VmaMemoryUsage vmaUsage,
-                                          VmaAllocationCreateFlags vmaFlags) {
+                                          VmaAllocationCreateFlags vmaFlags,
+                                          bool sharedWithTransfer) {
     ManagedBuffer buffer;
 
+    const auto& queues = Context::get().getDeviceInfo().queues;
+    uint32_t families[] = {queues.graphics.value(),
+                           queues.transferOrGraphics()};
+
     VkBufferCreateInfo createInfo{};
     createInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     createInfo.size = size;
     createInfo.usage = usage;
     createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
+    // Concurrent sharing saves the queue family ownership transfers
+    if (sharedWithTransfer && queues.hasDedicatedTransferQueue()) {
+        createInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        createInfo.queueFamilyIndexCount = 2;
+        createInfo.pQueueFamilyIndices = families;
+    }
+
     VmaAllocationCreateInfo allocInfo{};
     allocInfo.flags = vmaFlags;
     allocInfo.usage = vmaUsage;
@@ -468,7 +658,8 @@ ManagedImage BufferManager::createImage(uint32_t width, uint32_t height,
                                         VkFormat format,
                                         VkImageUsageFlags usage,
                                         VmaMemoryUsage vmaUsage,
-                                        VmaAllocationCreateFlags vmaFlags) {
+                                        VmaAllocationCreateFlags vmaFlags,
+                                        uint32_t mipLevels) {
     ManagedImage image;
 
     VkImageCreateInfo createInfo{};
@@ -477,7 +668,7 @@ ManagedImage BufferManager::createImage(uint32_t width, uint32_t height,
     createInfo.extent.width = width;
     createInfo.extent.height = height;
     createInfo.extent.depth = 1;
-    createInfo.mipLevels = 1;
+    createInfo.mipLevels = mipLevels;
     createInfo.arrayLayers = 1;
     createInfo.format = format;
     createInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
@@ -499,7 +690,9 @@ ManagedImage BufferManager::createImage(uint32_t width, uint32_t height,
 }
 
 ManagedImageView BufferManager::createImageView(VkImage image, VkFormat format,
-                                                VkImageAspectFlags aspect) {
+                                                VkImageAspectFlags aspect,
+                                                uint32_t baseMipLevel,
+                                                uint32_t levelCount) {
     ManagedImageView imageView;
 
     VkImageViewCreateInfo createInfo{};
@@ -508,8 +701,8 @@ ManagedImageView BufferManager::createImageView(VkImage image, VkFormat format,
     createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
     createInfo.format = format;
     createInfo.subresourceRange.aspectMask = aspect;
-    createInfo.subresourceRange.baseMipLevel = 0;
-    createInfo.subresourceRange.levelCount = 1;
+    createInfo.subresourceRange.baseMipLevel = baseMipLevel;
+    createInfo.subresourceRange.levelCount = levelCount;
     createInfo.subresourceRange.baseArrayLayer = 0;
     createInfo.subresourceRange.layerCount = 1;
 
@@ -528,14 +721,6 @@ void BufferManager::startRecording() {
     vkBeginCommandBuffer(commandBuffer, &beginInfo);
 }
 
-void BufferManager::copyBuffer(VkBuffer src, VkBuffer dst, VkDeviceSize size) {
-    VkBufferCopy copyRegion{};
-    copyRegion.srcOffset = 0;
-    copyRegion.dstOffset = 0;
-    copyRegion.size = size;
-    vkCmdCopyBuffer(commandBuffer, src, dst, 1, &copyRegion);
-}
-
 void BufferManager::copyBufferToImage(VkBuffer src, VkImage dst, uint32_t width,
                                       uint32_t height) {
     VkBufferImageCopy copyRegion{};
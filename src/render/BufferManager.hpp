@@ -2,32 +2,37 @@
 
 #include <vulkan/vulkan_core.h>
 
+#include <array>
 #include <memory>
 #include <stdexcept>
 #include <string>
+#include <type_traits>
 #include <vector>
 
+#include "Context.hpp"
+#include "GeometryHeap.hpp"
 #include "Managed.hpp"
+#include "Uploader.hpp"
 
 namespace render {
 
 struct Ubo;
 struct UboDescriptorSet;
 struct BaseMesh;
+struct GeometryMesh;
+struct HostBuffer;
 struct Image;
 struct Texture;
-struct TextureDescriptorSet;
 
 class BufferManager {
     friend class UboDescriptorSet;
-    friend class TextureDescriptorSet;
 
 private:
     static std::unique_ptr<BufferManager> INSTANCE;
 
 public:
-    static void create(size_t uboPoolSize, size_t texturePoolSize) {
-        INSTANCE.reset(new BufferManager(uboPoolSize, texturePoolSize));
+    static void create(size_t uboPoolSize) {
+        INSTANCE.reset(new BufferManager(uboPoolSize));
     }
 
     static BufferManager& get() {
@@ -40,44 +45,106 @@ public:
 
     static void destroy() { INSTANCE.reset(); }
 
-    void performDeferOps();
+    // Releases what was deferred the last time this frame in flight was
+    // recorded, call it once the frame's fence has signalled. Until the next
+    // call, deferred resources are tied to this frame.
+    void performDeferOps(uint32_t frameInFlight);
+
+    // Submits the mesh uploads queued since the last call, never waits
+    void flushUploads() { uploader->flush(); }
+    // Semaphores of the uploads completed since the last call, see Uploader
+    std::vector<VkSemaphore> takeCompletedUploads() {
+        return uploader->takeCompleted();
+    }
+    void recycleUploadSemaphores(std::vector<VkSemaphore>& semaphores) {
+        uploader->recycle(semaphores);
+    }
 
     // Mesh stuff
     template <typename T>
     T allocateMesh(const std::vector<uint16_t>& indices,
                    const std::vector<typename T::Vertex>& vertices);
 
+    // Places the mesh in the geometry heap, so that it can be drawn
+    // indirectly along with the others. Falls back to a buffer of its own
+    // when the heap is full.
+    GeometryMesh allocateHeapMesh(const std::vector<uint16_t>& indices,
+                                  const std::vector<GeometryVertex>& vertices);
+
     void deallocateMeshDefer(BaseMesh&& mesh);
 
+    // Meshes are uploaded asynchronously, they are only drawable after this
+    bool isUploaded(const BaseMesh& mesh) const;
+
+    const GeometryHeap& getGeometryHeap() const { return *geometryHeap; }
+
+    // Host visible buffer the CPU writes every frame, like draw commands, or
+    // reads back from the GPU
+    HostBuffer allocateHostBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
+                                  bool readback = false);
+    // Buffer only the GPU reads and writes
+    ManagedBuffer allocateDeviceBuffer(VkDeviceSize size,
+                                       VkBufferUsageFlags usage);
+
     // UBO stuff
     VkDescriptorSetLayout getUboLayout() const { return *uboLayout; }
 
     Ubo allocateUbo(size_t size);
 
     // Image stuff
-    Image allocateDepthImage(uint32_t width, uint32_t height);
+    // Usage is added to the one of a sampled depth attachment
+    Image allocateDepthImage(uint32_t width, uint32_t height,
+                             VkImageUsageFlags usage = 0);
 
     Image importImage(VkImage image, uint32_t width, uint32_t height,
                       VkFormat format);
     Image allocateImage(const uint8_t* pixels, uint32_t width, uint32_t height,
                         VkFormat format);
     Image allocateImage(const std::string& path, VkFormat format);
+    // Left in VK_IMAGE_LAYOUT_UNDEFINED, the view covers every level
+    Image allocateStorageImage(uint32_t width, uint32_t height,
+                               uint32_t mipLevels, VkFormat format);
+    // View of a single level, for writing it from a compute shader
+    ManagedImageView allocateMipView(const Image& image, uint32_t level);
 
     // Texture stuff
+    // Every texture lives in a single table, bound once as a set holding a
+    // sampler2D array. Shaders pick them by Texture::index.
+    static constexpr uint32_t MAX_TEXTURES = 4096;
+    // Slots in the table, fewer than MAX_TEXTURES if the device limits it
+    uint32_t getTextureCapacity() const { return textureCapacity; }
+
     VkDescriptorSetLayout getTextureLayout() const { return *textureLayout; }
+    VkDescriptorSet getTextureTable() const { return textureTable; }
 
     Texture allocateTexture(const std::string& path, VkFormat format);
-    Texture allocateDepthTexture(uint32_t width, uint32_t height);
+    Texture allocateDepthTexture(uint32_t width, uint32_t height,
+                                 VkImageUsageFlags usage = 0);
+    // Destroys the texture and frees its slot once the frames in flight are
+    // done sampling it, see performDeferOps(). Textures call it themselves
+    // when destroyed or assigned over.
+    void deallocateTextureDefer(Texture&& texture);
 
 private:
-    BufferManager(size_t uboPoolSize, size_t texturePoolSize);
+    // What is left of a texture until no frame in flight samples it
+    struct DroppedTexture {
+        ManagedImage image;
+        ManagedImageView view;
+        ManagedSampler sampler;
+        uint32_t index;
+    };
+
+    BufferManager(size_t uboPoolSize);
 
     BaseMesh allocateMeshInner(const void* indicesData, size_t indicesDataSize,
                                size_t indicesCount, const void* vertexData,
                                size_t vertexDataSize, size_t vertexCount);
+    // Lays the vertices out as the two streams of GeometryMesh
+    GeometryMesh allocateGeometryMesh(
+        const std::vector<uint16_t>& indices,
+        const std::vector<GeometryVertex>& vertices);
 
     void releaseUboDescriptorSet(VkDescriptorSet descriptor);
-    void releaseTextureDescriptorSet(VkDescriptorSet descriptor);
 
     void createCommandPool();
     void createCommandBuffer();
@@ -88,31 +155,50 @@ private:
     void createUboDescriptorSets(uint32_t size);
 
     void createTextureLayout();
-    void createTextureDescriptorPool(uint32_t size);
-    void createTextureDescriptorSets(uint32_t size);
+    void createTextureDescriptorPool();
+    void createTextureTable();
+    // Writes the texture into a free slot of the table, returns it
+    uint32_t addToTextureTable(VkImageView view, VkSampler sampler,
+                               VkImageLayout layout);
 
+    // Buffers written by the uploader are shared with the transfer queue
     ManagedBuffer createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
                                VmaMemoryUsage vmaUsage,
-                               VmaAllocationCreateFlags vmaFlags);
+                               VmaAllocationCreateFlags vmaFlags,
+                               bool sharedWithTransfer = false);
 
     ManagedImage createImage(uint32_t width, uint32_t height, VkFormat format,
                              VkImageUsageFlags usage, VmaMemoryUsage vmaUsage,
-                             VmaAllocationCreateFlags vmaFlags);
+                             VmaAllocationCreateFlags vmaFlags,
+                             uint32_t mipLevels = 1);
 
     ManagedImageView createImageView(VkImage image, VkFormat format,
-                                     VkImageAspectFlags aspect);
+                                     VkImageAspectFlags aspect,
+                                     uint32_t baseMipLevel = 0,
+                                     uint32_t levelCount = 1);
 
     void startRecording();
-    void copyBuffer(VkBuffer src, VkBuffer dst, VkDeviceSize size);
     void copyBufferToImage(VkBuffer src, VkImage dst, uint32_t width,
                            uint32_t height);
     void transitionImageLayout(VkImage image, VkImageLayout oldLayout,
                                VkImageLayout newLayout, VkFormat format);
     void submitAndWait();
 
-    std::vector<BaseMesh> meshDefer;
-
-    std::vector<VkDescriptorSet> textureDescriptorSets;
+    std::array<std::vector<BaseMesh>, Context::FRAMES_IN_FLIGHT> meshDefer;
+    std::array<std::vector<DroppedTexture>, Context::FRAMES_IN_FLIGHT>
+        textureDefer;
+    uint32_t deferFrame{0};
+
+    // Declared first so that the uploader, waiting on its copies when
+    // destroyed, goes before the heap
+    std::unique_ptr<GeometryHeap> geometryHeap;
+    std::unique_ptr<Uploader> uploader;
+
+    VkDescriptorSet textureTable{VK_NULL_HANDLE};
+    uint32_t textureCount{0};
+    uint32_t textureCapacity{0};
+    // Slots below textureCount given back by deallocateTextureDefer()
+    std::vector<uint32_t> freeTextures;
     ManagedDescriptorSetLayout textureLayout;
     ManagedDescriptorPool textureDescriptorPool;
 
@@ -128,10 +214,14 @@ private:
 template <typename T>
 T BufferManager::allocateMesh(const std::vector<uint16_t>& indices,
                               const std::vector<typename T::Vertex>& vertices) {
-    return T{allocateMeshInner(
-        indices.data(), indices.size() * sizeof(uint16_t), indices.size(),
-        vertices.data(), vertices.size() * sizeof(typename T::Vertex),
-        vertices.size())};
+    if constexpr (std::is_same_v<T, GeometryMesh>) {
+        return allocateGeometryMesh(indices, vertices);
+    } else {
+        return T{allocateMeshInner(
+            indices.data(), indices.size() * sizeof(uint16_t), indices.size(),
+            vertices.data(), vertices.size() * sizeof(typename T::Vertex),
+            vertices.size())};
+    }
 }
 
 struct UboDescriptorSet {
@@ -147,19 +237,4 @@ struct UboDescriptorSet {
     ~UboDescriptorSet() { BufferManager::get().releaseUboDescriptorSet(inner); }
 };
 
-struct TextureDescriptorSet {
-    VkDescriptorSet inner{VK_NULL_HANDLE};
-
-    TextureDescriptorSet() {}
-    TextureDescriptorSet(const TextureDescriptorSet&) = delete;
-    TextureDescriptorSet(TextureDescriptorSet&& other) {
-        inner = other.inner;
-        other.inner = VK_NULL_HANDLE;
-    }
-
-    ~TextureDescriptorSet() {
-        BufferManager::get().releaseTextureDescriptorSet(inner);
-    }
-};
-
 }  // namespace render
\ No newline at end of file
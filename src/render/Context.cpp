@@ -1,9 +1,13 @@
 #include "Context.hpp"
 
+#include <algorithm>
 #include <cstring>
+#include <exception>
 #include <fstream>
 #include <iostream>
 #include <stdexcept>
+#include <thread>
+#include <utility>
 #include <vector>
 
 using namespace render;
@@ -17,6 +21,11 @@ std::vector<const char *> getGlfwExtensions() {
 
 std::unique_ptr<Context> Context::INSTANCE;
 
+namespace {
+// Tells our cache files apart from anything else at that path
+constexpr uint32_t PIPELINE_CACHE_MAGIC = 0x55504d43;
+}  // namespace
+
 Context::Context(GLFWwindow *window) : window{window} {
     try {
         createInstance();
@@ -24,6 +33,7 @@ Context::Context(GLFWwindow *window) : window{window} {
         deviceInfo = pickPhysicalDevice();
         createDevice();
         createVma();
+        createPipelineCache();
     } catch (...) {
         cleanup();
         throw;
@@ -33,6 +43,15 @@ Context::Context(GLFWwindow *window) : window{window} {
 Context::~Context() { cleanup(); }
 
 void Context::cleanup() {
+    // Pipelines still compiling would use the cache
+    cancelPipelines();
+
+    if (pipelineCache != VK_NULL_HANDLE) {
+        savePipelineCache();
+        vkDestroyPipelineCache(device, pipelineCache, nullptr);
+        pipelineCache = VK_NULL_HANDLE;
+    }
+
     if (vma != VK_NULL_HANDLE) {
         vmaDestroyAllocator(vma);
         vma = VK_NULL_HANDLE;
@@ -68,6 +87,13 @@ void Context::createInstance() {
 
     auto requiredExtensions = getGlfwExtensions();
     auto instanceExtensions = getInstanceExtensionSupport();
+    // Queries the features of VK_EXT_descriptor_indexing
+    if (!instanceExtensions.hasKHRGetPhysicalDeviceProperties2)
+        throw std::runtime_error{
+            "VK_KHR_get_physical_device_properties2 is not supported!"};
+    requiredExtensions.push_back(
+        VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+
     if (instanceExtensions.hasKHRPortabilityEnumeration) {
         requiredExtensions.push_back(
             VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME);
@@ -111,6 +137,12 @@ Context::DeviceInfo Context::pickPhysicalDevice() {
 
         auto support = getDeviceExtensionSupport(device);
         if (!support.hasKHRSwapchain) continue;
+        // For the texture table
+        if (!support.hasEXTDescriptorIndexing || !support.hasKHRMaintenance3)
+            continue;
+        if (!hasTextureTableFeatures(device)) continue;
+        uint32_t maxTextureTableSize = getTextureTableLimit(device);
+        if (maxTextureTableSize == 0) continue;
 
         auto surfaceFormat = chooseSurfaceFormat(device);
         if (!surfaceFormat.has_value()) continue;
@@ -134,6 +166,11 @@ Context::DeviceInfo Context::pickPhysicalDevice() {
 
         bool hasFilterAnisotropy =
             supportedFeatures.samplerAnisotropy == VK_TRUE;
+        bool hasDepthClamp = supportedFeatures.depthClamp == VK_TRUE;
+        bool hasMultiDrawIndirect =
+            supportedFeatures.multiDrawIndirect == VK_TRUE;
+        bool hasDrawIndirectFirstInstance =
+            supportedFeatures.drawIndirectFirstInstance == VK_TRUE;
 
         return DeviceInfo{queues,
                           device,
@@ -141,8 +178,13 @@ Context::DeviceInfo Context::pickPhysicalDevice() {
                           presentMode.value(),
                           depthFormat.value(),
                           hasFilterAnisotropy,
+                          hasDepthClamp,
+                          hasMultiDrawIndirect,
+                          hasDrawIndirectFirstInstance,
                           support.hasKHRDedicatedAllocation,
-                          props.limits.maxSamplerAnisotropy};
+                          support.hasKHRDrawIndirectCount,
+                          props.limits.maxSamplerAnisotropy,
+                          maxTextureTableSize};
     }
 
     throw std::runtime_error{"no suitable device found!"};
@@ -167,17 +209,41 @@ void Context::createDevice() {
         queueCreateInfos.push_back(queueCreateInfo);
     }
 
+    if (deviceInfo.queues.hasDedicatedTransferQueue()) {
+        std::cout << "[INFO] Device has dedicated transfer queue" << std::endl;
+        queueCreateInfo.queueFamilyIndex = deviceInfo.queues.transfer.value();
+        queueCreateInfos.push_back(queueCreateInfo);
+    }
+
     VkPhysicalDeviceFeatures deviceFeatures{};
     deviceFeatures.samplerAnisotropy =
         deviceInfo.hasFilterAnisotropy ? VK_TRUE : VK_FALSE;
+    deviceFeatures.depthClamp = deviceInfo.hasDepthClamp ? VK_TRUE : VK_FALSE;
+    deviceFeatures.multiDrawIndirect =
+        deviceInfo.hasMultiDrawIndirect ? VK_TRUE : VK_FALSE;
+    deviceFeatures.drawIndirectFirstInstance =
+        deviceInfo.hasDrawIndirectFirstInstance ? VK_TRUE : VK_FALSE;
+    deviceFeatures.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+
+    // What the texture table needs, checked by pickPhysicalDevice()
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures{};
+    indexingFeatures.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+    indexingFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+    indexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+    indexingFeatures.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+    indexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+    indexingFeatures.runtimeDescriptorArray = VK_TRUE;
 
     VkDeviceCreateInfo deviceCreateInfo{};
     deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    deviceCreateInfo.pNext = &indexingFeatures;
     deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
     deviceCreateInfo.queueCreateInfoCount = queueCreateInfos.size();
 
     std::vector<const char *> requiredExtensions{
-        VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+        VK_KHR_SWAPCHAIN_EXTENSION_NAME, VK_KHR_MAINTENANCE3_EXTENSION_NAME,
+        VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME};
     if (deviceInfo.hasKHRDedicatedAllocation) {
         std::cout << "[INFO] Enabling VK_KHR_dedicated_allocation" << std::endl;
         requiredExtensions.push_back(
@@ -185,6 +251,10 @@ void Context::createDevice() {
         requiredExtensions.push_back(
             VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME);
     }
+    if (deviceInfo.hasKHRDrawIndirectCount) {
+        std::cout << "[INFO] Enabling VK_KHR_draw_indirect_count" << std::endl;
+        requiredExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    }
 
     deviceCreateInfo.enabledExtensionCount = requiredExtensions.size();
     deviceCreateInfo.ppEnabledExtensionNames = requiredExtensions.data();
@@ -199,6 +269,16 @@ void Context::createDevice() {
                      &graphicsQueue);
     vkGetDeviceQueue(device, deviceInfo.queues.present.value(), 0,
                      &presentQueue);
+    vkGetDeviceQueue(device, deviceInfo.queues.transferOrGraphics(), 0,
+                     &transferQueue);
+
+    // Extension commands are not exported by the loader
+    if (deviceInfo.hasKHRDrawIndirectCount) {
+        PFN_vkVoidFunction function =
+            vkGetDeviceProcAddr(device, "vkCmdDrawIndexedIndirectCountKHR");
+        cmdDrawIndexedIndirectCount =
+            reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(function);
+    }
 }
 
 void Context::createVma() {
@@ -223,12 +303,17 @@ Context::InstanceExtensions Context::getInstanceExtensionSupport() {
     std::vector<VkExtensionProperties> properties{count};
     vkEnumerateInstanceExtensionProperties(nullptr, &count, properties.data());
 
-    InstanceExtensions support;
+    InstanceExtensions support{};
 
     for (auto &extension : properties) {
         if (std::strcmp(extension.extensionName,
                         VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME) == 0)
             support.hasKHRPortabilityEnumeration = true;
+
+        if (std::strcmp(
+                extension.extensionName,
+                VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0)
+            support.hasKHRGetPhysicalDeviceProperties2 = true;
     }
 
     return support;
@@ -260,7 +345,7 @@ Context::DeviceExtensions Context::getDeviceExtensionSupport(
     vkEnumerateDeviceExtensionProperties(device, nullptr, &count,
                                          properties.data());
 
-    DeviceExtensions support;
+    DeviceExtensions support{};
 
     for (auto &extension : properties) {
         if (std::strcmp(extension.extensionName,
@@ -270,11 +355,71 @@ Context::DeviceExtensions Context::getDeviceExtensionSupport(
         if (std::strcmp(extension.extensionName,
                         VK_KHR_DEDICATED_ALLOCATION_EXTENSION_NAME) == 0)
             support.hasKHRDedicatedAllocation = true;
+
+        if (std::strcmp(extension.extensionName,
+                        VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME) == 0)
+            support.hasKHRDrawIndirectCount = true;
+
+        if (std::strcmp(extension.extensionName,
+                        VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) == 0)
+            support.hasEXTDescriptorIndexing = true;
+
+        if (std::strcmp(extension.extensionName,
+                        VK_KHR_MAINTENANCE3_EXTENSION_NAME) == 0)
+            support.hasKHRMaintenance3 = true;
     }
 
     return support;
 }
 
+bool Context::hasTextureTableFeatures(VkPhysicalDevice device) {
+    // Instance extension commands are not exported by the loader either
+    auto getFeatures2 = reinterpret_cast<PFN_vkGetPhysicalDeviceFeatures2KHR>(
+        vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2KHR"));
+    if (!getFeatures2) return false;
+
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures{};
+    indexingFeatures.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+
+    VkPhysicalDeviceFeatures2KHR features{};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+    features.pNext = &indexingFeatures;
+    getFeatures2(device, &features);
+
+    return features.features.shaderSampledImageArrayDynamicIndexing &&
+           indexingFeatures.shaderSampledImageArrayNonUniformIndexing &&
+           indexingFeatures.descriptorBindingSampledImageUpdateAfterBind &&
+           indexingFeatures.descriptorBindingUpdateUnusedWhilePending &&
+           indexingFeatures.descriptorBindingPartiallyBound &&
+           indexingFeatures.runtimeDescriptorArray;
+}
+
+uint32_t Context::getTextureTableLimit(VkPhysicalDevice device) {
+    auto getProperties2 =
+        reinterpret_cast<PFN_vkGetPhysicalDeviceProperties2KHR>(
+            vkGetInstanceProcAddr(instance,
+                                  "vkGetPhysicalDeviceProperties2KHR"));
+    if (!getProperties2) return 0;
+
+    VkPhysicalDeviceDescriptorIndexingPropertiesEXT indexingProperties{};
+    indexingProperties.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+
+    VkPhysicalDeviceProperties2KHR properties{};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+    properties.pNext = &indexingProperties;
+    getProperties2(device, &properties);
+
+    // A combined image sampler counts as both a sampler and an image
+    return std::min(
+        {indexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers,
+         indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+         indexingProperties.maxPerStageUpdateAfterBindResources,
+         indexingProperties.maxDescriptorSetUpdateAfterBindSamplers,
+         indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages});
+}
+
 Context::QueueFamilies Context::getDeviceQueueFamilies(
     VkPhysicalDevice device) {
     uint32_t count = 0;
@@ -299,6 +444,15 @@ Context::QueueFamilies Context::getDeviceQueueFamilies(
         i++;
     }
 
+    for (i = 0; i < count; i++) {
+        VkQueueFlags flags = properties[i].queueFlags;
+        if ((flags & VK_QUEUE_TRANSFER_BIT) &&
+            !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+            indices.transfer = i;
+            break;
+        }
+    }
+
     return indices;
 }
 
@@ -390,3 +544,133 @@ VkShaderModule Context::loadShaderModule(const uint32_t *code,
 }
 
 void Context::waitDeviceIdle() { vkDeviceWaitIdle(getDevice()); }
+
+void Context::createPipelineAsync(std::function<void()> create) {
+    uint32_t maxWorkers = std::clamp(std::thread::hardware_concurrency(), 1u,
+                                     MAX_PIPELINE_THREADS);
+
+    std::lock_guard<std::mutex> lock{pipelineMutex};
+    pipelineJobs.push_back(std::move(create));
+
+    // Workers only leave once the queue is empty, with the mutex held, so
+    // the running ones are bound to pick this job up
+    if (pipelineWorkersRunning < maxWorkers) {
+        pipelineWorkersRunning++;
+        pipelineWorkers.push_back(
+            std::async(std::launch::async, [this] { runPipelineJobs(); }));
+    }
+}
+
+void Context::runPipelineJobs() {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::lock_guard<std::mutex> lock{pipelineMutex};
+            if (pipelineJobs.empty()) {
+                pipelineWorkersRunning--;
+                return;
+            }
+            job = std::move(pipelineJobs.front());
+            pipelineJobs.pop_front();
+        }
+
+        // The others still run, they use the objects they belong to
+        try {
+            job();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock{pipelineMutex};
+            if (!pipelineError) pipelineError = std::current_exception();
+        }
+    }
+}
+
+void Context::waitPipelines() {
+    // Every job has to be done before rethrowing, as they use the objects
+    // they belong to
+    for (auto &worker : pipelineWorkers) worker.wait();
+    pipelineWorkers.clear();
+
+    std::exception_ptr error = std::exchange(pipelineError, nullptr);
+    if (error) std::rethrow_exception(error);
+}
+
+void Context::cancelPipelines() {
+    {
+        std::lock_guard<std::mutex> lock{pipelineMutex};
+        pipelineJobs.clear();
+    }
+    for (auto &worker : pipelineWorkers) worker.wait();
+    pipelineWorkers.clear();
+    pipelineError = nullptr;
+}
+
+void Context::createPipelineCache() {
+    VkPhysicalDeviceProperties props{};
+    vkGetPhysicalDeviceProperties(deviceInfo.device, &props);
+
+    std::vector<char> data;
+    std::ifstream is(PIPELINE_CACHE_PATH, std::ios::binary | std::ios::ate);
+    if (is) {
+        data.resize(is.tellg());
+        is.seekg(0);
+        is.read(data.data(), data.size());
+    }
+
+    // A stale or foreign cache is dropped, the driver would only reject it
+    // if it was made by another device
+    PipelineCacheHeader header{};
+    bool valid = data.size() >= sizeof(header);
+    if (valid) {
+        std::memcpy(&header, data.data(), sizeof(header));
+        valid = header.magic == PIPELINE_CACHE_MAGIC &&
+                header.vendorID == props.vendorID &&
+                header.deviceID == props.deviceID &&
+                header.driverVersion == props.driverVersion &&
+                std::memcmp(header.uuid, props.pipelineCacheUUID,
+                            VK_UUID_SIZE) == 0 &&
+                header.dataSize == data.size() - sizeof(header);
+    }
+
+    VkPipelineCacheCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    if (valid) {
+        createInfo.initialDataSize = header.dataSize;
+        createInfo.pInitialData = data.data() + sizeof(header);
+    }
+
+    if (vkCreatePipelineCache(device, &createInfo, nullptr, &pipelineCache) !=
+        VK_SUCCESS)
+        throw std::runtime_error{"failed to create pipeline cache!"};
+
+    pipelineCacheWarm = valid;
+    std::cout << "[INFO] Pipeline cache "
+              << (valid ? "loaded from disk" : "starts empty") << std::endl;
+}
+
+void Context::savePipelineCache() {
+    size_t size = 0;
+    if (vkGetPipelineCacheData(device, pipelineCache, &size, nullptr) !=
+        VK_SUCCESS)
+        return;
+
+    std::vector<char> data(size);
+    if (vkGetPipelineCacheData(device, pipelineCache, &size, data.data()) !=
+        VK_SUCCESS)
+        return;
+
+    VkPhysicalDeviceProperties props{};
+    vkGetPhysicalDeviceProperties(deviceInfo.device, &props);
+
+    PipelineCacheHeader header{};
+    header.magic = PIPELINE_CACHE_MAGIC;
+    header.vendorID = props.vendorID;
+    header.deviceID = props.deviceID;
+    header.driverVersion = props.driverVersion;
+    std::memcpy(header.uuid, props.pipelineCacheUUID, VK_UUID_SIZE);
+    header.dataSize = size;
+
+    // Failing to save only makes the next launch slower
+    std::ofstream os(PIPELINE_CACHE_PATH, std::ios::binary);
+    os.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    os.write(data.data(), size);
+}
@@ -4,7 +4,12 @@
 #include <GLFW/glfw3.h>
 #include <vk_mem_alloc.h>
 
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <stdexcept>
 #include <vector>
@@ -30,17 +35,34 @@ public:
 
     static void destroy() { INSTANCE.reset(); }
 
+    // Frames the CPU may record while the GPU is still busy with the
+    // previous ones. Anything the CPU writes per frame needs this many copies.
+    static constexpr uint32_t FRAMES_IN_FLIGHT = 2;
+
+    // Saved on exit and loaded on the next launch, so the driver does not
+    // compile the shaders again
+    static constexpr const char *PIPELINE_CACHE_PATH = "pipeline_cache.bin";
+
     ~Context();
 
     struct QueueFamilies {
         std::optional<uint32_t> graphics;
         std::optional<uint32_t> present;
+        // Only set for a family that can copy but not draw or compute,
+        // usually backed by a DMA engine
+        std::optional<uint32_t> transfer;
 
         bool isComplete() const {
             return graphics.has_value() && present.has_value();
         }
 
         bool hasDedicatedPresentQueue() const { return present != graphics; }
+        bool hasDedicatedTransferQueue() const { return transfer.has_value(); }
+
+        // Family the uploads are submitted to
+        uint32_t transferOrGraphics() const {
+            return transfer.has_value() ? transfer.value() : graphics.value();
+        }
 
         std::vector<uint32_t> indices() const {
             std::vector<uint32_t> out;
@@ -58,6 +80,20 @@ public:
 
     void waitDeviceIdle();
 
+    // Up to this many pipelines compile at once
+    static constexpr uint32_t MAX_PIPELINE_THREADS = 8;
+
+    // Queues a pipeline creation for a few worker threads, so that the
+    // pipelines of the renderer compile in parallel at startup. They can
+    // only be used once waitPipelines() has returned, which has to happen
+    // before the objects the jobs write into go away, even when unwinding.
+    void createPipelineAsync(std::function<void()> create);
+    // Rethrows the first failure among the pipelines
+    void waitPipelines();
+    // Drops the jobs not started yet and waits for the others, ignoring
+    // failures. For unwinding, see PipelineJobGuard.
+    void cancelPipelines();
+
     struct DeviceInfo {
         QueueFamilies queues;
         VkPhysicalDevice device{VK_NULL_HANDLE};
@@ -65,8 +101,16 @@ public:
         VkPresentModeKHR presentMode;
         VkFormat depthFormat;
         bool hasFilterAnisotropy;
+        bool hasDepthClamp;
+        // Several draws per indirect call, and firstInstance in them
+        bool hasMultiDrawIndirect;
+        bool hasDrawIndirectFirstInstance;
         bool hasKHRDedicatedAllocation;
+        // Indirect draws taking their draw count from a buffer
+        bool hasKHRDrawIndirectCount;
         float maxSamplerAnisotropy;
+        // Textures a shader can sample from an array updated after bind
+        uint32_t maxTextureTableSize;
     };
 
     VmaAllocator getVma() const { return vma; }
@@ -76,15 +120,39 @@ public:
     VkSurfaceKHR getSurface() const { return surface; }
     VkQueue getGraphicsQueue() const { return graphicsQueue; }
     VkQueue getPresentQueue() const { return presentQueue; }
+    // The graphics queue, if there is no dedicated transfer queue
+    VkQueue getTransferQueue() const { return transferQueue; }
     const DeviceInfo &getDeviceInfo() const { return deviceInfo; }
+    // Pass it to every pipeline creation
+    VkPipelineCache getPipelineCache() const { return pipelineCache; }
+    // Whether the cache came from disk, which makes startup faster
+    bool isPipelineCacheWarm() const { return pipelineCacheWarm; }
+
+    // Null without VK_KHR_draw_indirect_count
+    PFN_vkCmdDrawIndexedIndirectCountKHR getCmdDrawIndexedIndirectCount()
+        const {
+        return cmdDrawIndexedIndirectCount;
+    }
 
 private:
     Context(GLFWwindow *window);
 
     void cleanup();
 
+    // Written before the cache data, which the driver only checks against
+    // the device and not its driver version
+    struct PipelineCacheHeader {
+        uint32_t magic;
+        uint32_t vendorID;
+        uint32_t deviceID;
+        uint32_t driverVersion;
+        uint8_t uuid[VK_UUID_SIZE];
+        uint64_t dataSize;
+    };
+
     struct InstanceExtensions {
         bool hasKHRPortabilityEnumeration;
+        bool hasKHRGetPhysicalDeviceProperties2;
     };
 
     struct InstanceLayers {
@@ -94,6 +162,9 @@ private:
     struct DeviceExtensions {
         bool hasKHRSwapchain;
         bool hasKHRDedicatedAllocation;
+        bool hasKHRDrawIndirectCount;
+        bool hasEXTDescriptorIndexing;
+        bool hasKHRMaintenance3;
     };
 
     void createInstance();
@@ -101,10 +172,21 @@ private:
     DeviceInfo pickPhysicalDevice();
     void createDevice();
     void createVma();
+    // Starts from the cache on disk, unless it was made by another device
+    // or driver
+    void createPipelineCache();
+    void savePipelineCache();
+    // Body of the pipeline workers, runs queued jobs until there are none
+    void runPipelineJobs();
 
     InstanceExtensions getInstanceExtensionSupport();
     InstanceLayers getInstanceLayerSupport();
     DeviceExtensions getDeviceExtensionSupport(VkPhysicalDevice device);
+    // Whether the device can index a large, partially bound array of
+    // textures updated while in use, see BufferManager
+    bool hasTextureTableFeatures(VkPhysicalDevice device);
+    // Slots such an array can hold, within every limit it counts against
+    uint32_t getTextureTableLimit(VkPhysicalDevice device);
     QueueFamilies getDeviceQueueFamilies(VkPhysicalDevice device);
     std::optional<VkSurfaceFormatKHR> chooseSurfaceFormat(
         VkPhysicalDevice device);
@@ -120,8 +202,38 @@ private:
     VkDevice device{VK_NULL_HANDLE};
     VkQueue graphicsQueue{VK_NULL_HANDLE};
     VkQueue presentQueue{VK_NULL_HANDLE};
+    VkQueue transferQueue{VK_NULL_HANDLE};
+
+    PFN_vkCmdDrawIndexedIndirectCountKHR cmdDrawIndexedIndirectCount{nullptr};
+
+    VkPipelineCache pipelineCache{VK_NULL_HANDLE};
+    bool pipelineCacheWarm{false};
+    // Workers, the queue and the first failure are guarded by the mutex
+    std::vector<std::future<void>> pipelineWorkers;
+    std::mutex pipelineMutex;
+    std::deque<std::function<void()>> pipelineJobs;
+    uint32_t pipelineWorkersRunning{0};
+    std::exception_ptr pipelineError;
 
     DeviceInfo deviceInfo;
 };
 
+// Cancels the queued pipeline jobs when its scope is left by an exception.
+// The jobs write into the objects that queued them, so constructors that
+// queue jobs, or own objects that do, hold one before anything can throw.
+class PipelineJobGuard {
+public:
+    PipelineJobGuard() : exceptions{std::uncaught_exceptions()} {}
+    PipelineJobGuard(const PipelineJobGuard &) = delete;
+    PipelineJobGuard &operator=(const PipelineJobGuard &) = delete;
+
+    ~PipelineJobGuard() {
+        if (std::uncaught_exceptions() > exceptions)
+            Context::get().cancelPipelines();
+    }
+
+private:
+    int exceptions;
+};
+
 }  // namespace render
\ No newline at end of file
@@ -9,35 +9,124 @@
 
 using namespace render;
 
-ForwardPass::ForwardPass() {
+ForwardPass::ForwardPass(const JointPalette& palette, RecordPool& recordPool)
+    : recordPool{recordPool} {
+    PipelineJobGuard pipelineGuard;
+    // Occlusion culling reads the pyramid from the cull shader
+    if (IndirectDraws::supportsGpuCulling()) {
+        hiZ = std::make_unique<HiZPyramid>();
+        createDisoccludedRenderPass();
+    }
+
     createRenderPass();
     framebuffer = Swapchain::get().createFramebuffer(*renderPass);
 
     skyboxRenderer = std::make_unique<SkyboxRenderer>(*renderPass);
-    geometryRenderer = std::make_unique<GeometryRenderer>(*renderPass);
+    geometryRenderer =
+        std::make_unique<GeometryRenderer>(*renderPass, palette);
     uiRenderer = std::make_unique<UiRenderer>(*renderPass);
 }
 
 void ForwardPass::record(VkCommandBuffer commandBuffer, Swapchain::Frame frame,
-                         const Camera& camera, const Skybox& skybox,
+                         uint32_t frameInFlight, const Camera& camera,
+                         const Skybox& skybox,
                          const GeometryRenderer::LightInfo& lights,
-                         const Texture& depthTexture,
-                         std::list<GeometryModel> models,
-                         std::list<UiModel> uiModels) {
+                         const ShadowPass& shadowPass,
+                         const RenderQueue& queue) {
     VkExtent2D extent = framebuffer->getExtent();
 
     float ratio =
         static_cast<float>(extent.width) / static_cast<float>(extent.height);
 
+    if (hiZ) hiZ->resize(extent);
+
+    geometryRenderer->prepare(commandBuffer, frameInFlight, camera, ratio,
+                              queue, hiZ.get());
+
+    geometryRenderer->updateLights(frameInFlight, camera, lights, shadowPass);
+
     VkViewport viewport = framebuffer->getViewport();
     VkRect2D scissor = framebuffer->getScissor();
+    VkFramebuffer target = framebuffer->getFrame(frame.index);
+    uint32_t sliceCount = recordPool.getWorkerCount();
+
+    geometryRenderer->setOverdrawView(overdrawView);
+
+    // The geometry is split between the workers. The skybox only fills the
+    // pixels it left empty and the UI goes over everything, so both come
+    // last.
+    auto recordSlice = [&](VkCommandBuffer sliceBuffer, uint32_t slice,
+                           GeometryRenderer::Pass pass, bool disoccluded,
+                           bool last) {
+        vkCmdSetViewport(sliceBuffer, 0, 1, &viewport);
+        vkCmdSetScissor(sliceBuffer, 0, 1, &scissor);
+
+        geometryRenderer->record(sliceBuffer, frameInFlight, pass, slice,
+                                 sliceCount, disoccluded);
+        if (pass == GeometryRenderer::Pass::DEPTH || !last ||
+            slice != sliceCount - 1)
+            return;
+
+        skyboxRenderer->record(sliceBuffer, frameInFlight, camera, ratio,
+                               skybox, overdrawView);
+        uiRenderer->record(sliceBuffer, extent, queue);
+    };
+
+    // With the prepass, the depth of the geometry is laid down first, then
+    // each pixel is only shaded by the surface left in front
+    auto recordGeometry = [&](VkRenderPass pass, bool disoccluded,
+                              bool last) {
+        if (depthPrepass) {
+            recordPool.record(
+                commandBuffer, pass, target,
+                [&](VkCommandBuffer sliceBuffer, uint32_t slice) {
+                    recordSlice(sliceBuffer, slice,
+                                GeometryRenderer::Pass::DEPTH, disoccluded,
+                                last);
+                });
+        }
+
+        GeometryRenderer::Pass colorPass =
+            depthPrepass ? GeometryRenderer::Pass::COLOR_OVER_DEPTH
+                         : GeometryRenderer::Pass::COLOR;
+        recordPool.record(commandBuffer, pass, target,
+                          [&](VkCommandBuffer sliceBuffer, uint32_t slice) {
+                              recordSlice(sliceBuffer, slice, colorPass,
+                                          disoccluded, last);
+                          });
+    };
+
+    beginRenderPass(commandBuffer, *renderPass, frame.index);
+    recordGeometry(*renderPass, false, !hiZ);
+
+    if (hiZ) {
+        vkCmdEndRenderPass(commandBuffer);
+
+        // Draws hidden by the depth of the previous frame may show up in
+        // this one, test them again against what is drawn so far
+        hiZ->build(commandBuffer, frameInFlight,
+                   framebuffer->getDepthImage(frame.index),
+                   camera.computeVPMat(ratio));
+        geometryRenderer->cullDisoccluded(commandBuffer, *hiZ);
+
+        beginRenderPass(commandBuffer, *disoccludedRenderPass, frame.index);
+        recordGeometry(*disoccludedRenderPass, true, true);
+    }
+
+    vkCmdEndRenderPass(commandBuffer);
+}
+
+void ForwardPass::beginRenderPass(VkCommandBuffer commandBuffer,
+                                  VkRenderPass pass, uint32_t frameIndex) {
+    VkRect2D scissor = framebuffer->getScissor();
 
     VkRenderPassBeginInfo renderPassBeginInfo{};
     renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    renderPassBeginInfo.renderPass = *renderPass;
-    renderPassBeginInfo.framebuffer = framebuffer->getFrame(frame.index);
+    renderPassBeginInfo.renderPass = pass;
+    renderPassBeginInfo.framebuffer = framebuffer->getFrame(frameIndex);
     renderPassBeginInfo.renderArea = scissor;
 
+    // Ignored by the disoccluded pass, which loads both attachments
     VkClearValue clearValues[2] = {};
     clearValues[0].color = {0.0f, 0.0f, 0.0f, 1.0f};
     clearValues[1].depthStencil = {1.0f, 0};
@@ -46,17 +135,7 @@ void ForwardPass::record(VkCommandBuffer commandBuffer, Swapchain::Frame frame,
     renderPassBeginInfo.pClearValues = clearValues;
 
     vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo,
-                         VK_SUBPASS_CONTENTS_INLINE);
-
-    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
-    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
-
-    skyboxRenderer->record(commandBuffer, camera, ratio, skybox);
-    geometryRenderer->record(commandBuffer, camera, ratio, lights, depthTexture,
-                             models);
-    uiRenderer->record(commandBuffer, extent, uiModels);
-
-    vkCmdEndRenderPass(commandBuffer);
+                         VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 }
 
 void ForwardPass::createRenderPass() {
@@ -82,6 +161,15 @@ void ForwardPass::createRenderPass() {
     depthAttachment.finalLayout =
         VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
+    // The disoccluded pass finishes the frame, after the pyramid is built
+    // from the depth
+    if (hiZ) {
+        colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        depthAttachment.finalLayout =
+            VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+    }
+
     VkAttachmentReference colorAttachmentRef{};
     colorAttachmentRef.attachment = 0;
     colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
@@ -108,6 +196,92 @@ void ForwardPass::createRenderPass() {
     dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
                                VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 
+    // The pyramid of a previous frame may still be built from the depth
+    if (hiZ) dependency.srcStageMask |= VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+    // Then the pyramid is built from the depth of this frame
+    VkSubpassDependency hiZDependency{};
+    hiZDependency.srcSubpass = 0;
+    hiZDependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+    hiZDependency.srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    hiZDependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    hiZDependency.dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    hiZDependency.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    VkSubpassDependency dependencies[] = {dependency, hiZDependency};
+
+    VkAttachmentDescription attachments[] = {colorAttachment, depthAttachment};
+
+    VkRenderPassCreateInfo renderPassCreateInfo{};
+    renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    renderPassCreateInfo.attachmentCount = 2;
+    renderPassCreateInfo.pAttachments = attachments;
+    renderPassCreateInfo.subpassCount = 1;
+    renderPassCreateInfo.pSubpasses = &subpass;
+    renderPassCreateInfo.dependencyCount = hiZ ? 2 : 1;
+    renderPassCreateInfo.pDependencies = dependencies;
+    if (vkCreateRenderPass(Context::get().getDevice(), &renderPassCreateInfo,
+                           nullptr, &*renderPass) != VK_SUCCESS)
+        throw std::runtime_error{"failed to create render pass!"};
+}
+
+void ForwardPass::createDisoccludedRenderPass() {
+    // Compatible with the first pass, so they share pipelines and
+    // framebuffers
+    VkAttachmentDescription colorAttachment{};
+    colorAttachment.format =
+        Context::get().getDeviceInfo().surfaceFormat.format;
+    colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+    VkAttachmentDescription depthAttachment{};
+    depthAttachment.format = Context::get().getDeviceInfo().depthFormat;
+    depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.initialLayout =
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+    depthAttachment.finalLayout =
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference colorAttachmentRef{};
+    colorAttachmentRef.attachment = 0;
+    colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference depthAttachmentRef{};
+    depthAttachmentRef.attachment = 1;
+    depthAttachmentRef.layout =
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkSubpassDescription subpass{};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &colorAttachmentRef;
+    subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+    // Waits for the first pass, and for the pyramid build reading the depth
+    VkSubpassDependency dependency{};
+    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependency.dstSubpass = 0;
+    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                              VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT |
+                              VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                               VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                              VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+                               VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                               VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                               VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
     VkAttachmentDescription attachments[] = {colorAttachment, depthAttachment};
 
     VkRenderPassCreateInfo renderPassCreateInfo{};
@@ -119,6 +293,6 @@ void ForwardPass::createRenderPass() {
     renderPassCreateInfo.dependencyCount = 1;
     renderPassCreateInfo.pDependencies = &dependency;
     if (vkCreateRenderPass(Context::get().getDevice(), &renderPassCreateInfo,
-                           nullptr, &*renderPass) != VK_SUCCESS)
+                           nullptr, &*disoccludedRenderPass) != VK_SUCCESS)
         throw std::runtime_error{"failed to create render pass!"};
 }
\ No newline at end of file
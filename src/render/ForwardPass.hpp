@@ -6,7 +6,12 @@
 
 #include "Framebuffer.hpp"
 #include "GeometryRenderer.hpp"
+#include "HiZPyramid.hpp"
+#include "JointPalette.hpp"
 #include "Managed.hpp"
+#include "RecordPool.hpp"
+#include "RenderQueue.hpp"
+#include "ShadowPass.hpp"
 #include "SkyboxRenderer.hpp"
 #include "Swapchain.hpp"
 #include "UiRenderer.hpp"
@@ -15,18 +20,48 @@ namespace render {
 
 class ForwardPass {
 public:
-    ForwardPass();
+    ForwardPass(const JointPalette& palette, RecordPool& recordPool);
 
     void record(VkCommandBuffer commandBuffer, Swapchain::Frame frame,
-                const Camera& camera, const Skybox& skybox,
+                uint32_t frameInFlight, const Camera& camera,
+                const Skybox& skybox,
                 const GeometryRenderer::LightInfo& lights,
-                const Texture& depthTexture, std::list<GeometryModel> models,
-                std::list<UiModel> uiModels);
+                const ShadowPass& shadowPass, const RenderQueue& queue);
+
+    CullingStats getCullingStats() const {
+        return geometryRenderer->getCullingStats();
+    }
+    GeometryRenderer::RecordStats getRecordStats() const {
+        return geometryRenderer->getRecordStats();
+    }
+
+    // Draws the depth of the geometry before shading it, so that each pixel
+    // is shaded once. On by default.
+    void setDepthPrepass(bool enabled) { depthPrepass = enabled; }
+    // Shows how many times each pixel is shaded instead of the scene, to
+    // measure overdraw
+    void setOverdrawView(bool enabled) { overdrawView = enabled; }
 
 private:
     void createRenderPass();
+    // Picks up where renderPass left, for the draws hidden by the depth of
+    // the previous frame but not by the one of this frame
+    void createDisoccludedRenderPass();
+
+    // The draws are recorded by the pool, into secondary buffers
+    void beginRenderPass(VkCommandBuffer commandBuffer, VkRenderPass pass,
+                         uint32_t frameIndex);
+
+    RecordPool& recordPool;
+
+    bool depthPrepass{true};
+    bool overdrawView{false};
 
     ManagedRenderPass renderPass;
+    ManagedRenderPass disoccludedRenderPass;
+
+    // Depth of the last frame, null without GPU culling
+    std::unique_ptr<HiZPyramid> hiZ;
 
     std::shared_ptr<Framebuffer> framebuffer;
 
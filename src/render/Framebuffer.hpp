@@ -20,6 +20,11 @@ public:
         return *framebuffers[idx];
     }
 
+    const Image& getDepthImage(uint32_t idx) const {
+        assert(idx < imageCount);
+        return depthImages[idx];
+    }
+
     VkExtent2D getExtent() const { return extent; }
     VkFormat getColorFormat() const { return colorFormat; }
 
@@ -0,0 +1,109 @@
+#include "Frustum.hpp"
+
+#include <cmath>
+
+using namespace render;
+
+Frustum Frustum::fromMatrix(const glm::mat4& vp) {
+    // Rows of the matrix, glm is column major
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; i++)
+        rows[i] = glm::vec4{vp[0][i], vp[1][i], vp[2][i], vp[3][i]};
+
+    Frustum frustum;
+    frustum.planes[PLANE_LEFT] = rows[3] + rows[0];
+    frustum.planes[PLANE_RIGHT] = rows[3] - rows[0];
+    frustum.planes[PLANE_BOTTOM] = rows[3] + rows[1];
+    frustum.planes[PLANE_TOP] = rows[3] - rows[1];
+    frustum.planes[PLANE_NEAR] = rows[2];
+    frustum.planes[PLANE_FAR] = rows[3] - rows[2];
+
+    // Normalize, so that plane distances are in world units
+    for (auto& plane : frustum.planes)
+        plane /= glm::length(glm::vec3{plane});
+
+    return frustum;
+}
+
+void FrustumCuller::clear() {
+    centerX.clear();
+    centerY.clear();
+    centerZ.clear();
+    extentX.clear();
+    extentY.clear();
+    extentZ.clear();
+    radius.clear();
+}
+
+void FrustumCuller::addAabb(glm::vec3 min, glm::vec3 max) {
+    glm::vec3 center = (min + max) * 0.5f;
+    glm::vec3 extent = (max - min) * 0.5f;
+
+    centerX.push_back(center.x);
+    centerY.push_back(center.y);
+    centerZ.push_back(center.z);
+    extentX.push_back(extent.x);
+    extentY.push_back(extent.y);
+    extentZ.push_back(extent.z);
+    radius.push_back(0.0f);
+}
+
+void FrustumCuller::addSphere(glm::vec3 center, float r) {
+    centerX.push_back(center.x);
+    centerY.push_back(center.y);
+    centerZ.push_back(center.z);
+    extentX.push_back(0.0f);
+    extentY.push_back(0.0f);
+    extentZ.push_back(0.0f);
+    radius.push_back(r);
+}
+
+void FrustumCuller::addModel(const GeometryModel& model) {
+    addModel(*model.mesh, model.pos, model.rot);
+}
+
+void FrustumCuller::addModel(const GeometryMesh& mesh, glm::vec3 pos,
+                             glm::quat rot) {
+    glm::vec3 min = mesh.boundsMin;
+    glm::vec3 max = mesh.boundsMax;
+
+    if (rot == glm::quat{1.0f, 0.0f, 0.0f, 0.0f}) {
+        // Chunks are never rotated, their boxes are exact
+        addAabb(pos + min, pos + max);
+    } else {
+        // Animated models are, use a sphere around the box
+        glm::vec3 center = pos + rot * ((min + max) * 0.5f);
+        addSphere(center, glm::length(max - min) * 0.5f);
+    }
+}
+
+uint32_t FrustumCuller::cull(const Frustum& frustum) {
+    size_t count = size();
+    visible.assign(count, 1);
+
+    const float* cx = centerX.data();
+    const float* cy = centerY.data();
+    const float* cz = centerZ.data();
+    const float* ex = extentX.data();
+    const float* ey = extentY.data();
+    const float* ez = extentZ.data();
+    const float* r = radius.data();
+    uint8_t* out = visible.data();
+
+    for (const auto& plane : frustum.planes) {
+        float nx = plane.x, ny = plane.y, nz = plane.z, d = plane.w;
+        float ax = std::abs(nx), ay = std::abs(ny), az = std::abs(nz);
+
+        // No branches in here, a volume is out as soon as it is completely
+        // behind one plane
+        for (size_t i = 0; i < count; i++) {
+            float dist = nx * cx[i] + ny * cy[i] + nz * cz[i] + d;
+            float reach = ax * ex[i] + ay * ey[i] + az * ez[i] + r[i];
+            out[i] &= static_cast<uint8_t>(dist + reach >= 0.0f);
+        }
+    }
+
+    uint32_t visibleCount = 0;
+    for (size_t i = 0; i < count; i++) visibleCount += out[i];
+    return visibleCount;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "Primitives.hpp"
+
+namespace render {
+
+struct CullingStats {
+    uint32_t visible{0};
+    uint32_t culled{0};
+    // Skipped before frustum culling, as they were found to be hidden
+    uint32_t occluded{0};
+};
+
+// Planes of a view frustum, pointing inwards
+struct Frustum {
+    static constexpr int PLANE_COUNT = 6;
+    enum Plane {
+        PLANE_LEFT = 0,
+        PLANE_RIGHT,
+        PLANE_BOTTOM,
+        PLANE_TOP,
+        PLANE_NEAR,
+        PLANE_FAR
+    };
+
+    glm::vec4 planes[PLANE_COUNT];
+
+    // Stops testing against a plane, making the frustum open on that side
+    void removePlane(Plane plane) { planes[plane] = {0.0f, 0.0f, 0.0f, 1.0f}; }
+
+    // Works with any VP matrix with depth in [0, 1], perspective or ortho
+    static Frustum fromMatrix(const glm::mat4& vp);
+};
+
+// Tests a batch of bounding volumes against a frustum. Volumes are kept as a
+// structure of arrays, so the inner loop runs over plain float arrays and
+// gets vectorised by the compiler. Storage is reused across frames.
+class FrustumCuller {
+public:
+    void clear();
+
+    void addAabb(glm::vec3 min, glm::vec3 max);
+    void addSphere(glm::vec3 center, float radius);
+    // Box for unrotated models (chunks), sphere for the others
+    void addModel(const GeometryModel& model);
+    void addModel(const GeometryMesh& mesh, glm::vec3 pos, glm::quat rot);
+
+    // Returns how many volumes are at least partially inside
+    uint32_t cull(const Frustum& frustum);
+
+    size_t size() const { return centerX.size(); }
+    bool isVisible(size_t index) const { return visible[index] != 0; }
+
+private:
+    // Every volume is a box grown by a radius: spheres have no extent and
+    // boxes have no radius
+    std::vector<float> centerX, centerY, centerZ;
+    std::vector<float> extentX, extentY, extentZ;
+    std::vector<float> radius;
+
+    std::vector<uint8_t> visible;
+};
+
+}  // namespace render
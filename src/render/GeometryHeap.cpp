@@ -0,0 +1,212 @@
+#include "GeometryHeap.hpp"
+
+#include <algorithm>
+
+using namespace render;
+
+RangeAllocator::RangeAllocator(uint32_t capacity) : freeCount{capacity} {
+    freeRanges.insert({0, capacity});
+}
+
+uint32_t RangeAllocator::allocate(uint32_t count) {
+    for (auto it = freeRanges.begin(); it != freeRanges.end(); it++) {
+        if (it->second < count) continue;
+
+        uint32_t offset = it->first;
+        uint32_t remaining = it->second - count;
+        freeRanges.erase(it);
+        if (remaining > 0) freeRanges.insert({offset + count, remaining});
+
+        freeCount -= count;
+        return offset;
+    }
+
+    return INVALID;
+}
+
+void RangeAllocator::free(uint32_t offset, uint32_t count) {
+    if (count == 0) return;
+    freeCount += count;
+
+    auto next = freeRanges.lower_bound(offset);
+
+    // Merge with the range right after
+    if (next != freeRanges.end() && offset + count == next->first) {
+        count += next->second;
+        next = freeRanges.erase(next);
+    }
+
+    // And with the one right before
+    if (next != freeRanges.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == offset) {
+            prev->second += count;
+            return;
+        }
+    }
+
+    freeRanges.insert(next, {offset, count});
+}
+
+uint32_t RangeAllocator::getLargestFree() const {
+    uint32_t largest = 0;
+    for (const auto& [offset, count] : freeRanges)
+        largest = std::max(largest, count);
+    return largest;
+}
+
+GeometryHeap::GeometryHeap(ManagedBuffer vertexBuffer,
+                           ManagedBuffer indexBuffer)
+    : vertexBuffer{std::move(vertexBuffer)},
+      indexBuffer{std::move(indexBuffer)} {}
+
+uint32_t GeometryHeap::allocate(uint32_t vertexCount, uint32_t indexCount) {
+    uint32_t vertexOffset = vertexRanges.allocate(vertexCount);
+    if (vertexOffset == RangeAllocator::INVALID) return HeapHandle::NONE;
+
+    uint32_t indexOffset = indexRanges.allocate(indexCount);
+    if (indexOffset == RangeAllocator::INVALID) {
+        vertexRanges.free(vertexOffset, vertexCount);
+        return HeapHandle::NONE;
+    }
+
+    uint32_t handle;
+    if (freeSlots.empty()) {
+        handle = static_cast<uint32_t>(slots.size());
+        slots.emplace_back();
+    } else {
+        handle = freeSlots.back();
+        freeSlots.pop_back();
+    }
+
+    slots[handle] = Slot{};
+    slots[handle].current = {vertexOffset, vertexCount, indexOffset,
+                             indexCount};
+    slots[handle].used = true;
+
+    return handle;
+}
+
+void GeometryHeap::free(uint32_t handle, uint64_t completedBatch) {
+    Slot& slot = slots[handle];
+
+    // A pending move still reads the current ranges and writes the target
+    if (slot.moving && slot.moveBatch > completedBatch) {
+        copyDefer.push_back({slot.current, slot.moveBatch});
+        copyDefer.push_back({slot.target, slot.moveBatch});
+    } else {
+        release(slot.current);
+        if (slot.moving) release(slot.target);
+    }
+
+    slot.used = false;
+    slot.moving = false;
+    freeSlots.push_back(handle);
+}
+
+void GeometryHeap::bind(VkCommandBuffer commandBuffer) const {
+    VkBuffer buffers[] = {*vertexBuffer, *vertexBuffer};
+    VkDeviceSize offsets[] = {DEPTH_BASE, SURFACE_BASE};
+    vkCmdBindVertexBuffers(commandBuffer, GeometryMesh::DEPTH_BINDING, 2,
+                           buffers, offsets);
+    vkCmdBindIndexBuffer(commandBuffer, *indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+}
+
+void GeometryHeap::bindDepth(VkCommandBuffer commandBuffer) const {
+    VkDeviceSize offsets[] = {DEPTH_BASE};
+    vkCmdBindVertexBuffers(commandBuffer, GeometryMesh::DEPTH_BINDING, 1,
+                           &*vertexBuffer, offsets);
+    vkCmdBindIndexBuffer(commandBuffer, *indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+}
+
+void GeometryHeap::performDeferOps(uint32_t frameInFlight,
+                                   uint64_t completedBatch) {
+    for (const auto& allocation : rangeDefer[frameInFlight])
+        release(allocation);
+    rangeDefer[frameInFlight].clear();
+    deferFrame = frameInFlight;
+
+    for (size_t i = copyDefer.size(); i-- > 0;) {
+        if (copyDefer[i].second > completedBatch) continue;
+        release(copyDefer[i].first);
+        copyDefer[i] = copyDefer.back();
+        copyDefer.pop_back();
+    }
+
+    // Moves whose copy is done start being drawn from the new place, the
+    // old one stays until the frames drawing from it are done
+    for (auto& slot : slots) {
+        if (!slot.moving || slot.moveBatch > completedBatch) continue;
+
+        rangeDefer[deferFrame].push_back(slot.current);
+        slot.current = slot.target;
+        slot.moving = false;
+    }
+}
+
+void GeometryHeap::defragment(Uploader& uploader, uint64_t completedBatch) {
+    if (getFragmentation() < DEFRAG_THRESHOLD) return;
+
+    for (int moves = 0; moves < DEFRAG_MOVES; moves++) {
+        // The allocation furthest into the heap, that is not busy
+        Slot* last = nullptr;
+        for (auto& slot : slots) {
+            if (!slot.used || slot.moving || slot.uploadBatch > completedBatch)
+                continue;
+            if (!last || slot.current.vertexOffset > last->current.vertexOffset)
+                last = &slot;
+        }
+        if (!last) return;
+
+        Allocation& from = last->current;
+        uint32_t vertexOffset = vertexRanges.allocate(from.vertexCount);
+        uint32_t indexOffset = indexRanges.allocate(from.indexCount);
+
+        // First fit, so the new place is the lowest one. Stop if it is not
+        // lower than the current one, the heap is as compact as it gets.
+        if (vertexOffset == RangeAllocator::INVALID ||
+            indexOffset == RangeAllocator::INVALID ||
+            vertexOffset > from.vertexOffset) {
+            if (vertexOffset != RangeAllocator::INVALID)
+                vertexRanges.free(vertexOffset, from.vertexCount);
+            if (indexOffset != RangeAllocator::INVALID)
+                indexRanges.free(indexOffset, from.indexCount);
+            return;
+        }
+
+        last->target = {vertexOffset, from.vertexCount, indexOffset,
+                        from.indexCount};
+
+        // The new ranges were free, so they never overlap the old ones
+        uint64_t depthBatch = uploader.copy(
+            *vertexBuffer, DEPTH_BASE + from.vertexOffset * DEPTH_STRIDE,
+            *vertexBuffer, DEPTH_BASE + vertexOffset * DEPTH_STRIDE,
+            from.vertexCount * DEPTH_STRIDE);
+        uint64_t surfaceBatch = uploader.copy(
+            *vertexBuffer, SURFACE_BASE + from.vertexOffset * SURFACE_STRIDE,
+            *vertexBuffer, SURFACE_BASE + vertexOffset * SURFACE_STRIDE,
+            from.vertexCount * SURFACE_STRIDE);
+        uint64_t indexBatch = uploader.copy(
+            *indexBuffer, from.indexOffset * INDEX_STRIDE, *indexBuffer,
+            indexOffset * INDEX_STRIDE, from.indexCount * INDEX_STRIDE);
+
+        // Draws keep using the old place until performDeferOps() sees the
+        // batch complete, and the frame switching over waits on its
+        // semaphore, see Uploader
+        last->moveBatch = std::max({depthBatch, surfaceBatch, indexBatch});
+        last->moving = true;
+    }
+}
+
+float GeometryHeap::getFragmentation() const {
+    uint32_t freeCount = vertexRanges.getFreeCount();
+    if (freeCount == 0) return 0.0f;
+
+    return 1.0f - static_cast<float>(vertexRanges.getLargestFree()) /
+                      static_cast<float>(freeCount);
+}
+
+void GeometryHeap::release(const Allocation& allocation) {
+    vertexRanges.free(allocation.vertexOffset, allocation.vertexCount);
+    indexRanges.free(allocation.indexOffset, allocation.indexCount);
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <vulkan/vulkan_core.h>
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "Context.hpp"
+#include "Managed.hpp"
+#include "Primitives.hpp"
+#include "Uploader.hpp"
+
+namespace render {
+
+// First fit allocator of ranges in [0, capacity). Free ranges are kept
+// sorted by offset and merged with their neighbours when released.
+class RangeAllocator {
+public:
+    static constexpr uint32_t INVALID = UINT32_MAX;
+
+    RangeAllocator(uint32_t capacity);
+
+    // Returns INVALID if no free range is large enough
+    uint32_t allocate(uint32_t count);
+    void free(uint32_t offset, uint32_t count);
+
+    uint32_t getFreeCount() const { return freeCount; }
+    uint32_t getLargestFree() const;
+
+private:
+    // Offset to count
+    std::map<uint32_t, uint32_t> freeRanges;
+    uint32_t freeCount;
+};
+
+// A couple of big device buffers holding the vertices and indices of every
+// chunk, so that they can be drawn with a handful of indirect calls instead
+// of one bind and one draw each. Sizes and offsets are in elements.
+//
+// The vertex buffer holds the two streams of GeometryMesh one after the
+// other, a vertex has the same offset in both.
+class GeometryHeap {
+public:
+    static constexpr uint32_t VERTEX_CAPACITY = 1 << 21;
+    static constexpr uint32_t INDEX_CAPACITY = 1 << 22;
+    static constexpr VkDeviceSize DEPTH_STRIDE = sizeof(DepthVertex);
+    static constexpr VkDeviceSize SURFACE_STRIDE = sizeof(SurfaceVertex);
+    static constexpr VkDeviceSize INDEX_STRIDE = sizeof(uint16_t);
+    // Byte offsets of the streams in the vertex buffer
+    static constexpr VkDeviceSize DEPTH_BASE = 0;
+    static constexpr VkDeviceSize SURFACE_BASE = VERTEX_CAPACITY * DEPTH_STRIDE;
+    static constexpr VkDeviceSize VERTEX_BUFFER_SIZE =
+        VERTEX_CAPACITY * (DEPTH_STRIDE + SURFACE_STRIDE);
+
+    // Compaction starts once the largest free vertex range is smaller than
+    // this fraction of the free vertices
+    static constexpr float DEFRAG_THRESHOLD = 0.5f;
+    // Allocations moved per frame at most
+    static constexpr int DEFRAG_MOVES = 4;
+
+    struct Allocation {
+        uint32_t vertexOffset{0};
+        uint32_t vertexCount{0};
+        uint32_t indexOffset{0};
+        uint32_t indexCount{0};
+    };
+
+    GeometryHeap(ManagedBuffer vertexBuffer, ManagedBuffer indexBuffer);
+
+    // Returns HeapHandle::NONE if the heap is full
+    uint32_t allocate(uint32_t vertexCount, uint32_t indexCount);
+    // Both the GPU and the uploads have to be done with the slot
+    void free(uint32_t handle, uint64_t completedBatch);
+    // Upload batch writing the slot, it can't be moved before it completes
+    void setUploadBatch(uint32_t handle, uint64_t batch) {
+        slots[handle].uploadBatch = batch;
+    }
+
+    const Allocation& get(uint32_t handle) const {
+        return slots[handle].current;
+    }
+
+    VkBuffer getVertexBuffer() const { return *vertexBuffer; }
+    VkBuffer getIndexBuffer() const { return *indexBuffer; }
+
+    // Binds both vertex streams and the index buffer
+    void bind(VkCommandBuffer commandBuffer) const;
+    // Binds the depth stream alone and the index buffer, for depth only
+    // passes
+    void bindDepth(VkCommandBuffer commandBuffer) const;
+
+    // Releases the ranges freed the last time this frame in flight was
+    // recorded, and switches moved allocations to their new place
+    void performDeferOps(uint32_t frameInFlight, uint64_t completedBatch);
+
+    // Moves the allocations at the end of the heap into the holes at the
+    // start, a few per call, whenever free space is too fragmented
+    void defragment(Uploader& uploader, uint64_t completedBatch);
+
+    // 0 when the free vertices are contiguous, close to 1 when scattered
+    float getFragmentation() const;
+
+private:
+    struct Slot {
+        Allocation current;
+        // Where the data is being copied to, while moving
+        Allocation target;
+        uint64_t uploadBatch{0};
+        uint64_t moveBatch{0};
+        bool used{false};
+        bool moving{false};
+    };
+
+    void release(const Allocation& allocation);
+
+    ManagedBuffer vertexBuffer;
+    ManagedBuffer indexBuffer;
+
+    RangeAllocator vertexRanges{VERTEX_CAPACITY};
+    RangeAllocator indexRanges{INDEX_CAPACITY};
+
+    std::vector<Slot> slots;
+    std::vector<uint32_t> freeSlots;
+
+    // Ranges the GPU may still be reading, per frame in flight
+    std::array<std::vector<Allocation>, Context::FRAMES_IN_FLIGHT> rangeDefer;
+    uint32_t deferFrame{0};
+    // Ranges a pending copy is still writing, with the batch of the copy
+    std::vector<std::pair<Allocation, uint64_t>> copyDefer;
+};
+
+}  // namespace render
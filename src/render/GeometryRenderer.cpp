@@ -2,56 +2,290 @@
 
 #include <vulkan/vulkan_core.h>
 
+#include <algorithm>
+#include <chrono>
+
 #include "BufferManager.hpp"
 #include "Context.hpp"
 #include "Managed.hpp"
-#include "ShadowPass.hpp"
 
 using namespace render;
 
-GeometryRenderer::GeometryRenderer(VkRenderPass renderPass) {
-    lightInfoUbo = BufferManager::get().allocateUbo(sizeof(LightInfoUbo));
+GeometryRenderer::GeometryRenderer(VkRenderPass renderPass,
+                                   const JointPalette& palette)
+    : palette{palette} {
+    PipelineJobGuard pipelineGuard;
+    for (auto& lightInfoUbo : lightInfoUbos)
+        lightInfoUbo = BufferManager::get().allocateUbo(sizeof(LightInfoUbo));
+
+    // Shared by the pipelines, which are created in parallel
+    createPipelineLayout();
+
+    Context::get().createPipelineAsync([this, renderPass] {
+        createPipeline(renderPass, Pass::DEPTH, false, depthPipeline);
+    });
+    for (bool overdraw : {false, true}) {
+        for (Pass pass : {Pass::COLOR, Pass::COLOR_OVER_DEPTH}) {
+            Context::get().createPipelineAsync(
+                [this, renderPass, pass, overdraw] {
+                    createPipeline(renderPass, pass, overdraw,
+                                   getColorPipeline(pass, overdraw));
+                });
+        }
+    }
+}
 
-    createPipeline(renderPass);
+void GeometryRenderer::prepare(VkCommandBuffer commandBuffer,
+                               uint32_t frameInFlight, const Camera& camera,
+                               float ratio, const RenderQueue& queue,
+                               const HiZPyramid* hiZ) {
+    auto start = std::chrono::steady_clock::now();
+    for (auto& slice : slices) slice.stats = {};
+
+    vp = camera.computeVPMat(ratio);
+    Frustum frustum = Frustum::fromMatrix(vp);
+
+    draws.begin(frameInFlight);
+
+    // Cull everything in one go, before recording. Heap meshes are left to
+    // the GPU when it can cull them.
+    uint32_t occluded = 0;
+    uint32_t gpuCandidates = 0;
+    const auto& models = queue.getGeometry();
+    culler.clear();
+    for (const auto& model : models) {
+        if (model.shadowOnly)
+            occluded++;
+        else if (draws.isGpuCulled() && model.mesh->isInHeap())
+            gpuCandidates++;
+        else
+            culler.addModel(model);
+    }
+
+    // Instances are always culled on the CPU, after the models
+    const auto& instanced = queue.getInstanced();
+    const auto& instances = queue.getInstances();
+    size_t firstInstanceVolume = culler.size();
+    for (const auto& batch : instanced) {
+        for (uint32_t j = 0; j < batch.count; j++) {
+            const auto& instance = instances[batch.first + j];
+            culler.addModel(*batch.mesh, instance.pos, instance.rot);
+        }
+    }
+
+    uint32_t visible = culler.cull(frustum);
+
+    // The queue is sorted front to back. Heap meshes in a row are gathered
+    // into runs, each drawn with one indirect call in that order, whatever
+    // their textures.
+    steps.clear();
+    auto endRun = [&]() {
+        uint32_t run = draws.endRun();
+        if (run != IndirectDraws::NO_RUN) steps.push_back({nullptr, run});
+    };
+    // Out of instances, the model is left out like the instanced ones
+    auto addSingle = [&](const GeometryModel& model) {
+        uint32_t index = draws.addInstance(GeometryInstance::fromOffset(
+            glm::vec3{0.0f}, model.texture->index));
+        if (index != IndirectDraws::NO_INSTANCE)
+            steps.push_back(
+                {&model, IndirectDraws::NO_RUN, model.mesh, index, 1});
+    };
+
+    size_t i = 0;
+    for (const auto& model : models) {
+        if (model.shadowOnly) continue;
+
+        bool gpuCulled = draws.isGpuCulled() && model.mesh->isInHeap();
+        if (!gpuCulled && !culler.isVisible(i++)) continue;
+
+        if (model.mesh->isNull() ||
+            !BufferManager::get().isUploaded(*model.mesh))
+            continue;
+
+        if (!model.mesh->isInHeap()) {
+            endRun();
+            addSingle(model);
+            continue;
+        }
+
+        // Out of indirect draws, the instance offset is zero for these
+        if (!draws.add(*model.mesh, model.pos, model.texture->index)) {
+            endRun();
+            addSingle(model);
+        }
+    }
+    endRun();
+
+    // Each batch of instances goes out in a single draw
+    size_t volume = firstInstanceVolume;
+    for (const auto& batch : instanced) {
+        size_t batchVolume = volume;
+        volume += batch.count;
+
+        if (batch.mesh->isNull() ||
+            !BufferManager::get().isUploaded(*batch.mesh))
+            continue;
+
+        DrawStep step{nullptr, IndirectDraws::NO_RUN, batch.mesh};
+        for (uint32_t j = 0; j < batch.count; j++) {
+            if (!culler.isVisible(batchVolume + j)) continue;
+
+            const auto& instance = instances[batch.first + j];
+            uint32_t index = draws.addInstance(
+                GeometryInstance::fromTransform(instance.pos, instance.rot,
+                                               instance.palette,
+                                               batch.texture->index));
+            if (index == IndirectDraws::NO_INSTANCE) break;
+
+            if (step.instanceCount == 0) step.firstInstance = index;
+            step.instanceCount++;
+        }
+
+        if (step.instanceCount > 0) steps.push_back(step);
+    }
+
+    draws.cull(commandBuffer, frustum, hiZ);
+
+    // GPU culling results are read back a few frames late
+    visible += std::min(draws.getGpuVisible(), gpuCandidates);
+    uint32_t candidates = static_cast<uint32_t>(culler.size()) + gpuCandidates;
+    cullingStats = {visible, candidates - visible, occluded};
+
+    prepareMs = std::chrono::duration<float, std::milli>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
 }
 
-void GeometryRenderer::record(VkCommandBuffer commandBuffer,
-                              const Camera& camera, float ratio,
-                              const LightInfo& lights,
-                              const Texture& depthTexture,
-                              std::list<GeometryModel> models) {
-    // Update UBO
-    lightInfoUbo.write(
-        LightInfoUbo{ShadowPass::computeShadowVP(camera.pos, lights.sunDir),
-                     {lights.ambientColor, 1.0f},
-                     {lights.sunDir, 1.0f},
-                     {lights.sunColor, 1.0f},
-                     {camera.pos, 1.0f}});
+void GeometryRenderer::cullDisoccluded(VkCommandBuffer commandBuffer,
+                                       const HiZPyramid& hiZ) {
+    draws.cullDisoccluded(commandBuffer, hiZ, vp);
+}
 
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                      *pipeline);
+GeometryRenderer::RecordStats GeometryRenderer::getRecordStats() const {
+    RecordStats stats{};
+    for (const auto& slice : slices) {
+        stats.draws += slice.stats.draws;
+        stats.indirectDraws += slice.stats.indirectDraws;
+        stats.descriptorBinds += slice.stats.descriptorBinds;
+        stats.bufferBinds += slice.stats.bufferBinds;
+        stats.recordMs = std::max(stats.recordMs, slice.stats.recordMs);
+    }
+    stats.recordMs += prepareMs;
+
+    return stats;
+}
+
+void GeometryRenderer::updateLights(uint32_t frameInFlight,
+                                    const Camera& camera,
+                                    const LightInfo& lights,
+                                    const ShadowPass& shadowPass) {
+    LightInfoUbo ubo{};
+    for (uint32_t i = 0; i < ShadowPass::CASCADE_COUNT; i++)
+        ubo.cascadeVPs[i] = shadowPass.getCascadeVP(i);
+    ubo.ambientColor = {lights.ambientColor, 1.0f};
+    ubo.sunDir = {lights.sunDir, 1.0f};
+    ubo.sunColor = {lights.sunColor, 1.0f};
+    ubo.viewPos = {camera.pos, 1.0f};
+    ubo.shadowMap = shadowPass.getDepthTexture().index;
+
+    lightInfoUbos[frameInFlight].write(ubo);
+}
 
-    glm::mat4 vp = camera.computeVPMat(ratio);
-    // glm::mat4 vp = ShadowPass::computeShadowVP(lights.sunDir);
+void GeometryRenderer::record(VkCommandBuffer commandBuffer,
+                              uint32_t frameInFlight, Pass pass,
+                              uint32_t slice, uint32_t sliceCount,
+                              bool disoccluded) {
+    auto start = std::chrono::steady_clock::now();
+    Slice& state = slices[slice];
+    state.depthOnly = pass == Pass::DEPTH;
+
+    // A secondary buffer starts with nothing bound
+    VkPipeline pipeline = state.depthOnly
+                              ? *depthPipeline
+                              : *getColorPipeline(pass, overdrawView);
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      pipeline);
 
-    // Record models
-    for (const auto& model : models)
-        recordSingle(commandBuffer, vp, depthTexture, model);
+    // The texture table, the lights and the joints are the same for every
+    // draw, bind them once. Draws pick their texture by instance.
+    VkDescriptorSet frameSets[3] = {BufferManager::get().getTextureTable(),
+                                    lightInfoUbos[frameInFlight].descriptor,
+                                    palette.getSet(frameInFlight)};
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            *pipelineLayout, 0, 3, frameSets, 0, nullptr);
+    state.stats.descriptorBinds++;
+
+    state.boundMesh = nullptr;
+    state.heapBound = false;
+
+    draws.bindInstances(commandBuffer);
+
+    // Contiguous slices keep the sorted order within each of them. Only heap
+    // runs can hold disoccluded draws.
+    size_t first = steps.size() * slice / sliceCount;
+    size_t last = steps.size() * (slice + 1) / sliceCount;
+    for (size_t i = first; i < last; i++) {
+        const DrawStep& step = steps[i];
+        if (step.run != IndirectDraws::NO_RUN) {
+            recordHeapRun(commandBuffer, state, step.run, disoccluded);
+        } else if (disoccluded) {
+            continue;
+        } else if (step.model) {
+            recordSingle(commandBuffer, state, step);
+        } else {
+            recordInstanced(commandBuffer, state, step);
+        }
+    }
+
+    state.stats.recordMs += std::chrono::duration<float, std::milli>(
+                                std::chrono::steady_clock::now() - start)
+                                .count();
 }
 
-void GeometryRenderer::recordSingle(VkCommandBuffer commandBuffer, glm::mat4 vp,
-                                    const Texture& depthTexture,
-                                    const GeometryModel& model) {
-    if (model.mesh.isNull()) return;
+void GeometryRenderer::bindHeap(VkCommandBuffer commandBuffer, Slice& slice) {
+    if (slice.heapBound) return;
+
+    const GeometryHeap& heap = BufferManager::get().getGeometryHeap();
+    if (slice.depthOnly)
+        heap.bindDepth(commandBuffer);
+    else
+        heap.bind(commandBuffer);
+    slice.heapBound = true;
+    slice.boundMesh = nullptr;
+    slice.stats.bufferBinds++;
+}
 
-    VkDescriptorSet descriptorSets[3] = {model.texture.descriptor,
-                                         depthTexture.descriptor,
-                                         lightInfoUbo.descriptor};
+void GeometryRenderer::bindMesh(VkCommandBuffer commandBuffer, Slice& slice,
+                                const GeometryMesh* mesh, uint32_t& firstIndex,
+                                int32_t& vertexOffset) {
+    firstIndex = 0;
+    vertexOffset = 0;
+    if (mesh->isInHeap()) {
+        bindHeap(commandBuffer, slice);
+
+        const auto& allocation =
+            BufferManager::get().getGeometryHeap().get(mesh->heap.index);
+        firstIndex = allocation.indexOffset;
+        vertexOffset = static_cast<int32_t>(allocation.vertexOffset);
+    } else if (mesh != slice.boundMesh) {
+        if (slice.depthOnly)
+            mesh->bindDepth(commandBuffer);
+        else
+            mesh->bind(commandBuffer);
+        slice.boundMesh = mesh;
+        slice.heapBound = false;
+        slice.stats.bufferBinds++;
+    }
+}
 
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                            *pipelineLayout, 0, 3, descriptorSets, 0, nullptr);
+void GeometryRenderer::recordSingle(VkCommandBuffer commandBuffer,
+                                    Slice& slice, const DrawStep& step) {
+    const GeometryModel& model = *step.model;
 
-    model.mesh.bind(commandBuffer);
+    uint32_t firstIndex;
+    int32_t vertexOffset;
+    bindMesh(commandBuffer, slice, model.mesh, firstIndex, vertexOffset);
 
     glm::mat4 m = model.computeModelMat();
     PushBuffer pushBuffer = {m, vp};
@@ -60,14 +294,50 @@ void GeometryRenderer::recordSingle(VkCommandBuffer commandBuffer, glm::mat4 vp,
                        VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushBuffer),
                        &pushBuffer);
 
-    vkCmdDrawIndexed(commandBuffer, model.mesh.indexCount, 1, 0, 0, 0);
+    // The instance holds a zero offset and the texture
+    vkCmdDrawIndexed(commandBuffer, model.mesh->indexCount, 1, firstIndex,
+                     vertexOffset, step.firstInstance);
+    slice.stats.draws++;
 }
 
-void GeometryRenderer::createPipeline(VkRenderPass renderPass) {
+void GeometryRenderer::recordInstanced(VkCommandBuffer commandBuffer,
+                                       Slice& slice, const DrawStep& step) {
+    uint32_t firstIndex;
+    int32_t vertexOffset;
+    bindMesh(commandBuffer, slice, step.mesh, firstIndex, vertexOffset);
+
+    // Instances carry the whole transform
+    PushBuffer pushBuffer = {glm::mat4{1.0f}, vp};
+    vkCmdPushConstants(commandBuffer, *pipelineLayout,
+                       VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushBuffer),
+                       &pushBuffer);
+
+    vkCmdDrawIndexed(commandBuffer, step.mesh->indexCount, step.instanceCount,
+                     firstIndex, vertexOffset, step.firstInstance);
+    slice.stats.draws++;
+}
+
+void GeometryRenderer::recordHeapRun(VkCommandBuffer commandBuffer,
+                                     Slice& slice, uint32_t run,
+                                     bool disoccluded) {
+    bindHeap(commandBuffer, slice);
+
+    // Heap meshes are placed by their instance offset alone
+    PushBuffer pushBuffer = {glm::mat4{1.0f}, vp};
+    vkCmdPushConstants(commandBuffer, *pipelineLayout,
+                       VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushBuffer),
+                       &pushBuffer);
+
+    slice.stats.draws += draws.record(commandBuffer, run, disoccluded);
+    // Counted once, the prepass draws the same run again
+    if (!disoccluded && !slice.depthOnly)
+        slice.stats.indirectDraws += draws.getRunSize(run);
+}
+
+void GeometryRenderer::createPipelineLayout() {
     VkDescriptorSetLayout descriptorSetLayouts[3] = {
         BufferManager::get().getTextureLayout(),
-        BufferManager::get().getTextureLayout(),
-        BufferManager::get().getUboLayout()};
+        BufferManager::get().getUboLayout(), palette.getLayout()};
     VkPushConstantRange pushConstantRange = {};
     pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
     pushConstantRange.offset = 0;
@@ -84,11 +354,16 @@ void GeometryRenderer::createPipeline(VkRenderPass renderPass) {
                                &pipelineLayoutCreateInfo, nullptr,
                                &*pipelineLayout) != VK_SUCCESS)
         throw std::runtime_error{"failed to create pipeline layout!"};
+}
+
+void GeometryRenderer::createPipeline(VkRenderPass renderPass, Pass pass,
+                                      bool overdraw, ManagedPipeline& target) {
+    bool depthOnly = pass == Pass::DEPTH;
 
-    ManagedShaderModule vertShaderModule{
-        Context::get().loadShaderModule("GeometryVert.vert.spv")};
-    ManagedShaderModule fragShaderModule{
-        Context::get().loadShaderModule("GeometryFrag.frag.spv")};
+    ManagedShaderModule vertShaderModule{Context::get().loadShaderModule(
+        depthOnly ? "GeometryDepthVert.vert.spv" : "GeometryVert.vert.spv")};
+    ManagedShaderModule fragShaderModule{Context::get().loadShaderModule(
+        overdraw ? "OverdrawFrag.frag.spv" : "GeometryFrag.frag.spv")};
 
     VkPipelineShaderStageCreateInfo vertStageInfo{};
     vertStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -111,19 +386,37 @@ void GeometryRenderer::createPipeline(VkRenderPass renderPass) {
     dynamicStateInfo.dynamicStateCount = 2;
     dynamicStateInfo.pDynamicStates = DYNAMIC_STATES;
 
-    auto bindingDescription = GeometryMesh::getBindingDescription();
+    auto bindingDescriptions = GeometryMesh::getBindingDescriptions();
     auto attributeDescriptions = GeometryMesh::getAttributeDescriptions();
+    auto depthBindingDescriptions =
+        GeometryMesh::getDepthBindingDescriptions();
+    auto depthAttributeDescriptions =
+        GeometryMesh::getDepthAttributeDescriptions();
 
     VkPipelineVertexInputStateCreateInfo vertexInputStageInfo{};
     vertexInputStageInfo.sType =
         VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertexInputStageInfo.vertexBindingDescriptionCount = 1;
-    vertexInputStageInfo.pVertexBindingDescriptions = &bindingDescription;
+    vertexInputStageInfo.vertexBindingDescriptionCount =
+        bindingDescriptions.size();
+    vertexInputStageInfo.pVertexBindingDescriptions =
+        bindingDescriptions.data();
     vertexInputStageInfo.vertexAttributeDescriptionCount =
         attributeDescriptions.size();
     vertexInputStageInfo.pVertexAttributeDescriptions =
         attributeDescriptions.data();
 
+    // The prepass only fetches positions
+    if (depthOnly) {
+        vertexInputStageInfo.vertexBindingDescriptionCount =
+            depthBindingDescriptions.size();
+        vertexInputStageInfo.pVertexBindingDescriptions =
+            depthBindingDescriptions.data();
+        vertexInputStageInfo.vertexAttributeDescriptionCount =
+            depthAttributeDescriptions.size();
+        vertexInputStageInfo.pVertexAttributeDescriptions =
+            depthAttributeDescriptions.data();
+    }
+
     VkPipelineInputAssemblyStateCreateInfo inputAssemblyStageInfo{};
     inputAssemblyStageInfo.sType =
         VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
@@ -172,6 +465,15 @@ void GeometryRenderer::createPipeline(VkRenderPass renderPass) {
     colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
     colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
 
+    if (depthOnly) colorBlendAttachment.colorWriteMask = 0;
+
+    // Every fragment shaded adds up
+    if (overdraw) {
+        colorBlendAttachment.blendEnable = VK_TRUE;
+        colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+        colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    }
+
     VkPipelineColorBlendStateCreateInfo colorBlendStateInfo{};
     colorBlendStateInfo.sType =
         VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
@@ -197,12 +499,20 @@ void GeometryRenderer::createPipeline(VkRenderPass renderPass) {
     depthStencilStateInfo.front = {};
     depthStencilStateInfo.back = {};
 
+    // The prepass already wrote the depth, only the fragments in front are
+    // left to shade
+    if (pass == Pass::COLOR_OVER_DEPTH) {
+        depthStencilStateInfo.depthWriteEnable = VK_FALSE;
+        depthStencilStateInfo.depthCompareOp = VK_COMPARE_OP_EQUAL;
+    }
+
     VkPipelineShaderStageCreateInfo stageInfos[] = {vertStageInfo,
                                                     fragStageInfo};
 
     VkGraphicsPipelineCreateInfo pipelineCreateInfo{};
     pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    pipelineCreateInfo.stageCount = 2;
+    // Depth only needs no fragment shader
+    pipelineCreateInfo.stageCount = depthOnly ? 1 : 2;
     pipelineCreateInfo.pStages = stageInfos;
     pipelineCreateInfo.pVertexInputState = &vertexInputStageInfo;
     pipelineCreateInfo.pInputAssemblyState = &inputAssemblyStageInfo;
@@ -218,8 +528,9 @@ void GeometryRenderer::createPipeline(VkRenderPass renderPass) {
     pipelineCreateInfo.basePipelineHandle = VK_NULL_HANDLE;
     pipelineCreateInfo.basePipelineIndex = -1;
 
-    if (vkCreateGraphicsPipelines(Context::get().getDevice(), VK_NULL_HANDLE, 1,
+    if (vkCreateGraphicsPipelines(Context::get().getDevice(),
+                                  Context::get().getPipelineCache(), 1,
                                   &pipelineCreateInfo, nullptr,
-                                  &*pipeline) != VK_SUCCESS)
+                                  &*target) != VK_SUCCESS)
         throw std::runtime_error{"failed to create graphics pipeline"};
 }
\ No newline at end of file
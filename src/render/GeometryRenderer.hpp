@@ -3,16 +3,35 @@
 #include <vulkan/vulkan.h>
 #include <vulkan/vulkan_core.h>
 
-#include <list>
+#include <vector>
 
+#include "Context.hpp"
+#include "Frustum.hpp"
+#include "HiZPyramid.hpp"
+#include "IndirectDraws.hpp"
+#include "JointPalette.hpp"
 #include "Managed.hpp"
 #include "Primitives.hpp"
+#include "RecordPool.hpp"
+#include "RenderQueue.hpp"
+#include "ShadowPass.hpp"
 
 namespace render {
 
 class GeometryRenderer {
 public:
-    GeometryRenderer(VkRenderPass renderPass);
+    GeometryRenderer(VkRenderPass renderPass, const JointPalette& palette);
+
+    // What record() draws
+    enum class Pass {
+        // Depth alone, from the position stream
+        DEPTH,
+        // Shades and writes depth
+        COLOR,
+        // Only shades the fragments the depth pass left in front, without
+        // writing depth
+        COLOR_OVER_DEPTH,
+    };
 
     struct LightInfo {
         glm::vec3 ambientColor;
@@ -20,9 +39,45 @@ public:
         glm::vec3 sunColor;
     };
 
-    void record(VkCommandBuffer commandBuffer, const Camera& camera,
-                float ratio, const LightInfo& lights,
-                const Texture& depthTexture, std::list<GeometryModel> models);
+    // Without state tracking, every draw would bind its buffers once, so
+    // bufferBinds would equal draws. Textures come from the texture table,
+    // descriptor sets are bound once per slice.
+    struct RecordStats {
+        // Draw calls, a multi-draw indirect call counts as one
+        uint32_t draws{0};
+        // Heap meshes drawn through indirect commands, before GPU culling
+        uint32_t indirectDraws{0};
+        uint32_t descriptorBinds{0};
+        uint32_t bufferBinds{0};
+        // CPU time spent culling, plus recording on the slowest thread
+        float recordMs{0.0f};
+    };
+
+    // Culls and sorts out the draws, outside of the render pass as it may
+    // record a compute dispatch. Heap meshes hidden in hiZ are held back.
+    void prepare(VkCommandBuffer commandBuffer, uint32_t frameInFlight,
+                 const Camera& camera, float ratio, const RenderQueue& queue,
+                 const HiZPyramid* hiZ = nullptr);
+    // Picks the held back meshes that hiZ, now built from this frame, shows
+    // to be visible. Outside of the render pass too.
+    void cullDisoccluded(VkCommandBuffer commandBuffer, const HiZPyramid& hiZ);
+    // Writes the lights of this frame, before recording it, along with
+    // where to find the shadow map and its cascades
+    void updateLights(uint32_t frameInFlight, const Camera& camera,
+                      const LightInfo& lights, const ShadowPass& shadowPass);
+    // Records a slice of the draws picked by prepare(), or of the ones
+    // picked by cullDisoccluded() if disoccluded is set. Slices can be
+    // recorded by several threads at once, up to RecordPool::MAX_WORKERS.
+    void record(VkCommandBuffer commandBuffer, uint32_t frameInFlight,
+                Pass pass, uint32_t slice, uint32_t sliceCount,
+                bool disoccluded = false);
+
+    // Color passes count the fragments they shade instead of lighting them
+    void setOverdrawView(bool enabled) { overdrawView = enabled; }
+
+    // Of the last recorded frame
+    CullingStats getCullingStats() const { return cullingStats; }
+    RecordStats getRecordStats() const;
 
 private:
     struct PushBuffer {
@@ -31,22 +86,79 @@ private:
     };
 
     struct LightInfoUbo {
-        glm::mat4 shadowVP;
+        glm::mat4 cascadeVPs[ShadowPass::CASCADE_COUNT];
         glm::vec4 ambientColor;
         glm::vec4 sunDir;
         glm::vec4 sunColor;
         glm::vec4 viewPos;
+        // Slot of the shadow map in the texture table
+        uint32_t shadowMap;
+    };
+
+    // Either a model drawn on its own, a run of indirect draws, or the
+    // copies of an instanced mesh. Models drawn on their own get an
+    // instance too, for their texture.
+    struct DrawStep {
+        const GeometryModel* model;
+        uint32_t run;
+        const GeometryMesh* mesh{nullptr};
+        uint32_t firstInstance{0};
+        uint32_t instanceCount{0};
     };
 
-    void recordSingle(VkCommandBuffer commandBuffer, glm::mat4 vp,
-                      const Texture& depthTexture, const GeometryModel& model);
+    // State bound by the last draw of a slice, and its counters
+    struct Slice {
+        const GeometryMesh* boundMesh{nullptr};
+        bool heapBound{false};
+        // Binds the position stream alone
+        bool depthOnly{false};
+        RecordStats stats;
+    };
+
+    // Only binds the state that differs from the previous draw
+    void bindHeap(VkCommandBuffer commandBuffer, Slice& slice);
+    // Binds the buffers holding the mesh, and gives where it starts in them
+    void bindMesh(VkCommandBuffer commandBuffer, Slice& slice,
+                  const GeometryMesh* mesh, uint32_t& firstIndex,
+                  int32_t& vertexOffset);
+    void recordSingle(VkCommandBuffer commandBuffer, Slice& slice,
+                      const DrawStep& step);
+    void recordInstanced(VkCommandBuffer commandBuffer, Slice& slice,
+                         const DrawStep& step);
+    void recordHeapRun(VkCommandBuffer commandBuffer, Slice& slice,
+                       uint32_t run, bool disoccluded);
+
+    ManagedPipeline& getColorPipeline(Pass pass, bool overdraw) {
+        return colorPipelines[pass == Pass::COLOR_OVER_DEPTH][overdraw];
+    }
+
+    void createPipelineLayout();
+    void createPipeline(VkRenderPass renderPass, Pass pass, bool overdraw,
+                        ManagedPipeline& target);
+
+    // One per frame in flight, so the GPU never reads a half written one
+    Ubo lightInfoUbos[Context::FRAMES_IN_FLIGHT];
+
+    const JointPalette& palette;
+    IndirectDraws draws;
+    // Filled by prepare(), in recording order
+    std::vector<DrawStep> steps;
+    glm::mat4 vp;
+
+    FrustumCuller culler;
+    CullingStats cullingStats;
+    // Time spent in prepare()
+    float prepareMs{0.0f};
 
-    void createPipeline(VkRenderPass renderPass);
+    // One per thread recording, reset every frame
+    Slice slices[RecordPool::MAX_WORKERS];
 
-    Ubo lightInfoUbo;
+    bool overdrawView{false};
 
     ManagedPipelineLayout pipelineLayout;
-    ManagedPipeline pipeline;
+    ManagedPipeline depthPipeline;
+    // By color pass, then lit or showing overdraw
+    ManagedPipeline colorPipelines[2][2];
 };
 
 }  // namespace render
\ No newline at end of file
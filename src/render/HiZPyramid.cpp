@@ -0,0 +1,278 @@
+#include "HiZPyramid.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "BufferManager.hpp"
+
+using namespace render;
+
+namespace {
+struct PushBuffer {
+    glm::uvec2 srcSize;
+    glm::uvec2 dstSize;
+};
+}  // namespace
+
+HiZPyramid::HiZPyramid() {
+    createSampler();
+    createLayout();
+    createDescriptorPool();
+    Context::get().createPipelineAsync([this] { createPipeline(); });
+}
+
+void HiZPyramid::resize(VkExtent2D depthExtent) {
+    if (depthExtent.width == this->depthExtent.width &&
+        depthExtent.height == this->depthExtent.height)
+        return;
+
+    // Swapchain recreation waits for the device to be idle, nothing is
+    // reading the old pyramid at this point
+    this->depthExtent = depthExtent;
+    valid = false;
+    needsTransition = true;
+    generation++;
+
+    // Half the depth buffer, rounded up so that no pixel is left out
+    uint32_t width = (depthExtent.width + 1) / 2;
+    uint32_t height = (depthExtent.height + 1) / 2;
+    uint32_t levels = 1;
+    while ((std::max(width, height) >> levels) > 0 && levels < MAX_LEVELS)
+        levels++;
+
+    // Moving into a live handle would leak it, free the old image first
+    levelViews.clear();
+    { Image old{std::move(pyramid)}; }
+    pyramid =BufferManager::get().allocateStorageImage(
+        width, height, levels, VK_FORMAT_R32_SFLOAT);
+    for (uint32_t i = 0; i < levels; i++)
+        levelViews.push_back(BufferManager::get().allocateMipView(pyramid, i));
+
+    vkResetDescriptorPool(Context::get().getDevice(), *descriptorPool, 0);
+
+    std::vector<VkDescriptorSetLayout> layouts(
+        Context::FRAMES_IN_FLIGHT + levels - 1, *layout);
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = *descriptorPool;
+    allocInfo.descriptorSetCount = static_cast<uint32_t>(layouts.size());
+    allocInfo.pSetLayouts = layouts.data();
+
+    std::vector<VkDescriptorSet> sets(layouts.size());
+    if (vkAllocateDescriptorSets(Context::get().getDevice(), &allocInfo,
+                                 sets.data()) != VK_SUCCESS)
+        throw std::runtime_error{"failed to create Hi-Z descriptor sets!"};
+
+    std::copy_n(sets.begin(), Context::FRAMES_IN_FLIGHT, depthSets);
+    levelSets.assign(sets.begin() + Context::FRAMES_IN_FLIGHT, sets.end());
+
+    for (uint32_t i = 1; i < levels; i++)
+        writeSet(levelSets[i - 1], *levelViews[i - 1],
+                 VK_IMAGE_LAYOUT_GENERAL, *levelViews[i]);
+}
+
+void HiZPyramid::build(VkCommandBuffer commandBuffer, uint32_t frameInFlight,
+                       const Image& depth, const glm::mat4& vp) {
+    VkDescriptorSet depthSet = depthSets[frameInFlight];
+    writeSet(depthSet, *depth.view,
+             VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, *levelViews[0]);
+
+    // Culling may still be reading the previous contents
+    VkImageMemoryBarrier imageBarrier{};
+    imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    imageBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    imageBarrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    imageBarrier.oldLayout = needsTransition ? VK_IMAGE_LAYOUT_UNDEFINED
+                                             : VK_IMAGE_LAYOUT_GENERAL;
+    imageBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.image = *pyramid.image;
+    imageBarrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0,
+                                     pyramid.mipLevels, 0, 1};
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr,
+                         0, nullptr, 1, &imageBarrier);
+    needsTransition = false;
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      *pipeline);
+
+    VkMemoryBarrier levelBarrier{};
+    levelBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    levelBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    levelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    glm::uvec2 srcSize{depthExtent.width, depthExtent.height};
+    for (uint32_t level = 0; level < pyramid.mipLevels; level++) {
+        glm::uvec2 dstSize{std::max(pyramid.width >> level, 1u),
+                           std::max(pyramid.height >> level, 1u)};
+
+        VkDescriptorSet set = level == 0 ? depthSet : levelSets[level - 1];
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                *pipelineLayout, 0, 1, &set, 0, nullptr);
+
+        PushBuffer pushBuffer{srcSize, dstSize};
+        vkCmdPushConstants(commandBuffer, *pipelineLayout,
+                           VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushBuffer),
+                           &pushBuffer);
+
+        vkCmdDispatch(commandBuffer, (dstSize.x + GROUP_SIZE - 1) / GROUP_SIZE,
+                      (dstSize.y + GROUP_SIZE - 1) / GROUP_SIZE, 1);
+
+        // Read by the next level, and by culling after the last one
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                             &levelBarrier, 0, nullptr, 0, nullptr);
+
+        srcSize = dstSize;
+    }
+
+    this->vp = vp;
+    valid = true;
+}
+
+void HiZPyramid::writeSet(VkDescriptorSet set, VkImageView source,
+                          VkImageLayout sourceLayout,
+                          VkImageView destination) {
+    VkDescriptorImageInfo sourceInfo{};
+    sourceInfo.sampler = *sampler;
+    sourceInfo.imageView = source;
+    sourceInfo.imageLayout = sourceLayout;
+
+    VkDescriptorImageInfo destinationInfo{};
+    destinationInfo.imageView = destination;
+    destinationInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    VkWriteDescriptorSet descriptorWrites[2] = {};
+    descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[0].dstSet = set;
+    descriptorWrites[0].dstBinding = 0;
+    descriptorWrites[0].descriptorType =
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorWrites[0].descriptorCount = 1;
+    descriptorWrites[0].pImageInfo = &sourceInfo;
+
+    descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[1].dstSet = set;
+    descriptorWrites[1].dstBinding = 1;
+    descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    descriptorWrites[1].descriptorCount = 1;
+    descriptorWrites[1].pImageInfo = &destinationInfo;
+
+    vkUpdateDescriptorSets(Context::get().getDevice(), 2, descriptorWrites, 0,
+                           nullptr);
+}
+
+void HiZPyramid::createSampler() {
+    // Only read with texelFetch, but a combined image sampler is the one
+    // descriptor type that can also read the depth buffer
+    VkSamplerCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    createInfo.magFilter = VK_FILTER_NEAREST;
+    createInfo.minFilter = VK_FILTER_NEAREST;
+    createInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    createInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    createInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    createInfo.anisotropyEnable = VK_FALSE;
+    createInfo.maxAnisotropy = 1.0f;
+    createInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+    createInfo.unnormalizedCoordinates = VK_FALSE;
+    createInfo.compareEnable = VK_FALSE;
+    createInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+    createInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    createInfo.mipLodBias = 0.0f;
+    createInfo.minLod = 0.0f;
+    createInfo.maxLod = static_cast<float>(MAX_LEVELS);
+
+    if (vkCreateSampler(Context::get().getDevice(), &createInfo, nullptr,
+                        &*sampler) != VK_SUCCESS)
+        throw std::runtime_error{"failed to create Hi-Z sampler!"};
+}
+
+void HiZPyramid::createLayout() {
+    VkDescriptorSetLayoutBinding bindings[2] = {};
+    bindings[0].binding = 0;
+    bindings[0].descriptorCount = 1;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    bindings[1].binding = 1;
+    bindings[1].descriptorCount = 1;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkDescriptorSetLayoutCreateInfo descriptorSetLayoutInfo{};
+    descriptorSetLayoutInfo.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descriptorSetLayoutInfo.bindingCount = 2;
+    descriptorSetLayoutInfo.pBindings = bindings;
+
+    if (vkCreateDescriptorSetLayout(Context::get().getDevice(),
+                                    &descriptorSetLayoutInfo, nullptr,
+                                    &*layout) != VK_SUCCESS)
+        throw std::runtime_error{"failed to create Hi-Z descriptor layout!"};
+}
+
+void HiZPyramid::createDescriptorPool() {
+    uint32_t maxSets = Context::FRAMES_IN_FLIGHT + MAX_LEVELS;
+
+    VkDescriptorPoolSize poolSizes[2] = {};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSizes[0].descriptorCount = maxSets;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    poolSizes[1].descriptorCount = maxSets;
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = 2;
+    poolInfo.pPoolSizes = poolSizes;
+    poolInfo.maxSets = maxSets;
+
+    if (vkCreateDescriptorPool(Context::get().getDevice(), &poolInfo, nullptr,
+                               &*descriptorPool) != VK_SUCCESS)
+        throw std::runtime_error{"failed to create Hi-Z descriptor pool!"};
+}
+
+void HiZPyramid::createPipeline() {
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(PushBuffer);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
+    pipelineLayoutCreateInfo.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCreateInfo.setLayoutCount = 1;
+    pipelineLayoutCreateInfo.pSetLayouts = &*layout;
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+    if (vkCreatePipelineLayout(Context::get().getDevice(),
+                               &pipelineLayoutCreateInfo, nullptr,
+                               &*pipelineLayout) != VK_SUCCESS)
+        throw std::runtime_error{"failed to create pipeline layout!"};
+
+    ManagedShaderModule shaderModule{
+        Context::get().loadShaderModule("HiZComp.comp.spv")};
+
+    VkPipelineShaderStageCreateInfo stageInfo{};
+    stageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    stageInfo.module = *shaderModule;
+    stageInfo.pName = "main";
+
+    VkComputePipelineCreateInfo pipelineCreateInfo{};
+    pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineCreateInfo.stage = stageInfo;
+    pipelineCreateInfo.layout = *pipelineLayout;
+    pipelineCreateInfo.basePipelineHandle = VK_NULL_HANDLE;
+    pipelineCreateInfo.basePipelineIndex = -1;
+
+    if (vkCreateComputePipelines(Context::get().getDevice(),
+                                 Context::get().getPipelineCache(), 1,
+                                 &pipelineCreateInfo, nullptr,
+                                 &*pipeline) != VK_SUCCESS)
+        throw std::runtime_error{"failed to create Hi-Z pipeline!"};
+}
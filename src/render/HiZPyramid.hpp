@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vulkan/vulkan_core.h>
+
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "Context.hpp"
+#include "Managed.hpp"
+#include "Primitives.hpp"
+
+namespace render {
+
+// Mip chain of a depth buffer keeping the farthest depth of each texel, so
+// that a box can be tested for occlusion with a handful of reads. Texel x of
+// level l covers the depth pixels [x, x + 1) * 2^(l + 1), the last one of a
+// row or column less. The image stays in VK_IMAGE_LAYOUT_GENERAL.
+class HiZPyramid {
+public:
+    static constexpr uint32_t GROUP_SIZE = 8;
+
+    HiZPyramid();
+
+    // Recreates the pyramid for a new depth buffer size, dropping its
+    // contents. Call before recording anything reading it, the GPU must not
+    // be using the old one anymore.
+    void resize(VkExtent2D depthExtent);
+
+    // Downsamples the depth buffer, rendered with vp, into the pyramid. The
+    // depth buffer has to be in DEPTH_STENCIL_READ_ONLY_OPTIMAL and done
+    // being written.
+    void build(VkCommandBuffer commandBuffer, uint32_t frameInFlight,
+               const Image& depth, const glm::mat4& vp);
+
+    // Whether the pyramid holds a depth buffer already
+    bool isValid() const { return valid; }
+    // VP matrix the depth buffer was rendered with
+    const glm::mat4& getVP() const { return vp; }
+    VkExtent2D getDepthExtent() const { return depthExtent; }
+    uint32_t getLevels() const { return pyramid.mipLevels; }
+
+    VkImageView getView() const { return *pyramid.view; }
+    VkSampler getSampler() const { return *sampler; }
+    // Changes whenever the image is recreated
+    uint32_t getGeneration() const { return generation; }
+
+private:
+    // Enough for a 65536 pixels wide depth buffer
+    static constexpr uint32_t MAX_LEVELS = 16;
+
+    void createSampler();
+    void createLayout();
+    void createDescriptorPool();
+    void createPipeline();
+
+    void writeSet(VkDescriptorSet set, VkImageView source,
+                  VkImageLayout sourceLayout, VkImageView destination);
+
+    Image pyramid;
+    std::vector<ManagedImageView> levelViews;
+    VkExtent2D depthExtent{0, 0};
+    bool valid{false};
+    bool needsTransition{false};
+    uint32_t generation{0};
+    glm::mat4 vp{1.0f};
+
+    ManagedSampler sampler;
+    ManagedDescriptorSetLayout layout;
+    ManagedDescriptorPool descriptorPool;
+    // Level 0 reads the depth buffer of the frame, rewritten every build
+    VkDescriptorSet depthSets[Context::FRAMES_IN_FLIGHT];
+    // Level i reads level i - 1
+    std::vector<VkDescriptorSet> levelSets;
+
+    ManagedPipelineLayout pipelineLayout;
+    ManagedPipeline pipeline;
+};
+
+}  // namespace render
@@ -0,0 +1,519 @@
+#include "IndirectDraws.hpp"
+
+#include <stdexcept>
+
+#include "BufferManager.hpp"
+
+using namespace render;
+
+namespace {
+constexpr uint32_t STRIDE = sizeof(VkDrawIndexedIndirectCommand);
+// Instances of direct draws come after the one of each indirect draw, and
+// the zero one
+constexpr uint32_t FIRST_INSTANCE = IndirectDraws::MAX_DRAWS + 1;
+constexpr uint32_t CULL_GROUP_SIZE = 64;
+constexpr uint32_t CULL_BINDINGS = 6;
+}  // namespace
+
+bool IndirectDraws::supportsGpuCulling() {
+    // The culled commands can only find their instance with firstInstance
+    return Context::get().getDeviceInfo().hasDrawIndirectFirstInstance;
+}
+
+IndirectDraws::IndirectDraws() {
+    const auto& deviceInfo = Context::get().getDeviceInfo();
+
+    gpuCulled = supportsGpuCulling();
+    // A count above one is a multi-draw too
+    hasDrawCount = deviceInfo.hasMultiDrawIndirect &&
+                   Context::get().getCmdDrawIndexedIndirectCount() != nullptr;
+
+    auto& bufferManager = BufferManager::get();
+    for (auto& frame : frames) {
+        frame.commands = bufferManager.allocateHostBuffer(
+            MAX_DRAWS * STRIDE, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+        frame.instances = bufferManager.allocateHostBuffer(
+            (FIRST_INSTANCE + MAX_INSTANCES) * sizeof(GeometryInstance),
+            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+
+        if (!gpuCulled) continue;
+
+        // Room for both rounds of culling
+        frame.culledCommands = bufferManager.allocateDeviceBuffer(
+            2 * MAX_DRAWS * STRIDE, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                        VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+        frame.candidates = bufferManager.allocateHostBuffer(
+            MAX_DRAWS * sizeof(Candidate), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+        frame.counts = bufferManager.allocateHostBuffer(
+            2 * MAX_RUNS * sizeof(uint32_t),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            true);
+        frame.occluded = bufferManager.allocateDeviceBuffer(
+            MAX_DRAWS * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+        frame.cullUbo = bufferManager.allocateHostBuffer(
+            sizeof(CullUbo), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+    }
+
+    commands.resize(MAX_DRAWS);
+    runs.reserve(MAX_RUNS);
+
+    if (gpuCulled) {
+        placeholder =
+            bufferManager.allocateStorageImage(1, 1, 1, VK_FORMAT_R32_SFLOAT);
+
+        VkSamplerCreateInfo samplerInfo{};
+        samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerInfo.magFilter = VK_FILTER_NEAREST;
+        samplerInfo.minFilter = VK_FILTER_NEAREST;
+        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.maxAnisotropy = 1.0f;
+        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+
+        if (vkCreateSampler(Context::get().getDevice(), &samplerInfo, nullptr,
+                            &*placeholderSampler) != VK_SUCCESS)
+            throw std::runtime_error{"failed to create cull sampler!"};
+
+        createCullLayout();
+        createCullDescriptorSets();
+        Context::get().createPipelineAsync([this] { createCullPipeline(); });
+    }
+}
+
+void IndirectDraws::begin(uint32_t frameInFlight) {
+    frame = frameInFlight;
+    count = 0;
+    runStart = 0;
+    runs.clear();
+    frustum = 0;
+    instanceCount = 0;
+
+    FrameBuffers& buffers = frames[frame];
+
+    // The GPU is done with this frame, so are its counts
+    if (gpuCulled) {
+        vmaInvalidateAllocation(Context::get().getVma(),
+                                buffers.counts.buffer.getMemory(), 0,
+                                VK_WHOLE_SIZE);
+        gpuVisible = 0;
+        for (uint32_t i = 0; i < buffers.runCount; i++)
+            gpuVisible += buffers.counts.data<uint32_t>()[i] +
+                          buffers.counts.data<uint32_t>()[MAX_RUNS + i];
+        buffers.runCount = 0;
+    }
+    disoccludedCulled = false;
+
+    buffers.instances.data<GeometryInstance>()[0] =
+        GeometryInstance::fromOffset(glm::vec3{0.0f});
+}
+
+void IndirectDraws::bindInstances(VkCommandBuffer commandBuffer) const {
+    // No-op on coherent memory
+    vmaFlushAllocation(Context::get().getVma(),
+                       frames[frame].instances.buffer.getMemory(), 0,
+                       VK_WHOLE_SIZE);
+
+    VkDeviceSize offsets[] = {0};
+    vkCmdBindVertexBuffers(commandBuffer, GeometryMesh::INSTANCE_BINDING, 1,
+                           &*frames[frame].instances.buffer, offsets);
+}
+
+bool IndirectDraws::add(const GeometryMesh& mesh, glm::vec3 offset,
+                        uint32_t texture) {
+    if (count == MAX_DRAWS || runs.size() == MAX_RUNS) return false;
+
+    const auto& allocation =
+        BufferManager::get().getGeometryHeap().get(mesh.heap.index);
+    FrameBuffers& buffers = frames[frame];
+
+    VkDrawIndexedIndirectCommand& command = commands[count];
+    command.indexCount = allocation.indexCount;
+    command.instanceCount = 1;
+    command.firstIndex = allocation.indexOffset;
+    command.vertexOffset = static_cast<int32_t>(allocation.vertexOffset);
+    command.firstInstance = count + 1;
+
+    buffers.instances.data<GeometryInstance>()[count + 1] =
+        GeometryInstance::fromOffset(offset, texture);
+
+    if (gpuCulled) {
+        buffers.candidates.data<Candidate>()[count] = {
+            glm::vec4{offset + mesh.boundsMin, 0.0f},
+            glm::vec4{offset + mesh.boundsMax, 0.0f},
+            command.indexCount,
+            command.firstIndex,
+            command.vertexOffset,
+            static_cast<uint32_t>(runs.size()),
+            runStart,
+            frustum};
+    } else {
+        buffers.commands.data<VkDrawIndexedIndirectCommand>()[count] =
+            command;
+    }
+
+    count++;
+    return true;
+}
+
+uint32_t IndirectDraws::addInstance(const GeometryInstance& instance) {
+    if (instanceCount == MAX_INSTANCES) return NO_INSTANCE;
+
+    uint32_t index = FIRST_INSTANCE + instanceCount++;
+    frames[frame].instances.data<GeometryInstance>()[index] = instance;
+    return index;
+}
+
+uint32_t IndirectDraws::endRun() {
+    if (count == runStart) return NO_RUN;
+
+    runs.push_back({runStart, count - runStart});
+    runStart = count;
+    return static_cast<uint32_t>(runs.size() - 1);
+}
+
+void IndirectDraws::cull(VkCommandBuffer commandBuffer, const Frustum* frusta,
+                         uint32_t frustumCount, const HiZPyramid* hiZ) {
+    if (!gpuCulled || count == 0) return;
+    if (frustumCount > MAX_FRUSTA)
+        throw std::runtime_error{"too many frusta to cull against!"};
+
+    FrameBuffers& buffers = frames[frame];
+    buffers.runCount = static_cast<uint32_t>(runs.size());
+
+    bindHiZ(hiZ);
+
+    CullUbo& ubo = *buffers.cullUbo.data<CullUbo>();
+    for (uint32_t f = 0; f < frustumCount; f++)
+        for (int i = 0; i < Frustum::PLANE_COUNT; i++)
+            ubo.planes[f][i] = frusta[f].planes[i];
+    ubo.hiZInfo = glm::uvec4{0};
+    if (hiZ) {
+        VkExtent2D extent = hiZ->getDepthExtent();
+        ubo.occlusionVP[0] = hiZ->getVP();
+        ubo.hiZInfo = {extent.width, extent.height, hiZ->getLevels(),
+                       hiZ->isValid() ? 1u : 0u};
+    }
+
+    // No-op on coherent memory
+    vmaFlushAllocation(Context::get().getVma(),
+                       buffers.candidates.buffer.getMemory(), 0,
+                       VK_WHOLE_SIZE);
+    vmaFlushAllocation(Context::get().getVma(),
+                       buffers.cullUbo.buffer.getMemory(), 0, VK_WHOLE_SIZE);
+
+    vkCmdFillBuffer(commandBuffer, *buffers.counts.buffer, 0, VK_WHOLE_SIZE,
+                    0);
+
+    // The pyramid was last written by the previous frame
+    VkMemoryBarrier clearBarrier{};
+    clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    clearBarrier.srcAccessMask =
+        VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    clearBarrier.dstAccessMask =
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+    VkImageMemoryBarrier placeholderBarrier{};
+    placeholderBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    placeholderBarrier.srcAccessMask = 0;
+    placeholderBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    placeholderBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    placeholderBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    placeholderBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    placeholderBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    placeholderBarrier.image = *placeholder.image;
+    placeholderBarrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0,
+                                           1};
+
+    vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &clearBarrier, 0, nullptr,
+        placeholderReady ? 0 : 1, &placeholderBarrier);
+    placeholderReady = true;
+
+    dispatchCull(commandBuffer, 0);
+}
+
+void IndirectDraws::cullDisoccluded(VkCommandBuffer commandBuffer,
+                                    const HiZPyramid& hiZ,
+                                    const glm::mat4& vp) {
+    if (!gpuCulled || count == 0) return;
+
+    FrameBuffers& buffers = frames[frame];
+    bindHiZ(&hiZ);
+
+    // Read when the command buffer runs, after both rounds are recorded
+    buffers.cullUbo.data<CullUbo>()->occlusionVP[1] = vp;
+    vmaFlushAllocation(Context::get().getVma(),
+                       buffers.cullUbo.buffer.getMemory(), 0, VK_WHOLE_SIZE);
+
+    // The first round wrote which draws were hidden
+    VkMemoryBarrier occludedBarrier{};
+    occludedBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    occludedBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    occludedBarrier.dstAccessMask =
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                         &occludedBarrier, 0, nullptr, 0, nullptr);
+
+    dispatchCull(commandBuffer, 1);
+    disoccludedCulled = true;
+}
+
+void IndirectDraws::dispatchCull(VkCommandBuffer commandBuffer,
+                                 uint32_t round) {
+    FrameBuffers& buffers = frames[frame];
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      *cullPipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            *cullPipelineLayout, 0, 1, &buffers.cullSet, 0,
+                            nullptr);
+
+    CullPushBuffer pushBuffer{};
+    pushBuffer.candidateCount = count;
+    pushBuffer.compact = hasDrawCount ? 1 : 0;
+    pushBuffer.round = round;
+    pushBuffer.commandBase = round * MAX_DRAWS;
+    pushBuffer.countBase = round * MAX_RUNS;
+
+    vkCmdPushConstants(commandBuffer, *cullPipelineLayout,
+                       VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullPushBuffer),
+                       &pushBuffer);
+
+    uint32_t groups = (count + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE;
+    vkCmdDispatch(commandBuffer, groups, 1, 1);
+
+    // The counts are also read back on the host by begin(), once the
+    // frame's fence has signalled
+    VkMemoryBarrier cullBarrier{};
+    cullBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    cullBarrier.dstAccessMask =
+        VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(
+        commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0, 1,
+        &cullBarrier, 0, nullptr, 0, nullptr);
+}
+
+void IndirectDraws::bindHiZ(const HiZPyramid* hiZ) {
+    FrameBuffers& buffers = frames[frame];
+    uint32_t generation = hiZ ? hiZ->getGeneration() : 0;
+    if (hiZ == buffers.boundHiZ && generation == buffers.boundGeneration)
+        return;
+
+    // This frame in flight is done on the GPU, so is its set
+    VkDescriptorImageInfo imageInfo{};
+    imageInfo.sampler = hiZ ? hiZ->getSampler() : *placeholderSampler;
+    imageInfo.imageView = hiZ ? hiZ->getView() : *placeholder.view;
+    imageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    VkWriteDescriptorSet descriptorWrite{};
+    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet = buffers.cullSet;
+    descriptorWrite.dstBinding = 3;
+    descriptorWrite.dstArrayElement = 0;
+    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.pImageInfo = &imageInfo;
+
+    vkUpdateDescriptorSets(Context::get().getDevice(), 1, &descriptorWrite, 0,
+                           nullptr);
+
+    buffers.boundHiZ = hiZ;
+    buffers.boundGeneration = generation;
+}
+
+uint32_t IndirectDraws::record(VkCommandBuffer commandBuffer, uint32_t run,
+                               bool disoccluded) {
+    if (run == NO_RUN) return 0;
+    // Culled on the CPU, every visible draw went out the first time
+    if (disoccluded && !disoccludedCulled) return 0;
+
+    const auto& deviceInfo = Context::get().getDeviceInfo();
+    const FrameBuffers& buffers = frames[frame];
+    uint32_t first = runs[run].first;
+    uint32_t last = first + runs[run].count;
+
+    if (gpuCulled) {
+        if (disoccluded) {
+            first += MAX_DRAWS;
+            last += MAX_DRAWS;
+        }
+
+        if (hasDrawCount) {
+            uint32_t countIndex = disoccluded ? MAX_RUNS + run : run;
+            Context::get().getCmdDrawIndexedIndirectCount()(
+                commandBuffer, *buffers.culledCommands, first * STRIDE,
+                *buffers.counts.buffer, countIndex * sizeof(uint32_t),
+                runs[run].count, STRIDE);
+            return 1;
+        }
+
+        // Culled commands stay in place, with no instances
+        if (deviceInfo.hasMultiDrawIndirect) {
+            vkCmdDrawIndexedIndirect(commandBuffer, *buffers.culledCommands,
+                                     first * STRIDE, runs[run].count, STRIDE);
+            return 1;
+        }
+
+        for (uint32_t i = first; i < last; i++)
+            vkCmdDrawIndexedIndirect(commandBuffer, *buffers.culledCommands,
+                                     i * STRIDE, 1, STRIDE);
+        return runs[run].count;
+    }
+
+    // No-op on coherent memory
+    vmaFlushAllocation(Context::get().getVma(),
+                       buffers.commands.buffer.getMemory(), 0, VK_WHOLE_SIZE);
+
+    // Indirect draws can only pick their instance data with firstInstance
+    if (!deviceInfo.hasDrawIndirectFirstInstance) {
+        for (uint32_t i = first; i < last; i++) {
+            const auto& command = commands[i];
+            vkCmdDrawIndexed(commandBuffer, command.indexCount, 1,
+                             command.firstIndex, command.vertexOffset,
+                             command.firstInstance);
+        }
+        return runs[run].count;
+    }
+
+    if (!deviceInfo.hasMultiDrawIndirect) {
+        for (uint32_t i = first; i < last; i++)
+            vkCmdDrawIndexedIndirect(commandBuffer, *buffers.commands.buffer,
+                                     i * STRIDE, 1, STRIDE);
+        return runs[run].count;
+    }
+
+    vkCmdDrawIndexedIndirect(commandBuffer, *buffers.commands.buffer,
+                             first * STRIDE, runs[run].count, STRIDE);
+    return 1;
+}
+
+void IndirectDraws::createCullLayout() {
+    VkDescriptorSetLayoutBinding bindings[CULL_BINDINGS] = {};
+    for (uint32_t i = 0; i < CULL_BINDINGS; i++) {
+        bindings[i].binding = i;
+        bindings[i].descriptorCount = 1;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        bindings[i].pImmutableSamplers = nullptr;
+    }
+    bindings[3].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[5].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+
+    VkDescriptorSetLayoutCreateInfo descriptorSetLayoutInfo{};
+    descriptorSetLayoutInfo.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descriptorSetLayoutInfo.bindingCount = CULL_BINDINGS;
+    descriptorSetLayoutInfo.pBindings = bindings;
+
+    if (vkCreateDescriptorSetLayout(Context::get().getDevice(),
+                                    &descriptorSetLayoutInfo, nullptr,
+                                    &*cullLayout) != VK_SUCCESS)
+        throw std::runtime_error{"failed to create cull descriptor layout!"};
+}
+
+void IndirectDraws::createCullDescriptorSets() {
+    VkDescriptorPoolSize poolSizes[3] = {};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[0].descriptorCount = 4 * Context::FRAMES_IN_FLIGHT;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSizes[1].descriptorCount = Context::FRAMES_IN_FLIGHT;
+    poolSizes[2].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    poolSizes[2].descriptorCount = Context::FRAMES_IN_FLIGHT;
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = 3;
+    poolInfo.pPoolSizes = poolSizes;
+    poolInfo.maxSets = Context::FRAMES_IN_FLIGHT;
+
+    if (vkCreateDescriptorPool(Context::get().getDevice(), &poolInfo, nullptr,
+                               &*cullDescriptorPool) != VK_SUCCESS)
+        throw std::runtime_error{"failed to create cull descriptor pool!"};
+
+    for (auto& frame : frames) {
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = *cullDescriptorPool;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts = &*cullLayout;
+
+        if (vkAllocateDescriptorSets(Context::get().getDevice(), &allocInfo,
+                                     &frame.cullSet) != VK_SUCCESS)
+            throw std::runtime_error{"failed to create cull descriptor set!"};
+
+        // The pyramid at binding 3 is written by bindHiZ()
+        VkDescriptorBufferInfo bufferInfos[5] = {
+            {*frame.candidates.buffer, 0, VK_WHOLE_SIZE},
+            {*frame.culledCommands, 0, VK_WHOLE_SIZE},
+            {*frame.counts.buffer, 0, VK_WHOLE_SIZE},
+            {*frame.occluded, 0, VK_WHOLE_SIZE},
+            {*frame.cullUbo.buffer, 0, VK_WHOLE_SIZE}};
+        uint32_t bindings[5] = {0, 1, 2, 4, 5};
+
+        VkWriteDescriptorSet descriptorWrites[5] = {};
+        for (uint32_t i = 0; i < 5; i++) {
+            descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[i].dstSet = frame.cullSet;
+            descriptorWrites[i].dstBinding = bindings[i];
+            descriptorWrites[i].dstArrayElement = 0;
+            descriptorWrites[i].descriptorType =
+                bindings[i] == 5 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER
+                                 : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            descriptorWrites[i].descriptorCount = 1;
+            descriptorWrites[i].pBufferInfo = &bufferInfos[i];
+        }
+
+        vkUpdateDescriptorSets(Context::get().getDevice(), 5, descriptorWrites,
+                               0, nullptr);
+    }
+}
+
+void IndirectDraws::createCullPipeline() {
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(CullPushBuffer);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
+    pipelineLayoutCreateInfo.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCreateInfo.setLayoutCount = 1;
+    pipelineLayoutCreateInfo.pSetLayouts = &*cullLayout;
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+    if (vkCreatePipelineLayout(Context::get().getDevice(),
+                               &pipelineLayoutCreateInfo, nullptr,
+                               &*cullPipelineLayout) != VK_SUCCESS)
+        throw std::runtime_error{"failed to create pipeline layout!"};
+
+    ManagedShaderModule shaderModule{
+        Context::get().loadShaderModule("CullComp.comp.spv")};
+
+    VkPipelineShaderStageCreateInfo stageInfo{};
+    stageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    stageInfo.module = *shaderModule;
+    stageInfo.pName = "main";
+
+    VkComputePipelineCreateInfo pipelineCreateInfo{};
+    pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineCreateInfo.stage = stageInfo;
+    pipelineCreateInfo.layout = *cullPipelineLayout;
+    pipelineCreateInfo.basePipelineHandle = VK_NULL_HANDLE;
+    pipelineCreateInfo.basePipelineIndex = -1;
+
+    if (vkCreateComputePipelines(Context::get().getDevice(),
+                                 Context::get().getPipelineCache(), 1,
+                                 &pipelineCreateInfo, nullptr,
+                                 &*cullPipeline) != VK_SUCCESS)
+        throw std::runtime_error{"failed to create cull pipeline!"};
+}
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <vulkan/vulkan_core.h>
+
+#include <vector>
+
+#include "Context.hpp"
+#include "Frustum.hpp"
+#include "HiZPyramid.hpp"
+#include "Managed.hpp"
+#include "Primitives.hpp"
+
+namespace render {
+
+// Per frame list of draws of geometry heap meshes. Each draw carries its
+// translation as instance data, so a run of them needs no push constants and
+// goes out as a single multi-draw indirect call. The instance buffer also
+// holds the instances of direct instanced draws, after those of the heap
+// draws.
+//
+// When the device can pick instances in indirect draws, the draws are also
+// frustum culled on the GPU: a compute shader reads their bounds and writes
+// the commands of the visible ones, packed at the start of their run, along
+// with a draw count per run. The CPU then only has to list the candidates.
+//
+// Given a Hi-Z pyramid, the cull shader also drops the draws hidden behind
+// the depth of the previous frame. Some of those are visible now, so once
+// the pyramid holds the depth of this frame, cullDisoccluded() tests them
+// again and the ones that show up are drawn in a second round.
+class IndirectDraws {
+public:
+    static constexpr uint32_t MAX_DRAWS = 8192;
+    static constexpr uint32_t MAX_RUNS = 256;
+    static constexpr uint32_t NO_RUN = UINT32_MAX;
+    // For instanced draws
+    static constexpr uint32_t MAX_INSTANCES = 4096;
+    static constexpr uint32_t NO_INSTANCE = UINT32_MAX;
+    // Frusta a single cull() can test runs against
+    static constexpr uint32_t MAX_FRUSTA = 4;
+
+    IndirectDraws();
+
+    // Whether the device can cull indirect draws on the GPU
+    static bool supportsGpuCulling();
+
+    // Whether the draws are culled by cull(), instead of by the caller
+    bool isGpuCulled() const { return gpuCulled; }
+
+    // Starts over with the buffers of this frame in flight
+    void begin(uint32_t frameInFlight);
+
+    // Instance 0 is always a zero offset, for meshes drawn on their own.
+    // Call it once every instance is added.
+    void bindInstances(VkCommandBuffer commandBuffer) const;
+
+    // Adds an instance for a direct instanced draw and returns its index,
+    // NO_INSTANCE if the frame is out of them. The instances of a draw have
+    // to be added in a row.
+    uint32_t addInstance(const GeometryInstance& instance);
+
+    // Queues a draw of the heap mesh at the given position, with the given
+    // slot of the texture table. False if the frame is out of draws or runs.
+    bool add(const GeometryMesh& mesh, glm::vec3 offset,
+             uint32_t texture = 0);
+    // Groups the draws queued since the last call into a run, to be
+    // recorded in one go. NO_RUN if there were none.
+    uint32_t endRun();
+    uint32_t getRunSize(uint32_t run) const { return runs[run].count; }
+    // Which of the frusta given to cull() the draws queued from now on are
+    // tested against, 0 after begin()
+    void setFrustum(uint32_t index) { frustum = index; }
+
+    // Culls every run against the frustum on the GPU, no-op when culled on
+    // the CPU. Has to be recorded outside of a render pass, after the last
+    // run and before recording any of them. Draws hidden in the last depth
+    // held by hiZ are left for cullDisoccluded().
+    void cull(VkCommandBuffer commandBuffer, const Frustum& frustum,
+              const HiZPyramid* hiZ = nullptr) {
+        cull(commandBuffer, &frustum, 1, hiZ);
+    }
+    // Same, each draw against the frustum set when it was queued
+    void cull(VkCommandBuffer commandBuffer, const Frustum* frusta,
+              uint32_t frustumCount, const HiZPyramid* hiZ = nullptr);
+    // Tests the draws cull() found hidden against hiZ again, now holding
+    // the depth of this frame drawn with vp. Outside of a render pass too.
+    void cullDisoccluded(VkCommandBuffer commandBuffer, const HiZPyramid& hiZ,
+                         const glm::mat4& vp);
+
+    // Records a run, the heap has to be bound. Returns the number of draw
+    // calls it took. The disoccluded draws of a run are recorded apart,
+    // after cullDisoccluded().
+    uint32_t record(VkCommandBuffer commandBuffer, uint32_t run,
+                    bool disoccluded = false);
+
+    // Draws that passed GPU culling the last time this frame in flight was
+    // recorded, they can only be read back once the GPU is done
+    uint32_t getGpuVisible() const { return gpuVisible; }
+
+private:
+    struct Run {
+        uint32_t first;
+        uint32_t count;
+    };
+
+    // Matches the compute shader, std430
+    struct Candidate {
+        glm::vec4 boundsMin;
+        glm::vec4 boundsMax;
+        uint32_t indexCount;
+        uint32_t firstIndex;
+        int32_t vertexOffset;
+        uint32_t run;
+        uint32_t runFirst;
+        uint32_t frustum;
+        uint32_t padding[2];
+    };
+
+    // Matches the compute shader, std140
+    struct CullUbo {
+        glm::vec4 planes[MAX_FRUSTA][Frustum::PLANE_COUNT];
+        // Of the depth in the pyramid for the first round, of this frame
+        // for the second
+        glm::mat4 occlusionVP[2];
+        // Depth buffer size, pyramid levels, whether the first round tests
+        // occlusion
+        glm::uvec4 hiZInfo;
+    };
+
+    struct CullPushBuffer {
+        uint32_t candidateCount;
+        // Packs the visible commands, otherwise the culled ones are left in
+        // place with no instances
+        uint32_t compact;
+        // 0 for cull(), 1 for cullDisoccluded()
+        uint32_t round;
+        // Where the round writes its commands and counts
+        uint32_t commandBase;
+        uint32_t countBase;
+    };
+
+    struct FrameBuffers {
+        // Written by the CPU, or by the cull shader
+        HostBuffer commands;
+        ManagedBuffer culledCommands;
+        HostBuffer instances;
+
+        HostBuffer candidates;
+        // Visible draws per run, the second round after the first
+        HostBuffer counts;
+        uint32_t runCount{0};
+        // Whether each draw was hidden in the first round
+        ManagedBuffer occluded;
+        HostBuffer cullUbo;
+        VkDescriptorSet cullSet{VK_NULL_HANDLE};
+        // Generation of the pyramid bound to the set, none at first
+        const HiZPyramid* boundHiZ{nullptr};
+        uint32_t boundGeneration{UINT32_MAX};
+    };
+
+    void createCullLayout();
+    void createCullDescriptorSets();
+    void createCullPipeline();
+
+    // Points the set of this frame at the pyramid, or the placeholder
+    void bindHiZ(const HiZPyramid* hiZ);
+    void dispatchCull(VkCommandBuffer commandBuffer, uint32_t round);
+
+    bool gpuCulled{false};
+    bool hasDrawCount{false};
+
+    FrameBuffers frames[Context::FRAMES_IN_FLIGHT];
+    uint32_t frame{0};
+
+    // CPU copy of the commands, for devices drawing them directly
+    std::vector<VkDrawIndexedIndirectCommand> commands;
+    uint32_t count{0};
+    uint32_t runStart{0};
+    std::vector<Run> runs;
+    uint32_t frustum{0};
+    uint32_t instanceCount{0};
+
+    uint32_t gpuVisible{0};
+    // Whether the second round ran this frame
+    bool disoccludedCulled{false};
+
+    // Bound in place of a pyramid when there is none, never read
+    Image placeholder;
+    ManagedSampler placeholderSampler;
+    bool placeholderReady{false};
+
+    ManagedDescriptorSetLayout cullLayout;
+    ManagedDescriptorPool cullDescriptorPool;
+    ManagedPipelineLayout cullPipelineLayout;
+    ManagedPipeline cullPipeline;
+};
+
+}  // namespace render
@@ -0,0 +1,95 @@
+#include "JointPalette.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "BufferManager.hpp"
+
+using namespace render;
+
+JointPalette::JointPalette() {
+    for (auto& buffer : buffers)
+        buffer = BufferManager::get().allocateHostBuffer(
+            MAX_JOINTS * sizeof(JointTransform),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+
+    createLayout();
+    createDescriptorSets();
+}
+
+void JointPalette::upload(uint32_t frameInFlight, const RenderQueue& queue) {
+    const auto& joints = queue.getJoints();
+    size_t count = std::min<size_t>(joints.size(), MAX_JOINTS);
+    if (count == 0) return;
+
+    std::memcpy(buffers[frameInFlight].ptr, joints.data(),
+                count * sizeof(JointTransform));
+    // No-op on coherent memory
+    vmaFlushAllocation(Context::get().getVma(),
+                       buffers[frameInFlight].buffer.getMemory(), 0,
+                       count * sizeof(JointTransform));
+}
+
+void JointPalette::createLayout() {
+    VkDescriptorSetLayoutBinding binding{};
+    binding.binding = 0;
+    binding.descriptorCount = 1;
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    binding.pImmutableSamplers = nullptr;
+
+    VkDescriptorSetLayoutCreateInfo descriptorSetLayoutInfo{};
+    descriptorSetLayoutInfo.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descriptorSetLayoutInfo.bindingCount = 1;
+    descriptorSetLayoutInfo.pBindings = &binding;
+
+    if (vkCreateDescriptorSetLayout(Context::get().getDevice(),
+                                    &descriptorSetLayoutInfo, nullptr,
+                                    &*layout) != VK_SUCCESS)
+        throw std::runtime_error{"failed to create palette descriptor layout!"};
+}
+
+void JointPalette::createDescriptorSets() {
+    VkDescriptorPoolSize poolSize{};
+    poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSize.descriptorCount = Context::FRAMES_IN_FLIGHT;
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+    poolInfo.maxSets = Context::FRAMES_IN_FLIGHT;
+
+    if (vkCreateDescriptorPool(Context::get().getDevice(), &poolInfo, nullptr,
+                               &*descriptorPool) != VK_SUCCESS)
+        throw std::runtime_error{"failed to create palette descriptor pool!"};
+
+    for (uint32_t i = 0; i < Context::FRAMES_IN_FLIGHT; i++) {
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = *descriptorPool;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts = &*layout;
+
+        if (vkAllocateDescriptorSets(Context::get().getDevice(), &allocInfo,
+                                     &sets[i]) != VK_SUCCESS)
+            throw std::runtime_error{
+                "failed to create palette descriptor set!"};
+
+        VkDescriptorBufferInfo bufferInfo{*buffers[i].buffer, 0, VK_WHOLE_SIZE};
+
+        VkWriteDescriptorSet descriptorWrite{};
+        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrite.dstSet = sets[i];
+        descriptorWrite.dstBinding = 0;
+        descriptorWrite.dstArrayElement = 0;
+        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrite.descriptorCount = 1;
+        descriptorWrite.pBufferInfo = &bufferInfo;
+
+        vkUpdateDescriptorSets(Context::get().getDevice(), 1, &descriptorWrite,
+                               0, nullptr);
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vulkan/vulkan_core.h>
+
+#include "Context.hpp"
+#include "Managed.hpp"
+#include "Primitives.hpp"
+#include "RenderQueue.hpp"
+
+namespace render {
+
+// Joints of every skinned mesh of a frame, read by the vertex shaders from a
+// storage buffer. A skinned mesh is drawn in one call whatever its number of
+// joints: its instance points at its first joint, and each vertex picks its
+// own from there.
+class JointPalette {
+public:
+    static constexpr uint32_t MAX_JOINTS = RenderQueue::MAX_JOINTS;
+
+    JointPalette();
+
+    // Copies the joints of the queue into the buffer of this frame in flight
+    void upload(uint32_t frameInFlight, const RenderQueue& queue);
+
+    VkDescriptorSetLayout getLayout() const { return *layout; }
+    VkDescriptorSet getSet(uint32_t frameInFlight) const {
+        return sets[frameInFlight];
+    }
+
+private:
+    void createLayout();
+    void createDescriptorSets();
+
+    // One per frame in flight, so the GPU never reads a half written one
+    HostBuffer buffers[Context::FRAMES_IN_FLIGHT];
+    VkDescriptorSet sets[Context::FRAMES_IN_FLIGHT];
+
+    ManagedDescriptorSetLayout layout;
+    ManagedDescriptorPool descriptorPool;
+};
+
+}  // namespace render
@@ -5,11 +5,14 @@
 #include <vulkan/vulkan_core.h>
 
 #include <array>
+#include <cstdint>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_inverse.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtx/quaternion.hpp>
+#include <utility>
+#include <vector>
 
 // #include "BufferManager.hpp"
 #include "Managed.hpp"
@@ -22,11 +25,28 @@ struct SkyboxVertex {
     glm::vec2 uv;
 };
 
+// Built by the game, then stored by GeometryMesh as two streams
 struct GeometryVertex {
     glm::vec3 pos;
     glm::vec3 normal;
     glm::vec2 uv;
     float specStrength;
+    // Index in the joint palette of the instance, for skinned meshes
+    uint32_t joint{0};
+};
+
+// What depth only passes read of a vertex, the joint is needed to place
+// skinned vertices
+struct DepthVertex {
+    glm::vec3 pos;
+    uint32_t joint;
+};
+
+// The rest of a vertex, only read when shading
+struct SurfaceVertex {
+    glm::vec3 normal;
+    glm::vec2 uv;
+    float specStrength;
 };
 
 struct UiVertex {
@@ -34,6 +54,67 @@ struct UiVertex {
     glm::vec2 uv;
 };
 
+// Per instance data of the geometry pipelines
+struct GeometryInstance {
+    static constexpr uint32_t NO_PALETTE = UINT32_MAX;
+
+    // Added to the world position
+    glm::vec3 offset;
+    // First joint of a skinned mesh in the joint palette
+    uint32_t palette;
+    // Applied before the offset, as x, y, z, w
+    glm::vec4 rotation;
+    // Slot of the texture in the texture table
+    uint32_t texture;
+
+    static GeometryInstance fromOffset(glm::vec3 offset,
+                                       uint32_t texture = 0) {
+        return {offset, NO_PALETTE, glm::vec4{0.0f, 0.0f, 0.0f, 1.0f},
+                texture};
+    }
+
+    static GeometryInstance fromTransform(glm::vec3 pos, glm::quat rot,
+                                          uint32_t palette = NO_PALETTE,
+                                          uint32_t texture = 0) {
+        return {pos, palette, glm::vec4{rot.x, rot.y, rot.z, rot.w}, texture};
+    }
+};
+
+// Joint of a skinned mesh, in model space. Matches the vertex shaders,
+// std430.
+struct JointTransform {
+    // w is unused
+    glm::vec4 pos;
+    // As x, y, z, w
+    glm::vec4 rot;
+
+    static JointTransform fromTransform(glm::vec3 pos, glm::quat rot) {
+        return {glm::vec4{pos, 0.0f}, glm::vec4{rot.x, rot.y, rot.z, rot.w}};
+    }
+};
+
+// Slot of a mesh in the geometry heap. Move only, like the buffers, so that
+// a slot is never released twice.
+struct HeapHandle {
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    uint32_t index{NONE};
+
+    HeapHandle() = default;
+    HeapHandle(uint32_t index) : index{index} {}
+    HeapHandle(const HeapHandle &) = delete;
+    HeapHandle &operator=(const HeapHandle &) = delete;
+
+    HeapHandle(HeapHandle &&other)
+        : index{std::exchange(other.index, NONE)} {}
+    HeapHandle &operator=(HeapHandle &&other) {
+        index = std::exchange(other.index, NONE);
+        return *this;
+    }
+
+    bool isNull() const { return index == NONE; }
+};
+
 struct BaseMesh {
     ManagedBuffer buffer;
 
@@ -43,12 +124,21 @@ struct BaseMesh {
     size_t vertexCount{0};
     size_t indexCount{0};
 
+    // Upload batch filling the buffer, it can't be drawn before it completes
+    uint64_t uploadBatch{0};
+
+    // Set for meshes living in the geometry heap instead of their own
+    // buffer, the offsets above are then unused
+    HeapHandle heap;
+
     BaseMesh() = default;
     BaseMesh(BaseMesh &&) = default;
     BaseMesh &operator=(BaseMesh &&) = default;
 
-    bool isNull() const { return buffer.isNull(); }
+    bool isNull() const { return buffer.isNull() && heap.isNull(); }
+    bool isInHeap() const { return !heap.isNull(); }
 
+    // Only for meshes with their own buffer
     void bind(VkCommandBuffer commandBuffer) const {
         VkDeviceSize offsets[] = {vertexOffset};
         vkCmdBindVertexBuffers(commandBuffer, 0, 1, &*buffer, offsets);
@@ -86,40 +176,148 @@ struct SkyboxMesh : BaseMesh {
     }
 };
 
+// The vertices are stored as a stream of DepthVertex, followed by a stream
+// of SurfaceVertex, so that depth only passes fetch positions alone
 struct GeometryMesh : BaseMesh {
     using Vertex = GeometryVertex;
 
-    static VkVertexInputBindingDescription getBindingDescription() {
-        VkVertexInputBindingDescription description{};
-        description.binding = 0;
-        description.stride = sizeof(GeometryVertex);
-        description.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+    static constexpr uint32_t DEPTH_BINDING = 0;
+    static constexpr uint32_t SURFACE_BINDING = 1;
+    static constexpr uint32_t INSTANCE_BINDING = 2;
 
-        return description;
+    // Only for meshes with their own buffer, the depth stream starts at
+    // vertexOffset
+    VkDeviceSize surfaceOffset{0};
+
+    // Model space bounding box, filled in by BufferManager::allocateMesh
+    glm::vec3 boundsMin{0.0f};
+    glm::vec3 boundsMax{0.0f};
+
+    // Only for meshes with their own buffer
+    void bind(VkCommandBuffer commandBuffer) const {
+        VkBuffer buffers[] = {*buffer, *buffer};
+        VkDeviceSize offsets[] = {vertexOffset, surfaceOffset};
+        vkCmdBindVertexBuffers(commandBuffer, DEPTH_BINDING, 2, buffers,
+                               offsets);
+        vkCmdBindIndexBuffer(commandBuffer, *buffer, indicesOffset,
+                             VK_INDEX_TYPE_UINT16);
+    }
+
+    // Leaves the surface stream out
+    void bindDepth(VkCommandBuffer commandBuffer) const {
+        BaseMesh::bind(commandBuffer);
+    }
+
+    static void splitVertices(const std::vector<Vertex> &vertices,
+                              std::vector<DepthVertex> &depth,
+                              std::vector<SurfaceVertex> &surface) {
+        depth.clear();
+        surface.clear();
+        depth.reserve(vertices.size());
+        surface.reserve(vertices.size());
+        for (const auto &vertex : vertices) {
+            depth.push_back({vertex.pos, vertex.joint});
+            surface.push_back(
+                {vertex.normal, vertex.uv, vertex.specStrength});
+        }
     }
 
-    static std::array<VkVertexInputAttributeDescription, 4>
+    void computeBounds(const std::vector<Vertex> &vertices) {
+        if (vertices.empty()) return;
+
+        boundsMin = boundsMax = vertices[0].pos;
+        for (const auto &vertex : vertices) {
+            boundsMin = glm::min(boundsMin, vertex.pos);
+            boundsMax = glm::max(boundsMax, vertex.pos);
+        }
+    }
+
+    static std::array<VkVertexInputBindingDescription, 3>
+    getBindingDescriptions() {
+        std::array<VkVertexInputBindingDescription, 3> descriptions{};
+        descriptions[0] = getDepthBindingDescriptions()[0];
+
+        descriptions[1].binding = SURFACE_BINDING;
+        descriptions[1].stride = sizeof(SurfaceVertex);
+        descriptions[1].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+        descriptions[2] = getDepthBindingDescriptions()[1];
+
+        return descriptions;
+    }
+
+    static std::array<VkVertexInputAttributeDescription, 9>
     getAttributeDescriptions() {
-        std::array<VkVertexInputAttributeDescription, 4> descriptions{};
-        descriptions[0].binding = 0;
+        std::array<VkVertexInputAttributeDescription, 9> descriptions{};
+        auto depthDescriptions = getDepthAttributeDescriptions();
+        for (size_t i = 0; i < depthDescriptions.size(); i++)
+            descriptions[i] = depthDescriptions[i];
+
+        descriptions[5].binding = SURFACE_BINDING;
+        descriptions[5].location = 1;
+        descriptions[5].format = VK_FORMAT_R32G32B32_SFLOAT;
+        descriptions[5].offset = offsetof(SurfaceVertex, normal);
+
+        descriptions[6].binding = SURFACE_BINDING;
+        descriptions[6].location = 2;
+        descriptions[6].format = VK_FORMAT_R32G32_SFLOAT;
+        descriptions[6].offset = offsetof(SurfaceVertex, uv);
+
+        descriptions[7].binding = SURFACE_BINDING;
+        descriptions[7].location = 3;
+        descriptions[7].format = VK_FORMAT_R32_SFLOAT;
+        descriptions[7].offset = offsetof(SurfaceVertex, specStrength);
+
+        descriptions[8].binding = INSTANCE_BINDING;
+        descriptions[8].location = 8;
+        descriptions[8].format = VK_FORMAT_R32_UINT;
+        descriptions[8].offset = offsetof(GeometryInstance, texture);
+
+        return descriptions;
+    }
+
+    // For depth only passes, without the surface stream
+    static std::array<VkVertexInputBindingDescription, 2>
+    getDepthBindingDescriptions() {
+        std::array<VkVertexInputBindingDescription, 2> descriptions{};
+        descriptions[0].binding = DEPTH_BINDING;
+        descriptions[0].stride = sizeof(DepthVertex);
+        descriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+        descriptions[1].binding = INSTANCE_BINDING;
+        descriptions[1].stride = sizeof(GeometryInstance);
+        descriptions[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+        return descriptions;
+    }
+
+    static std::array<VkVertexInputAttributeDescription, 5>
+    getDepthAttributeDescriptions() {
+        std::array<VkVertexInputAttributeDescription, 5> descriptions{};
+        descriptions[0].binding = DEPTH_BINDING;
         descriptions[0].location = 0;
         descriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-        descriptions[0].offset = offsetof(GeometryVertex, pos);
+        descriptions[0].offset = offsetof(DepthVertex, pos);
 
-        descriptions[1].binding = 0;
-        descriptions[1].location = 1;
+        descriptions[1].binding = INSTANCE_BINDING;
+        descriptions[1].location = 4;
         descriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-        descriptions[1].offset = offsetof(GeometryVertex, normal);
+        descriptions[1].offset = offsetof(GeometryInstance, offset);
 
-        descriptions[2].binding = 0;
-        descriptions[2].location = 2;
-        descriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-        descriptions[2].offset = offsetof(GeometryVertex, uv);
+        descriptions[2].binding = INSTANCE_BINDING;
+        descriptions[2].location = 5;
+        descriptions[2].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+        descriptions[2].offset = offsetof(GeometryInstance, rotation);
 
-        descriptions[3].binding = 0;
-        descriptions[3].location = 3;
-        descriptions[3].format = VK_FORMAT_R32_SFLOAT;
-        descriptions[3].offset = offsetof(GeometryVertex, specStrength);
+        descriptions[3].binding = DEPTH_BINDING;
+        descriptions[3].location = 6;
+        descriptions[3].format = VK_FORMAT_R32_UINT;
+        descriptions[3].offset = offsetof(DepthVertex, joint);
+
+        descriptions[4].binding = INSTANCE_BINDING;
+        descriptions[4].location = 7;
+        descriptions[4].format = VK_FORMAT_R32_UINT;
+        descriptions[4].offset = offsetof(GeometryInstance, palette);
 
         return descriptions;
     }
@@ -178,6 +376,29 @@ struct Ubo {
     }
 };
 
+// Host visible buffer, mapped for its whole life
+struct HostBuffer {
+    ManagedBuffer buffer;
+
+    void *ptr{nullptr};
+    size_t size{0};
+
+    HostBuffer() = default;
+    HostBuffer(HostBuffer &&) = default;
+    HostBuffer &operator=(HostBuffer &&) = default;
+
+    ~HostBuffer() {
+        if (buffer.getMemory() != VK_NULL_HANDLE)
+            vmaUnmapMemory(Context::get().getVma(), buffer.getMemory());
+        ptr = nullptr;
+    }
+
+    template <typename T>
+    T *data() {
+        return reinterpret_cast<T *>(ptr);
+    }
+};
+
 struct Image {
     ManagedImage image;
     ManagedImageView view;
@@ -185,6 +406,7 @@ struct Image {
     uint32_t width{0};
     uint32_t height{0};
     VkFormat format{VK_FORMAT_UNDEFINED};
+    uint32_t mipLevels{1};
 
     Image() = default;
     Image(Image &&) = default;
@@ -194,27 +416,50 @@ struct Image {
 struct Texture {
     Image image;
     ManagedSampler sampler{VK_NULL_HANDLE};
-    VkDescriptorSet descriptor{VK_NULL_HANDLE};
+    // Slot in the texture table of BufferManager
+    uint32_t index{0};
 
     Texture() = default;
     Texture(Texture &&) = default;
-    Texture &operator=(Texture &&) = default;
+    // Both give the image and slot back to BufferManager, which keeps them
+    // until the frames in flight are done with them
+    Texture &operator=(Texture &&other);
+    ~Texture();
 };
 
 struct GeometryModel {
-    const GeometryMesh &mesh;
-    const Texture &texture;
+    const GeometryMesh *mesh;
+    const Texture *texture;
     glm::vec3 pos;
     glm::quat rot;
+    // Hidden from the camera, but it may still cast shadows
+    bool shadowOnly{false};
 
     glm::mat4 computeModelMat() const {
         return glm::translate(glm::mat4(1.0f), pos) * glm::toMat4(rot);
     }
 };
 
+// Placement of one copy of an instanced mesh
+struct ModelInstance {
+    glm::vec3 pos;
+    glm::quat rot;
+    // First joint in the palette of the render queue, for skinned meshes
+    uint32_t palette{GeometryInstance::NO_PALETTE};
+};
+
+// Copies of a mesh sharing a texture, drawn with a single call
+struct InstancedModel {
+    const GeometryMesh *mesh;
+    const Texture *texture;
+    // Range of the instances in the render queue
+    uint32_t first;
+    uint32_t count;
+};
+
 struct UiModel {
-    const UiMesh &mesh;
-    const Texture &texture;
+    const UiMesh *mesh;
+    const Texture *texture;
     glm::vec2 pos;
     glm::vec2 anchorPoint;
 };
@@ -0,0 +1,161 @@
+#include "RecordPool.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace render;
+
+RecordPool::RecordPool() {
+    uint32_t count = std::clamp(std::thread::hardware_concurrency(), 1u,
+                                MAX_WORKERS);
+
+    VkCommandPoolCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    createInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    createInfo.queueFamilyIndex =
+        Context::get().getDeviceInfo().queues.graphics.value();
+
+    for (uint32_t i = 0; i < count; i++) {
+        auto worker = std::make_unique<Worker>();
+        for (auto& pool : worker->pools) {
+            if (vkCreateCommandPool(Context::get().getDevice(), &createInfo,
+                                    nullptr, &*pool) != VK_SUCCESS)
+                throw std::runtime_error{"failed to create command pool!"};
+        }
+        workers.push_back(std::move(worker));
+    }
+
+    // Only once every worker exists, as they index the list
+    for (uint32_t i = 0; i < count; i++)
+        workers[i]->thread = std::thread{[this, i] { run(i); }};
+}
+
+RecordPool::~RecordPool() {
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        stopping = true;
+    }
+    jobReady.notify_all();
+
+    for (auto& worker : workers) {
+        if (worker->thread.joinable()) worker->thread.join();
+    }
+}
+
+void RecordPool::begin(uint32_t frameInFlight) {
+    frame = frameInFlight;
+
+    for (auto& worker : workers) {
+        vkResetCommandPool(Context::get().getDevice(),
+                           *worker->pools[frameInFlight], 0);
+        worker->used = 0;
+    }
+}
+
+void RecordPool::record(VkCommandBuffer commandBuffer, VkRenderPass renderPass,
+                        VkFramebuffer framebuffer, const Job& job) {
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        this->job = &job;
+        jobRenderPass = renderPass;
+        jobFramebuffer = framebuffer;
+        pending = getWorkerCount();
+        generation++;
+    }
+    jobReady.notify_all();
+
+    {
+        std::unique_lock<std::mutex> lock{mutex};
+        jobDone.wait(lock, [this] { return pending == 0; });
+        this->job = nullptr;
+    }
+
+    std::exception_ptr error;
+    std::vector<VkCommandBuffer> buffers;
+    for (auto& worker : workers) {
+        if (worker->error && !error) error = worker->error;
+        worker->error = nullptr;
+        buffers.push_back(worker->current);
+    }
+    if (error) std::rethrow_exception(error);
+
+    vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(buffers.size()),
+                         buffers.data());
+}
+
+void RecordPool::run(uint32_t slice) {
+    Worker& worker = *workers[slice];
+    uint64_t done = 0;
+
+    while (true) {
+        const Job* current;
+        VkRenderPass renderPass;
+        VkFramebuffer framebuffer;
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            jobReady.wait(lock,
+                          [&] { return stopping || generation != done; });
+            if (stopping) return;
+
+            done = generation;
+            current = job;
+            renderPass = jobRenderPass;
+            framebuffer = jobFramebuffer;
+        }
+
+        try {
+            VkCommandBuffer commandBuffer =
+                beginBuffer(worker, renderPass, framebuffer);
+            (*current)(commandBuffer, slice);
+
+            if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+                throw std::runtime_error{"failed to record command buffer!"};
+            worker.current = commandBuffer;
+        } catch (...) {
+            worker.error = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            pending--;
+        }
+        jobDone.notify_one();
+    }
+}
+
+VkCommandBuffer RecordPool::beginBuffer(Worker& worker,
+                                        VkRenderPass renderPass,
+                                        VkFramebuffer framebuffer) {
+    auto& buffers = worker.buffers[frame];
+    if (worker.used == buffers.size()) {
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = *worker.pools[frame];
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        allocInfo.commandBufferCount = 1;
+
+        VkCommandBuffer commandBuffer;
+        if (vkAllocateCommandBuffers(Context::get().getDevice(), &allocInfo,
+                                     &commandBuffer) != VK_SUCCESS)
+            throw std::runtime_error{"failed to create command buffer!"};
+        buffers.push_back(commandBuffer);
+    }
+    VkCommandBuffer commandBuffer = buffers[worker.used++];
+
+    VkCommandBufferInheritanceInfo inheritanceInfo{};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritanceInfo.renderPass = renderPass;
+    inheritanceInfo.subpass = 0;
+    inheritanceInfo.framebuffer = framebuffer;
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT |
+                      VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+        throw std::runtime_error{"failed to begin recording command buffer!"};
+
+    return commandBuffer;
+}
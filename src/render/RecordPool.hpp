@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vulkan/vulkan_core.h>
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Context.hpp"
+#include "Managed.hpp"
+
+namespace render {
+
+// Worker threads recording the draws of a render pass into secondary command
+// buffers, one slice of them each, so that recording scales with the cores.
+// Command pools can only be used by one thread at a time, so every worker
+// has its own, one per frame in flight.
+class RecordPool {
+public:
+    static constexpr uint32_t MAX_WORKERS = 8;
+
+    // Records slice slice out of getWorkerCount() into commandBuffer
+    using Job =
+        std::function<void(VkCommandBuffer commandBuffer, uint32_t slice)>;
+
+    RecordPool();
+    ~RecordPool();
+
+    uint32_t getWorkerCount() const {
+        return static_cast<uint32_t>(workers.size());
+    }
+
+    // Recycles the buffers of this frame in flight, the GPU has to be done
+    // with them
+    void begin(uint32_t frameInFlight);
+
+    // Runs job on every worker, each recording into a secondary buffer that
+    // continues the first subpass of renderPass, then executes them in slice
+    // order. The render pass has to be begun on commandBuffer with
+    // VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS.
+    void record(VkCommandBuffer commandBuffer, VkRenderPass renderPass,
+                VkFramebuffer framebuffer, const Job& job);
+
+private:
+    struct Worker {
+        std::thread thread;
+        ManagedCommandPool pools[Context::FRAMES_IN_FLIGHT];
+        // Allocated as needed, one per record() in a frame
+        std::vector<VkCommandBuffer> buffers[Context::FRAMES_IN_FLIGHT];
+        uint32_t used{0};
+        // Buffer of the current record()
+        VkCommandBuffer current{VK_NULL_HANDLE};
+        std::exception_ptr error;
+    };
+
+    void run(uint32_t slice);
+    VkCommandBuffer beginBuffer(Worker& worker, VkRenderPass renderPass,
+                                VkFramebuffer framebuffer);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    uint32_t frame{0};
+
+    // Hands the job to the workers, and waits for them to finish
+    std::mutex mutex;
+    std::condition_variable jobReady;
+    std::condition_variable jobDone;
+    const Job* job{nullptr};
+    VkRenderPass jobRenderPass{VK_NULL_HANDLE};
+    VkFramebuffer jobFramebuffer{VK_NULL_HANDLE};
+    uint64_t generation{0};
+    uint32_t pending{0};
+    bool stopping{false};
+};
+
+}  // namespace render
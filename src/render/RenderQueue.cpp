@@ -0,0 +1,101 @@
+#include "RenderQueue.hpp"
+
+#include <algorithm>
+
+using namespace render;
+
+RenderQueue::RenderQueue() {
+    geometry.reserve(INITIAL_CAPACITY);
+    entries.reserve(INITIAL_CAPACITY);
+    sorted.reserve(INITIAL_CAPACITY);
+    pending.reserve(INITIAL_CAPACITY);
+    instances.reserve(INITIAL_CAPACITY);
+    batchOf.reserve(INITIAL_CAPACITY);
+    joints.reserve(MAX_JOINTS);
+}
+
+void RenderQueue::clear() {
+    geometry.clear();
+    ui.clear();
+    pending.clear();
+    joints.clear();
+}
+
+uint32_t RenderQueue::pushJoints(uint32_t count) {
+    if (joints.size() + count > MAX_JOINTS)
+        return GeometryInstance::NO_PALETTE;
+
+    uint32_t first = static_cast<uint32_t>(joints.size());
+    joints.resize(joints.size() + count);
+    return first;
+}
+
+void RenderQueue::sort(glm::vec3 viewPos) {
+    entries.clear();
+    for (uint32_t i = 0; i < geometry.size(); i++)
+        entries.push_back({computeKey(geometry[i], viewPos), i});
+
+    std::sort(entries.begin(), entries.end(),
+              [](const SortEntry& a, const SortEntry& b) {
+                  return a.key < b.key;
+              });
+
+    // Swapping small entries and gathering once is cheaper than sorting the
+    // models themselves
+    sorted.clear();
+    for (const auto& entry : entries) sorted.push_back(geometry[entry.index]);
+    geometry.swap(sorted);
+
+    gatherInstances();
+}
+
+void RenderQueue::gatherInstances() {
+    instanced.clear();
+    batchOf.clear();
+
+    // A handful of meshes per frame, a linear search is the fastest
+    for (const auto& entry : pending) {
+        uint32_t batch = 0;
+        while (batch < instanced.size() &&
+               (instanced[batch].mesh != entry.mesh ||
+                instanced[batch].texture != entry.texture))
+            batch++;
+
+        if (batch == instanced.size())
+            instanced.push_back({entry.mesh, entry.texture, 0, 0});
+        instanced[batch].count++;
+        batchOf.push_back(batch);
+    }
+
+    uint32_t first = 0;
+    for (auto& batch : instanced) {
+        batch.first = first;
+        first += batch.count;
+        batch.count = 0;
+    }
+
+    instances.resize(pending.size());
+    for (size_t i = 0; i < pending.size(); i++) {
+        InstancedModel& batch = instanced[batchOf[i]];
+        instances[batch.first + batch.count++] = pending[i].instance;
+    }
+}
+
+uint64_t RenderQueue::computeKey(const GeometryModel& model,
+                                 glm::vec3 viewPos) {
+    // A single geometry pipeline for now
+    uint64_t pipeline = 0;
+    // Only used to keep draws of the same mesh at the same depth together,
+    // so losing the high bits of the address is harmless
+    uint64_t mesh = (reinterpret_cast<uintptr_t>(model.mesh) >> 4) &
+                    ((uint64_t{1} << MESH_BITS) - 1);
+
+    glm::vec3 center =
+        model.pos + (model.mesh->boundsMin + model.mesh->boundsMax) * 0.5f;
+    float distance = glm::length(center - viewPos) * DEPTH_SCALE;
+    uint64_t depth = static_cast<uint64_t>(
+        std::min(distance, static_cast<float>((1 << DEPTH_BITS) - 1)));
+
+    return (pipeline << (DEPTH_BITS + MESH_BITS)) | (depth << MESH_BITS) |
+           mesh;
+}
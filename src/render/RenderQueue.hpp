@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "Primitives.hpp"
+
+namespace render {
+
+// Everything drawn in a frame. It is filled by the game, sorted once by the
+// renderer and then read by every pass, which never copy it.
+//
+// Storage is only ever cleared, so it works as a linear arena: once it has
+// grown to the size of a busy frame, filling it does not allocate anymore.
+class RenderQueue {
+public:
+    // Enough for every chunk in view plus the mobs, so that even the first
+    // frames do not need to grow the storage
+    static constexpr size_t INITIAL_CAPACITY = 1024;
+    // Size of the joint palette, shared by every skinned mesh of a frame
+    static constexpr uint32_t MAX_JOINTS = 4096;
+
+    // Sort key layout, from the most significant bits:
+    // | pipeline: 4 | depth: 16 | mesh: 32 |
+    // Every chunk has a mesh of its own, so depth goes first for them to be
+    // drawn front to back, and hide as much as possible of what follows.
+    // Textures are picked per instance from a table, switching them costs
+    // nothing.
+    static constexpr int MESH_BITS = 32;
+    static constexpr int DEPTH_BITS = 16;
+    // Depth units per block, for the depth part of the key
+    static constexpr float DEPTH_SCALE = 16.0f;
+
+    RenderQueue();
+
+    void clear();
+
+    void push(const GeometryModel& model) { geometry.push_back(model); }
+    void push(const UiModel& model) { ui.push_back(model); }
+    // Copies of the same mesh and texture are drawn together, with one
+    // instanced call
+    void pushInstance(const GeometryMesh* mesh, const Texture* texture,
+                      glm::vec3 pos, glm::quat rot,
+                      uint32_t palette = GeometryInstance::NO_PALETTE) {
+        pending.push_back({mesh, texture, {pos, rot, palette}});
+    }
+    // Reserves count joints of the palette for a skinned instance, to be
+    // written through getJoints(). Returns the first one, NO_PALETTE if the
+    // palette is full.
+    uint32_t pushJoints(uint32_t count);
+    JointTransform* getJoints(uint32_t first) { return &joints[first]; }
+
+    // Sorts the geometry front to back, and gathers the instances by mesh.
+    // Call it once, after everything has been pushed.
+    void sort(glm::vec3 viewPos);
+
+    // Sorted, if sort() has been called
+    const std::vector<GeometryModel>& getGeometry() const { return geometry; }
+    // Filled by sort()
+    const std::vector<InstancedModel>& getInstanced() const {
+        return instanced;
+    }
+    const std::vector<ModelInstance>& getInstances() const {
+        return instances;
+    }
+    // Uploaded as is to the joint palette
+    const std::vector<JointTransform>& getJoints() const { return joints; }
+    // In the order it was pushed, later models are drawn on top
+    const std::vector<UiModel>& getUi() const { return ui; }
+
+private:
+    struct SortEntry {
+        uint64_t key;
+        uint32_t index;
+    };
+
+    struct PendingInstance {
+        const GeometryMesh* mesh;
+        const Texture* texture;
+        ModelInstance instance;
+    };
+
+    uint64_t computeKey(const GeometryModel& model, glm::vec3 viewPos);
+    void gatherInstances();
+
+    std::vector<GeometryModel> geometry;
+    std::vector<UiModel> ui;
+    std::vector<PendingInstance> pending;
+    std::vector<InstancedModel> instanced;
+    std::vector<ModelInstance> instances;
+    std::vector<JointTransform> joints;
+
+    // Scratch space for sort()
+    std::vector<SortEntry> entries;
+    std::vector<GeometryModel> sorted;
+    // Batch of each pending instance
+    std::vector<uint32_t> batchOf;
+};
+
+}  // namespace render
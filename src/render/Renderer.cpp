@@ -3,8 +3,8 @@
 #include <vulkan/vulkan_core.h>
 
 #include <glm/mat4x4.hpp>
-#include <list>
 #include <memory>
+#include <vector>
 
 #include "BufferManager.hpp"
 #include "Context.hpp"
@@ -16,27 +16,40 @@
 using namespace render;
 
 Renderer::Renderer() {
-    shadowPass = std::make_unique<ShadowPass>();
-    forwardPass = std::make_unique<ForwardPass>();
+    PipelineJobGuard pipelineGuard;
+    recordPool = std::make_unique<RecordPool>();
+    jointPalette = std::make_unique<JointPalette>();
+    shadowPass = std::make_unique<ShadowPass>(*jointPalette, *recordPool);
+    forwardPass = std::make_unique<ForwardPass>(*jointPalette, *recordPool);
+    // The passes compile their pipelines in parallel
+    Context::get().waitPipelines();
 
     createCommandPool();
-    createCommandBuffer();
+    createCommandBuffers();
     createSyncObjects();
 }
 
 void Renderer::render(const Camera& camera, const Skybox& skybox,
                       const GeometryRenderer::LightInfo& lights,
-                      std::list<GeometryModel> models,
-                      std::list<UiModel> uiModels, bool windowResized) {
-    vkWaitForFences(Context::get().getDevice(), 1, &*inFlightFence, VK_TRUE,
-                    UINT64_MAX);
+                      RenderQueue& queue, bool windowResized) {
+    // Meshes created since the last frame start uploading right away
+    BufferManager::get().flushUploads();
 
-    BufferManager::get().performDeferOps();
+    InFlightFrame& current = frames[currentFrame];
+    VkCommandBuffer commandBuffer = current.commandBuffer;
+
+    // Only waits for the GPU if it is FRAMES_IN_FLIGHT frames behind
+    vkWaitForFences(Context::get().getDevice(), 1, &*current.inFlightFence,
+                    VK_TRUE, UINT64_MAX);
+
+    BufferManager::get().recycleUploadSemaphores(current.uploadSemaphores);
+    BufferManager::get().performDeferOps(currentFrame);
+    recordPool->begin(currentFrame);
 
     Swapchain::Frame frame =
-        Swapchain::get().acquireFrame(*imageAvailableSemaphore);
+        Swapchain::get().acquireFrame(*current.imageAvailableSemaphore);
 
-    vkResetFences(Context::get().getDevice(), 1, &*inFlightFence);
+    vkResetFences(Context::get().getDevice(), 1, &*current.inFlightFence);
 
     vkResetCommandBuffer(commandBuffer, 0);
     VkCommandBufferBeginInfo beginInfo{};
@@ -47,9 +60,13 @@ void Renderer::render(const Camera& camera, const Skybox& skybox,
     if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
         throw std::runtime_error{"failed to begin recording command buffer!"};
 
-    shadowPass->record(commandBuffer, camera, lights.sunDir, models);
-    forwardPass->record(commandBuffer, frame, camera, skybox, lights,
-                        shadowPass->getDepthTexture(), models, uiModels);
+    queue.sort(camera.pos);
+    jointPalette->upload(currentFrame, queue);
+
+    shadowPass->record(commandBuffer, currentFrame, camera, lights.sunDir,
+                       queue);
+    forwardPass->record(commandBuffer, frame, currentFrame, camera, skybox,
+                        lights, *shadowPass, queue);
 
     if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
         throw std::runtime_error{"failed to record command buffer!"};
@@ -57,23 +74,36 @@ void Renderer::render(const Camera& camera, const Skybox& skybox,
     VkSubmitInfo submitInfo{};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-    VkPipelineStageFlags WAIT_STAGES[] = {
+    // Only meshes whose upload has completed get drawn, so waiting on the
+    // batches that completed since the last frame never stalls. The wait
+    // makes their writes from the transfer queue visible.
+    current.uploadSemaphores = BufferManager::get().takeCompletedUploads();
+    std::vector<VkSemaphore> waitSemaphores{*current.imageAvailableSemaphore};
+    std::vector<VkPipelineStageFlags> waitStages{
         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-    submitInfo.waitSemaphoreCount = 1;
-    submitInfo.pWaitSemaphores = &*imageAvailableSemaphore;
-    submitInfo.pWaitDstStageMask = WAIT_STAGES;
+    for (VkSemaphore semaphore : current.uploadSemaphores) {
+        waitSemaphores.push_back(semaphore);
+        waitStages.push_back(VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+                             VK_PIPELINE_STAGE_TRANSFER_BIT);
+    }
+    submitInfo.waitSemaphoreCount = waitSemaphores.size();
+    submitInfo.pWaitSemaphores = waitSemaphores.data();
+    submitInfo.pWaitDstStageMask = waitStages.data();
 
     submitInfo.commandBufferCount = 1;
     submitInfo.pCommandBuffers = &commandBuffer;
 
     submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pSignalSemaphores = &*renderFinishedSemaphore;
+    submitInfo.pSignalSemaphores = &*current.renderFinishedSemaphore;
 
     if (vkQueueSubmit(Context::get().getGraphicsQueue(), 1, &submitInfo,
-                      *inFlightFence) != VK_SUCCESS)
+                      *current.inFlightFence) != VK_SUCCESS)
         throw std::runtime_error{"failed to submit draw command buffer!"};
 
-    Swapchain::get().present(frame, *renderFinishedSemaphore, windowResized);
+    Swapchain::get().present(frame, *current.renderFinishedSemaphore,
+                             windowResized);
+
+    currentFrame = (currentFrame + 1) % Context::FRAMES_IN_FLIGHT;
 }
 
 void Renderer::createCommandPool() {
@@ -88,16 +118,18 @@ void Renderer::createCommandPool() {
         throw std::runtime_error{"failed to create command pool!"};
 }
 
-void Renderer::createCommandBuffer() {
+void Renderer::createCommandBuffers() {
     VkCommandBufferAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     allocInfo.commandPool = *commandPool;
     allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
     allocInfo.commandBufferCount = 1;
 
-    if (vkAllocateCommandBuffers(Context::get().getDevice(), &allocInfo,
-                                 &commandBuffer) != VK_SUCCESS)
-        throw std::runtime_error{"failed to create command buffer!"};
+    for (auto& frame : frames) {
+        if (vkAllocateCommandBuffers(Context::get().getDevice(), &allocInfo,
+                                     &frame.commandBuffer) != VK_SUCCESS)
+            throw std::runtime_error{"failed to create command buffer!"};
+    }
 }
 
 void Renderer::createSyncObjects() {
@@ -108,15 +140,19 @@ void Renderer::createSyncObjects() {
     fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
     fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
-    if (vkCreateSemaphore(Context::get().getDevice(), &semaphoreCreateInfo,
-                          nullptr, &*imageAvailableSemaphore) != VK_SUCCESS)
-        throw std::runtime_error{"failed to create sync objects!"};
-
-    if (vkCreateSemaphore(Context::get().getDevice(), &semaphoreCreateInfo,
-                          nullptr, &*renderFinishedSemaphore) != VK_SUCCESS)
-        throw std::runtime_error{"failed to create sync objects!"};
-
-    if (vkCreateFence(Context::get().getDevice(), &fenceCreateInfo, nullptr,
-                      &*inFlightFence) != VK_SUCCESS)
-        throw std::runtime_error{"failed to create sync objects!"};
+    for (auto& frame : frames) {
+        if (vkCreateSemaphore(Context::get().getDevice(), &semaphoreCreateInfo,
+                              nullptr,
+                              &*frame.imageAvailableSemaphore) != VK_SUCCESS)
+            throw std::runtime_error{"failed to create sync objects!"};
+
+        if (vkCreateSemaphore(Context::get().getDevice(), &semaphoreCreateInfo,
+                              nullptr,
+                              &*frame.renderFinishedSemaphore) != VK_SUCCESS)
+            throw std::runtime_error{"failed to create sync objects!"};
+
+        if (vkCreateFence(Context::get().getDevice(), &fenceCreateInfo,
+                          nullptr, &*frame.inFlightFence) != VK_SUCCESS)
+            throw std::runtime_error{"failed to create sync objects!"};
+    }
 }
@@ -2,12 +2,17 @@
 
 #include <vulkan/vulkan.h>
 
-#include <list>
+#include <array>
 #include <memory>
+#include <vector>
 
+#include "Context.hpp"
 #include "ForwardPass.hpp"
+#include "JointPalette.hpp"
 #include "Managed.hpp"
 #include "Primitives.hpp"
+#include "RecordPool.hpp"
+#include "RenderQueue.hpp"
 #include "ShadowPass.hpp"
 #include "Skybox.hpp"
 
@@ -21,28 +26,74 @@ public:
         return std::make_unique<Renderer>();
     }
 
+    // Sorts the queue, then records every pass from it
     void render(const Camera& camera, const Skybox& skybox,
-                const GeometryRenderer::LightInfo& lights,
-                std::list<GeometryModel> models, std::list<UiModel> uiModels,
+                const GeometryRenderer::LightInfo& lights, RenderQueue& queue,
                 bool windowResized);
 
     const Texture& getDepthTexture() const {
         return shadowPass->getDepthTexture();
     }
 
+    // Per pass culling counters, for the last frame
+    CullingStats getForwardCullingStats() const {
+        return forwardPass->getCullingStats();
+    }
+    CullingStats getShadowCullingStats() const {
+        return shadowPass->getCullingStats();
+    }
+    // Whether the terrain shadows had to be drawn again in the last frame
+    bool wasShadowStaticLayerRedrawn() const {
+        return shadowPass->wasStaticLayerRedrawn();
+    }
+    // How often it was, per cascade, since startup
+    ShadowPass::CacheStats getShadowCacheStats() const {
+        return shadowPass->getCacheStats();
+    }
+    // Vertex fetch of the shadow casters in the last frame, see FetchStats
+    ShadowPass::FetchStats getShadowFetchStats() const {
+        return shadowPass->getFetchStats();
+    }
+
+    // Draws and state changes of the geometry, for the last frame
+    GeometryRenderer::RecordStats getGeometryRecordStats() const {
+        return forwardPass->getRecordStats();
+    }
+
+    // See ForwardPass
+    void setDepthPrepass(bool enabled) {
+        forwardPass->setDepthPrepass(enabled);
+    }
+    void setOverdrawView(bool enabled) {
+        forwardPass->setOverdrawView(enabled);
+    }
+
 private:
+    // What the CPU needs to record a frame without waiting for the GPU to
+    // finish the previous one
+    struct InFlightFrame {
+        VkCommandBuffer commandBuffer{VK_NULL_HANDLE};
+
+        ManagedSemaphore imageAvailableSemaphore;
+        ManagedSemaphore renderFinishedSemaphore;
+        ManagedFence inFlightFence;
+        // Of the upload batches the frame waited on, see Uploader
+        std::vector<VkSemaphore> uploadSemaphores;
+    };
+
     void createCommandPool();
-    void createCommandBuffer();
+    void createCommandBuffers();
     void createSyncObjects();
 
     ManagedCommandPool commandPool;
-    VkCommandBuffer commandBuffer{VK_NULL_HANDLE};
 
+    std::array<InFlightFrame, Context::FRAMES_IN_FLIGHT> frames;
+    uint32_t currentFrame{0};
+
+    // Used by both passes
+    std::unique_ptr<RecordPool> recordPool;
+    std::unique_ptr<JointPalette> jointPalette;
     std::unique_ptr<ShadowPass> shadowPass;
     std::unique_ptr<ForwardPass> forwardPass;
-
-    ManagedSemaphore imageAvailableSemaphore;
-    ManagedSemaphore renderFinishedSemaphore;
-    ManagedFence inFlightFence;
 };
 }  // namespace render
\ No newline at end of file
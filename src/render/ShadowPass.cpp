@@ -2,61 +2,430 @@
 
 #include <vulkan/vulkan_core.h>
 
+#include <algorithm>
+#include <cmath>
+
 #include "BufferManager.hpp"
 #include "Context.hpp"
 #include "Managed.hpp"
+#include "Swapchain.hpp"
 #include "glm/ext/matrix_clip_space.hpp"
 #include "glm/ext/matrix_transform.hpp"
 
 using namespace render;
 
-ShadowPass::ShadowPass() {
+ShadowPass::ShadowPass(const JointPalette& palette, RecordPool& recordPool)
+    : palette{palette}, recordPool{recordPool} {
+    PipelineJobGuard pipelineGuard;
     depthTexture = BufferManager::get().allocateDepthTexture(
-        SHADOWMAP_EXTENT.width, SHADOWMAP_EXTENT.height);
+        SHADOWMAP_EXTENT.width, SHADOWMAP_EXTENT.height,
+        VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+    staticImage = BufferManager::get().allocateDepthImage(
+        SHADOWMAP_EXTENT.width, SHADOWMAP_EXTENT.height,
+        VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
 
     createRenderPass();
+    createStaticRenderPass();
     createFramebuffer();
-    createPipeline();
+    Context::get().createPipelineAsync([this] { createPipeline(); });
 }
 
-void ShadowPass::record(VkCommandBuffer commandBuffer, const Camera& camera,
-                        glm::vec3 lightDir, std::list<GeometryModel> models) {
-    VkViewport viewport = getViewport();
-    VkRect2D scissor = getScissor();
+void ShadowPass::record(VkCommandBuffer commandBuffer, uint32_t frameInFlight,
+                        const Camera& camera, glm::vec3 lightDir,
+                        const RenderQueue& queue) {
+    VkExtent2D extent = Swapchain::get().getExtent();
+    float ratio =
+        static_cast<float>(extent.width) / static_cast<float>(extent.height);
+    float tanHalfFov = std::tan(glm::radians(camera.fov) / 2.0f);
+    glm::vec3 viewDir = camera.computeViewDir();
+
+    float nearPlane = camera.nearPlane;
+    float farPlane = std::min(SHADOW_DISTANCE, camera.farPlane);
+    uint64_t casters = hashStaticCasters(queue);
+
+    if (needsTransition) transitionImages(commandBuffer);
+
+    cullingStats = {};
+    fetchStats = {};
+    staticRedrawn = false;
+    frame++;
+
+    draws.begin(frameInFlight);
+    Frustum frusta[CASCADE_COUNT] = {};
+    uint32_t gpuCandidates = 0;
+
+    float sliceNear = nearPlane;
+    for (uint32_t i = 0; i < CASCADE_COUNT; i++) {
+        Cascade& cascade = cascades[i];
+
+        float t = static_cast<float>(i + 1) / CASCADE_COUNT;
+        float sliceFar =
+            glm::mix(nearPlane + (farPlane - nearPlane) * t,
+                     nearPlane * std::pow(farPlane / nearPlane, t),
+                     SPLIT_LAMBDA);
+
+        // Offset, so that the far cascades are not all drawn the same frame
+        cascade.due = !cascade.valid || (frame + i) % UPDATE_PERIODS[i] == 0;
+        if (cascade.due) {
+            // The sun moves a little every frame, it is only followed once
+            // it has moved enough to show
+            bool sunMoved =
+                !cascade.valid ||
+                glm::dot(lightDir, cascade.staticLightDir) < SUN_STEP_COS;
+            if (sunMoved) cascade.staticLightDir = lightDir;
+
+            // Sphere around the slice, its size doesn't change as the
+            // camera turns, so neither does the size of the texels. Rounded
+            // up, so that it can be compared from a frame to the next.
+            float halfDepth = (sliceFar - sliceNear) / 2.0f;
+            float farHalfHeight = sliceFar * tanHalfFov;
+            float radius = std::ceil(
+                std::sqrt(farHalfHeight * farHalfHeight * (1 + ratio * ratio) +
+                          halfDepth * halfDepth));
+            // Moves with every step and turn of the camera, but the box
+            // only follows by whole steps, depth along the light included
+            glm::vec3 center = camera.pos + viewDir * (sliceNear + halfDepth);
+            glm::ivec3 cell;
+            cascade.vp = computeShadowVP(center, radius,
+                                         cascade.staticLightDir, cell);
+
+            cascade.redraw = sunMoved || cell != cascade.cell ||
+                             radius != cascade.radius ||
+                             casters != cascade.casters;
+            cascade.cell = cell;
+            cascade.radius = radius;
+            cascade.casters = casters;
+            cascade.valid = true;
+            staticRedrawn |= cascade.redraw;
+            cacheStats.updates[i]++;
+            if (cascade.redraw) cacheStats.redraws[i]++;
+
+            // Casters between the light and the shadow volume still shadow
+            // what is inside, so the volume is left open towards the light.
+            // Depth clamping flattens them on the near plane instead of
+            // clipping them.
+            frusta[i] = Frustum::fromMatrix(cascade.vp);
+            frusta[i].removePlane(Frustum::PLANE_NEAR);
+
+            gpuCandidates += prepareCascade(i, frusta[i], queue);
+        }
+
+        sliceNear = sliceFar;
+    }
+
+    // The frusta of the cascades not due are left unused
+    draws.cull(commandBuffer, frusta, CASCADE_COUNT);
+
+    // GPU culling results are read back a few frames late
+    uint32_t gpuVisible = std::min(draws.getGpuVisible(), gpuCandidates);
+    cullingStats.visible += gpuVisible;
+    cullingStats.culled += gpuCandidates - gpuVisible;
+
+    uint32_t sliceCount = recordPool.getWorkerCount();
+    VkClearValue clearValue = {};
+    clearValue.depthStencil = {1.0f, 0};
 
     VkRenderPassBeginInfo renderPassBeginInfo{};
     renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassBeginInfo.clearValueCount = 1;
+    renderPassBeginInfo.pClearValues = &clearValue;
+
+    renderPassBeginInfo.renderPass = *staticRenderPass;
+    renderPassBeginInfo.framebuffer = *staticFramebuffer;
+    for (uint32_t i = 0; i < CASCADE_COUNT; i++) {
+        if (!cascades[i].due || !cascades[i].redraw) continue;
+
+        renderPassBeginInfo.renderArea = getCascadeRect(i);
+        vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo,
+                             VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+        recordPool.record(commandBuffer, *staticRenderPass, *staticFramebuffer,
+                          [&](VkCommandBuffer sliceBuffer, uint32_t slice) {
+                              recordSlice(sliceBuffer, frameInFlight, i, true,
+                                          slice, sliceCount);
+                          });
+
+        vkCmdEndRenderPass(commandBuffer);
+    }
+
+    copyStaticLayers(commandBuffer);
+
+    // Loads the copies, and keeps the cascades not drawn this frame
     renderPassBeginInfo.renderPass = *renderPass;
     renderPassBeginInfo.framebuffer = *framebuffer;
-    renderPassBeginInfo.renderArea = scissor;
+    renderPassBeginInfo.renderArea = {{0, 0}, SHADOWMAP_EXTENT};
+    vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo,
+                         VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 
-    VkClearValue clearValue = {};
-    clearValue.depthStencil = {1.0f, 0};
+    recordPool.record(commandBuffer, *renderPass, *framebuffer,
+                      [&](VkCommandBuffer sliceBuffer, uint32_t slice) {
+                          for (uint32_t i = 0; i < CASCADE_COUNT; i++) {
+                              if (!cascades[i].due) continue;
+                              recordSlice(sliceBuffer, frameInFlight, i,
+                                          false, slice, sliceCount);
+                          }
+                      });
 
-    renderPassBeginInfo.clearValueCount = 1;
-    renderPassBeginInfo.pClearValues = &clearValue;
+    vkCmdEndRenderPass(commandBuffer);
+}
+
+uint32_t ShadowPass::prepareCascade(uint32_t index, const Frustum& frustum,
+                                    const RenderQueue& queue) {
+    Cascade& cascade = cascades[index];
+    bool redraw = cascade.redraw;
+
+    draws.setFrustum(index);
+
+    // Heap meshes are left to the GPU when it can cull them
+    uint32_t gpuCandidates = 0;
+    const auto& models = queue.getGeometry();
+    culler.clear();
+    for (const auto& model : models) {
+        if (!redraw && isStatic(model)) continue;
+
+        if (draws.isGpuCulled() && model.mesh->isInHeap())
+            gpuCandidates++;
+        else
+            culler.addModel(model);
+    }
+
+    const auto& instanced = queue.getInstanced();
+    const auto& instances = queue.getInstances();
+    size_t firstInstanceVolume = culler.size();
+    for (const auto& batch : instanced) {
+        for (uint32_t j = 0; j < batch.count; j++) {
+            const auto& instance = instances[batch.first + j];
+            culler.addModel(*batch.mesh, instance.pos, instance.rot);
+        }
+    }
+
+    uint32_t visible = culler.cull(frustum);
+
+    // Draw order doesn't matter for depth only, so every heap mesh goes in
+    // a single indirect run
+    cascade.staticDrawList.clear();
+    cascade.drawList.clear();
+    size_t i = 0;
+    for (const auto& model : models) {
+        bool isStaticModel = isStatic(model);
+        if (!redraw && isStaticModel) continue;
+
+        bool gpuCulled = draws.isGpuCulled() && model.mesh->isInHeap();
+        if (!gpuCulled && !culler.isVisible(i++)) continue;
+
+        if (model.mesh->isNull() ||
+            !BufferManager::get().isUploaded(*model.mesh))
+            continue;
+
+        if (!isStaticModel)
+            cascade.drawList.push_back(&model);
+        else if (!draws.add(*model.mesh, model.pos))
+            cascade.staticDrawList.push_back(&model);
+        countFetch(*model.mesh, 1);
+    }
+    cascade.run = draws.endRun();
+
+    cascade.instancedDrawList.clear();
+    size_t volume = firstInstanceVolume;
+    for (const auto& batch : instanced) {
+        size_t batchVolume = volume;
+        volume += batch.count;
+
+        if (batch.mesh->isNull() ||
+            !BufferManager::get().isUploaded(*batch.mesh))
+            continue;
+
+        InstancedDraw draw{batch.mesh, 0, 0};
+        for (uint32_t j = 0; j < batch.count; j++) {
+            if (!culler.isVisible(batchVolume + j)) continue;
+
+            const auto& instance = instances[batch.first + j];
+            uint32_t index = draws.addInstance(
+                GeometryInstance::fromTransform(instance.pos, instance.rot,
+                                               instance.palette));
+            if (index == IndirectDraws::NO_INSTANCE) break;
+
+            if (draw.instanceCount == 0) draw.firstInstance = index;
+            draw.instanceCount++;
+        }
+
+        if (draw.instanceCount > 0) {
+            cascade.instancedDrawList.push_back(draw);
+            countFetch(*draw.mesh, draw.instanceCount);
+        }
+    }
+
+    cullingStats.visible += visible;
+    cullingStats.culled += static_cast<uint32_t>(culler.size()) - visible;
+    return gpuCandidates;
+}
+
+void ShadowPass::countFetch(const GeometryMesh& mesh, uint32_t instanceCount) {
+    uint64_t vertices = static_cast<uint64_t>(mesh.vertexCount) * instanceCount;
+    fetchStats.vertices += vertices;
+    fetchStats.bytes += vertices * sizeof(DepthVertex);
+    fetchStats.fullBytes += vertices * sizeof(GeometryVertex);
+}
+
+uint64_t ShadowPass::hashStaticCasters(const RenderQueue& queue) {
+    // The queue is sorted by distance, so the hashes of the casters are
+    // summed up to not depend on their order
+    uint64_t hash = 0;
+    for (const auto& model : queue.getGeometry()) {
+        if (!isStatic(model) || !BufferManager::get().isUploaded(*model.mesh))
+            continue;
+
+        // A remeshed chunk gets a new upload batch
+        glm::uvec3 pos{glm::ivec3{glm::floor(model.pos)}};
+        uint64_t h = model.mesh->uploadBatch;
+        h = h * 31 + model.mesh->heap.index;
+        h = ((h * 31 + pos.x) * 31 + pos.y) * 31 + pos.z;
+
+        // Mixed, so that the sums of different casters rarely collide
+        h *= 0x9e3779b97f4a7c15ull;
+        hash += h ^ (h >> 32);
+    }
+
+    return hash;
+}
+
+void ShadowPass::recordSlice(VkCommandBuffer commandBuffer,
+                             uint32_t frameInFlight, uint32_t cascade,
+                             bool staticLayer, uint32_t slice,
+                             uint32_t sliceCount) {
+    const Cascade& target = cascades[cascade];
+    glm::mat4 vp = target.vp;
 
+    VkViewport viewport = getCascadeViewport(cascade);
+    VkRect2D scissor = getCascadeRect(cascade);
     vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
     vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
     vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
                       *pipeline);
+    VkDescriptorSet paletteSet = palette.getSet(frameInFlight);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            *pipelineLayout, 0, 1, &paletteSet, 0, nullptr);
+
+    draws.bindInstances(commandBuffer);
+
+    // The indirect run is a single call, it goes to the first slice
+    if (staticLayer && slice == 0 && target.run != IndirectDraws::NO_RUN) {
+        BufferManager::get().getGeometryHeap().bindDepth(commandBuffer);
+
+        PushBuffer pushBuffer = {vp};
+        vkCmdPushConstants(commandBuffer, *pipelineLayout,
+                           VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushBuffer),
+                           &pushBuffer);
+
+        draws.record(commandBuffer, target.run);
+    }
+
+    const auto& models =
+        staticLayer ? target.staticDrawList : target.drawList;
+    size_t first = models.size() * slice / sliceCount;
+    size_t last = models.size() * (slice + 1) / sliceCount;
+    for (size_t i = first; i < last; i++)
+        recordSingle(commandBuffer, vp, *models[i]);
+
+    if (staticLayer) return;
+
+    const auto& instanced = target.instancedDrawList;
+    first = instanced.size() * slice / sliceCount;
+    last = instanced.size() * (slice + 1) / sliceCount;
+    for (size_t i = first; i < last; i++)
+        recordInstanced(commandBuffer, vp, instanced[i]);
+}
 
-    vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo,
-                         VK_SUBPASS_CONTENTS_INLINE);
-
-    glm::mat4 vp = computeShadowVP(camera.pos, lightDir);
-
-    for (const auto& model : models) recordSingle(commandBuffer, vp, model);
+void ShadowPass::transitionImages(VkCommandBuffer commandBuffer) {
+    VkFormat format = depthTexture.image.format;
+    VkImageAspectFlags aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    if (format == VK_FORMAT_D32_SFLOAT_S8_UINT ||
+        format == VK_FORMAT_D24_UNORM_S8_UINT)
+        aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+
+    // Both are still empty, every cascade is drawn the first frame
+    VkImageMemoryBarrier barriers[2] = {};
+    for (auto& barrier : barriers) {
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = 0;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.subresourceRange = {aspectMask, 0, 1, 0, 1};
+    }
+    barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barriers[0].image = *staticImage.image;
+    barriers[1].newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+    barriers[1].image = *depthTexture.image.image;
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT |
+                             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         0, 0, nullptr, 0, nullptr, 2, barriers);
+    needsTransition = false;
+}
 
-    vkCmdEndRenderPass(commandBuffer);
+void ShadowPass::copyStaticLayers(VkCommandBuffer commandBuffer) {
+    VkFormat format = depthTexture.image.format;
+    VkImageAspectFlags aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    if (format == VK_FORMAT_D32_SFLOAT_S8_UINT ||
+        format == VK_FORMAT_D24_UNORM_S8_UINT)
+        aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+
+    // The previous frame may still be sampling the shadow map. The
+    // cascades not drawn this frame are kept.
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = *depthTexture.image.image;
+    barrier.subresourceRange = {aspectMask, 0, 1, 0, 1};
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                         nullptr, 1, &barrier);
+
+    // The static render pass leaves its image ready to be copied from
+    VkImageCopy regions[CASCADE_COUNT] = {};
+    uint32_t regionCount = 0;
+    for (uint32_t i = 0; i < CASCADE_COUNT; i++) {
+        if (!cascades[i].due) continue;
+
+        VkRect2D rect = getCascadeRect(i);
+        VkImageCopy& region = regions[regionCount++];
+        region.srcSubresource = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 0, 1};
+        region.srcOffset = {rect.offset.x, rect.offset.y, 0};
+        region.dstSubresource = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 0, 1};
+        region.dstOffset = {rect.offset.x, rect.offset.y, 0};
+        region.extent = {rect.extent.width, rect.extent.height, 1};
+    }
+
+    vkCmdCopyImage(commandBuffer, *staticImage.image,
+                   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   *depthTexture.image.image,
+                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, regionCount, regions);
 }
 
 void ShadowPass::recordSingle(VkCommandBuffer commandBuffer, glm::mat4 vp,
                               const GeometryModel& model) {
-    if (model.mesh.isNull()) return;
+    const GeometryHeap& heap = BufferManager::get().getGeometryHeap();
+
+    uint32_t firstIndex = 0;
+    int32_t vertexOffset = 0;
+    if (model.mesh->isInHeap()) {
+        heap.bindDepth(commandBuffer);
 
-    model.mesh.bind(commandBuffer);
+        const auto& allocation = heap.get(model.mesh->heap.index);
+        firstIndex = allocation.indexOffset;
+        vertexOffset = static_cast<int32_t>(allocation.vertexOffset);
+    } else {
+        model.mesh->bindDepth(commandBuffer);
+    }
 
     glm::mat4 m = model.computeModelMat();
     glm::mat4 mvp = vp * m;
@@ -67,14 +436,62 @@ void ShadowPass::recordSingle(VkCommandBuffer commandBuffer, glm::mat4 vp,
                        VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushBuffer),
                        &pushBuffer);
 
-    vkCmdDrawIndexed(commandBuffer, model.mesh.indexCount, 1, 0, 0, 0);
+    // Instance 0 holds a zero offset
+    vkCmdDrawIndexed(commandBuffer, model.mesh->indexCount, 1, firstIndex,
+                     vertexOffset, 0);
 }
 
-glm::mat4 ShadowPass::computeShadowVP(glm::vec3 center, glm::vec3 lightDir) {
-    constexpr float DISTANCE = 80.0f;
-    glm::quat rot = glm::vec3{-(float)M_PI_2, 0.0f, 0.0f};
+void ShadowPass::recordInstanced(VkCommandBuffer commandBuffer, glm::mat4 vp,
+                                 const InstancedDraw& draw) {
+    const GeometryHeap& heap = BufferManager::get().getGeometryHeap();
+
+    uint32_t firstIndex = 0;
+    int32_t vertexOffset = 0;
+    if (draw.mesh->isInHeap()) {
+        heap.bindDepth(commandBuffer);
+
+        const auto& allocation = heap.get(draw.mesh->heap.index);
+        firstIndex = allocation.indexOffset;
+        vertexOffset = static_cast<int32_t>(allocation.vertexOffset);
+    } else {
+        draw.mesh->bindDepth(commandBuffer);
+    }
 
-    glm::mat4 proj = glm::ortho(-50.0f, 50.0f, 50.0f, -50.0f, 0.1f, 500.0f);
+    // Instances carry the whole transform
+    PushBuffer pushBuffer = {vp};
+    vkCmdPushConstants(commandBuffer, *pipelineLayout,
+                       VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushBuffer),
+                       &pushBuffer);
+
+    vkCmdDrawIndexed(commandBuffer, draw.mesh->indexCount, draw.instanceCount,
+                     firstIndex, vertexOffset, draw.firstInstance);
+}
+
+glm::mat4 ShadowPass::computeShadowVP(glm::vec3 center, float radius,
+                                      glm::vec3 lightDir, glm::ivec3& cell) {
+    constexpr float DISTANCE = 80.0f;
+    constexpr float SNAP_RATIO = SNAP_TEXELS / CASCADE_EXTENT.width;
+
+    // The box is larger than the sphere by a snap step, so that it still
+    // holds it when lagging behind
+    float halfSize = radius / (1.0f - 2.0f * SNAP_RATIO);
+    float snap = 2.0f * halfSize * SNAP_RATIO;
+
+    // The box moves across the light by whole steps of texels, so that
+    // every texel keeps covering the same spot of the world. Shadows don't
+    // shimmer, and the static layer stays valid in between. Along the light
+    // it moves by steps too, or every depth in the layer would shift.
+    glm::mat4 lightView =
+        glm::lookAt(lightDir, glm::vec3{0.0f}, glm::vec3{0.0f, 1.0f, 0.0f});
+    glm::vec4 lightCenter = lightView * glm::vec4{center, 1.0f};
+    cell = glm::ivec3{glm::round(glm::vec3{lightCenter} / snap)};
+    lightCenter = glm::vec4{glm::vec3{cell} * snap, 1.0f};
+    center = glm::vec3{glm::inverse(lightView) * lightCenter};
+
+    // The sphere may lag behind the box center by half a step along the
+    // light, the far plane leaves a whole one
+    glm::mat4 proj = glm::ortho(-halfSize, halfSize, halfSize, -halfSize,
+                                0.1f, DISTANCE + halfSize + snap);
     glm::mat4 view = glm::lookAt(center + lightDir * DISTANCE, center,
                                  glm::vec3{0.0f, 1.0f, 0.0f});
 
@@ -85,11 +502,12 @@ void ShadowPass::createRenderPass() {
     VkAttachmentDescription depthAttachment{};
     depthAttachment.format = Context::get().getDeviceInfo().depthFormat;
     depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    // Starts from the copy of the static layer
+    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
     depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
     depthAttachment.finalLayout =
         VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
 
@@ -108,12 +526,12 @@ void ShadowPass::createRenderPass() {
 
     dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
     dependencies[0].dstSubpass = 0;
-    dependencies[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    dependencies[0].srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
     dependencies[0].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-    dependencies[0].srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    dependencies[0].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
     dependencies[0].dstAccessMask =
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
         VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-    dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
 
     dependencies[1].srcSubpass = 0;
     dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
@@ -139,6 +557,61 @@ void ShadowPass::createRenderPass() {
         throw std::runtime_error{"failed to create render pass!"};
 }
 
+void ShadowPass::createStaticRenderPass() {
+    VkAttachmentDescription depthAttachment{};
+    depthAttachment.format = Context::get().getDeviceInfo().depthFormat;
+    depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    // Only clears the render area, the other cascades are kept
+    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    depthAttachment.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+    VkAttachmentReference depthAttachmentRef{};
+    depthAttachmentRef.attachment = 0;
+    depthAttachmentRef.layout =
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkSubpassDescription subpass{};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 0;
+    subpass.pColorAttachments = nullptr;
+    subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+    VkSubpassDependency dependencies[2] = {};
+
+    // Previous frames may still be copying the layer
+    dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[0].dstSubpass = 0;
+    dependencies[0].srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    dependencies[0].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependencies[0].srcAccessMask = 0;
+    dependencies[0].dstAccessMask =
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    dependencies[1].srcSubpass = 0;
+    dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    dependencies[1].srcAccessMask =
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+    VkRenderPassCreateInfo renderPassCreateInfo{};
+    renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    renderPassCreateInfo.attachmentCount = 1;
+    renderPassCreateInfo.pAttachments = &depthAttachment;
+    renderPassCreateInfo.subpassCount = 1;
+    renderPassCreateInfo.pSubpasses = &subpass;
+    renderPassCreateInfo.dependencyCount = 2;
+    renderPassCreateInfo.pDependencies = dependencies;
+    if (vkCreateRenderPass(Context::get().getDevice(), &renderPassCreateInfo,
+                           nullptr, &*staticRenderPass) != VK_SUCCESS)
+        throw std::runtime_error{"failed to create render pass!"};
+}
+
 void ShadowPass::createFramebuffer() {
     const Image& depthImage = depthTexture.image;
 
@@ -154,6 +627,13 @@ void ShadowPass::createFramebuffer() {
     if (vkCreateFramebuffer(Context::get().getDevice(), &createInfo, nullptr,
                             &*framebuffer) != VK_SUCCESS)
         throw std::runtime_error{"failed to create framebuffer!"};
+
+    createInfo.renderPass = *staticRenderPass;
+    createInfo.pAttachments = &*staticImage.view;
+
+    if (vkCreateFramebuffer(Context::get().getDevice(), &createInfo, nullptr,
+                            &*staticFramebuffer) != VK_SUCCESS)
+        throw std::runtime_error{"failed to create framebuffer!"};
 }
 
 void ShadowPass::createPipeline() {
@@ -164,8 +644,9 @@ void ShadowPass::createPipeline() {
     VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
     pipelineLayoutCreateInfo.sType =
         VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutCreateInfo.setLayoutCount = 0;
-    pipelineLayoutCreateInfo.pSetLayouts = nullptr;
+    VkDescriptorSetLayout paletteLayout = palette.getLayout();
+    pipelineLayoutCreateInfo.setLayoutCount = 1;
+    pipelineLayoutCreateInfo.pSetLayouts = &paletteLayout;
     pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
     pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
 
@@ -200,14 +681,17 @@ void ShadowPass::createPipeline() {
     dynamicStateInfo.dynamicStateCount = 2;
     dynamicStateInfo.pDynamicStates = DYNAMIC_STATES;
 
-    auto bindingDescription = GeometryMesh::getBindingDescription();
-    auto attributeDescriptions = GeometryMesh::getAttributeDescriptions();
+    // Positions only, the rest of the vertex is never fetched
+    auto bindingDescriptions = GeometryMesh::getDepthBindingDescriptions();
+    auto attributeDescriptions = GeometryMesh::getDepthAttributeDescriptions();
 
     VkPipelineVertexInputStateCreateInfo vertexInputStageInfo{};
     vertexInputStageInfo.sType =
         VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertexInputStageInfo.vertexBindingDescriptionCount = 1;
-    vertexInputStageInfo.pVertexBindingDescriptions = &bindingDescription;
+    vertexInputStageInfo.vertexBindingDescriptionCount =
+        bindingDescriptions.size();
+    vertexInputStageInfo.pVertexBindingDescriptions =
+        bindingDescriptions.data();
     vertexInputStageInfo.vertexAttributeDescriptionCount =
         attributeDescriptions.size();
     vertexInputStageInfo.pVertexAttributeDescriptions =
@@ -228,7 +712,8 @@ void ShadowPass::createPipeline() {
     VkPipelineRasterizationStateCreateInfo rasterizerStateInfo{};
     rasterizerStateInfo.sType =
         VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-    rasterizerStateInfo.depthClampEnable = VK_FALSE;
+    rasterizerStateInfo.depthClampEnable =
+        Context::get().getDeviceInfo().hasDepthClamp ? VK_TRUE : VK_FALSE;
     rasterizerStateInfo.rasterizerDiscardEnable = VK_FALSE;
     rasterizerStateInfo.polygonMode = VK_POLYGON_MODE_FILL;
     rasterizerStateInfo.lineWidth = 1.0f;
@@ -307,7 +792,8 @@ void ShadowPass::createPipeline() {
     pipelineCreateInfo.basePipelineHandle = VK_NULL_HANDLE;
     pipelineCreateInfo.basePipelineIndex = -1;
 
-    if (vkCreateGraphicsPipelines(Context::get().getDevice(), VK_NULL_HANDLE, 1,
+    if (vkCreateGraphicsPipelines(Context::get().getDevice(),
+                                  Context::get().getPipelineCache(), 1,
                                   &pipelineCreateInfo, nullptr,
                                   &*pipeline) != VK_SUCCESS)
         throw std::runtime_error{"failed to create graphics pipeline"};
@@ -2,62 +2,203 @@
 
 #include <vulkan/vulkan_core.h>
 
-#include <list>
+#include <vector>
 
+#include "Frustum.hpp"
+#include "IndirectDraws.hpp"
+#include "JointPalette.hpp"
 #include "Managed.hpp"
 #include "Primitives.hpp"
+#include "RecordPool.hpp"
+#include "RenderQueue.hpp"
 
 namespace render {
 
+// Depth of the scene seen from the sun, as cascades fitted to slices of the
+// camera frustum, from near to far. They share a 2x2 atlas, each drawn with
+// its own view projection and culled on its own, though in a single GPU
+// culling dispatch. Near cascades are drawn every frame, far ones every few
+// frames.
+//
+// Terrain barely changes from a frame to the next, so it is drawn into a
+// cached static layer, only redrawn for a cascade when the sun or its box
+// moved by a step, the box was resized or a caster chunk changed. Every time
+// a cascade is drawn, it starts as a copy of its static layer, and the
+// moving casters are drawn on top.
 class ShadowPass {
 public:
-    const VkExtent2D SHADOWMAP_EXTENT{2048, 2048};
+    static constexpr uint32_t CASCADE_COUNT = 4;
+    static constexpr VkExtent2D CASCADE_EXTENT{1024, 1024};
+    static constexpr VkExtent2D SHADOWMAP_EXTENT{2048, 2048};
+    // Frames between two updates of each cascade
+    static constexpr uint32_t UPDATE_PERIODS[CASCADE_COUNT] = {1, 1, 2, 4};
+    // Past the loaded chunks
+    static constexpr float SHADOW_DISTANCE = 80.0f;
+    // Blend between uniform and logarithmic splits
+    static constexpr float SPLIT_LAMBDA = 0.75f;
+    // The shadow boxes move by this many texels at a time
+    static constexpr float SNAP_TEXELS = 64.0f;
+    // Cosine of the angle the sun has to move by before the static layer
+    // follows it, half a degree
+    static constexpr float SUN_STEP_COS = 0.99996f;
+
+    // Vertices the casters of the last frame read, counting the indirect
+    // draws before GPU culling. Terrain is only drawn on frames redrawing
+    // the static layer, the others are not comparable with those.
+    struct FetchStats {
+        uint64_t vertices{0};
+        uint64_t bytes{0};
+        // Had they read the whole vertex
+        uint64_t fullBytes{0};
+    };
+
+    // Since startup, how often each cascade was drawn, and how often its
+    // static layer had to be redrawn for it
+    struct CacheStats {
+        uint64_t updates[CASCADE_COUNT]{};
+        uint64_t redraws[CASCADE_COUNT]{};
+    };
 
-    ShadowPass();
+    ShadowPass(const JointPalette& palette, RecordPool& recordPool);
 
-    void record(VkCommandBuffer commandBuffer, const Camera& camera,
-                glm::vec3 lightDir, std::list<GeometryModel> models);
+    void record(VkCommandBuffer commandBuffer, uint32_t frameInFlight,
+                const Camera& camera, glm::vec3 lightDir,
+                const RenderQueue& queue);
 
     const Texture& getDepthTexture() const { return depthTexture; }
+    // The cascade has to be looked up with the one it was last drawn with
+    const glm::mat4& getCascadeVP(uint32_t cascade) const {
+        return cascades[cascade].vp;
+    }
+
+    // Of the last recorded frame, summed over the cascades drawn
+    CullingStats getCullingStats() const { return cullingStats; }
+    bool wasStaticLayerRedrawn() const { return staticRedrawn; }
+    FetchStats getFetchStats() const { return fetchStats; }
+    CacheStats getCacheStats() const { return cacheStats; }
 
-    static glm::mat4 computeShadowVP(glm::vec3 center, glm::vec3 lightDir);
+    // Box around the sphere, seen from the sun. It moves by whole snap
+    // steps along every axis of the light, cell gives where it sits in
+    // steps: the box only changes when the cell or lightDir does.
+    static glm::mat4 computeShadowVP(glm::vec3 center, float radius,
+                                     glm::vec3 lightDir, glm::ivec3& cell);
 
 private:
     struct PushBuffer {
         glm::mat4 mvp;
     };
 
-    VkViewport getViewport() const {
+    struct InstancedDraw {
+        const GeometryMesh* mesh;
+        uint32_t firstInstance;
+        uint32_t instanceCount;
+    };
+
+    struct Cascade {
+        glm::mat4 vp{1.0f};
+        // What the static layer was drawn with
+        glm::vec3 staticLightDir{0.0f};
+        glm::ivec3 cell{0};
+        // Changes with the fov, aspect ratio and splits
+        float radius{0.0f};
+        uint64_t casters{0};
+        bool valid{false};
+
+        // Whether it is drawn this frame, and its static layer
+        bool due{false};
+        bool redraw{false};
+        // In the draws shared by every cascade
+        uint32_t run{IndirectDraws::NO_RUN};
+        // Casters that survived culling and are not drawn indirectly.
+        // Static ones are only listed when the layer is redrawn.
+        std::vector<const GeometryModel*> staticDrawList;
+        std::vector<const GeometryModel*> drawList;
+        std::vector<InstancedDraw> instancedDrawList;
+    };
+
+    static VkRect2D getCascadeRect(uint32_t cascade) {
+        VkRect2D rect{};
+        rect.offset.x = static_cast<int32_t>(cascade % 2 *
+                                             CASCADE_EXTENT.width);
+        rect.offset.y = static_cast<int32_t>(cascade / 2 *
+                                             CASCADE_EXTENT.height);
+        rect.extent = CASCADE_EXTENT;
+
+        return rect;
+    }
+
+    static VkViewport getCascadeViewport(uint32_t cascade) {
+        VkRect2D rect = getCascadeRect(cascade);
+
         VkViewport viewport{};
-        viewport.x = 0.0f;
-        viewport.y = 0.0f;
-        viewport.width = static_cast<float>(SHADOWMAP_EXTENT.width);
-        viewport.height = static_cast<float>(SHADOWMAP_EXTENT.height);
+        viewport.x = static_cast<float>(rect.offset.x);
+        viewport.y = static_cast<float>(rect.offset.y);
+        viewport.width = static_cast<float>(rect.extent.width);
+        viewport.height = static_cast<float>(rect.extent.height);
         viewport.minDepth = 0.0f;
         viewport.maxDepth = 1.0f;
 
         return viewport;
     }
 
-    VkRect2D getScissor() const {
-        VkRect2D scissor{};
-        scissor.offset = {0, 0};
-        scissor.extent = SHADOWMAP_EXTENT;
-
-        return scissor;
+    // Heap meshes are terrain, which only changes when remeshed
+    static bool isStatic(const GeometryModel& model) {
+        return model.mesh->isInHeap();
     }
-
+    // Changes whenever a static caster is added, removed or remeshed
+    static uint64_t hashStaticCasters(const RenderQueue& queue);
+
+    void countFetch(const GeometryMesh& mesh, uint32_t instanceCount);
+    // Culls the casters of a cascade due this frame and lists them, its heap
+    // meshes are queued in a run of draws tested against frustum. Returns
+    // how many are left to GPU culling.
+    uint32_t prepareCascade(uint32_t index, const Frustum& frustum,
+                            const RenderQueue& queue);
+
+    // Records a slice of the casters of a cascade, those of its static
+    // layer or the moving ones, every worker draws some
+    void recordSlice(VkCommandBuffer commandBuffer, uint32_t frameInFlight,
+                     uint32_t cascade, bool staticLayer, uint32_t slice,
+                     uint32_t sliceCount);
     void recordSingle(VkCommandBuffer commandBuffer, glm::mat4 vp,
                       const GeometryModel& model);
+    void recordInstanced(VkCommandBuffer commandBuffer, glm::mat4 vp,
+                         const InstancedDraw& draw);
+
+    // Leaves both images in the layouts the render passes expect
+    void transitionImages(VkCommandBuffer commandBuffer);
+    // Starts the cascades drawn this frame from their static layer
+    void copyStaticLayers(VkCommandBuffer commandBuffer);
 
     void createRenderPass();
+    // Compatible with renderPass, so they share the pipeline
+    void createStaticRenderPass();
     void createFramebuffer();
     void createPipeline();
 
     Texture depthTexture;
+    Image staticImage;
+    bool needsTransition{true};
+    bool staticRedrawn{false};
+
+    const JointPalette& palette;
+    RecordPool& recordPool;
+
+    Cascade cascades[CASCADE_COUNT];
+    uint32_t frame{0};
+    // One run per cascade drawn
+    IndirectDraws draws;
+    static_assert(CASCADE_COUNT <= IndirectDraws::MAX_FRUSTA);
+
+    FrustumCuller culler;
+    CullingStats cullingStats;
+    FetchStats fetchStats;
+    CacheStats cacheStats;
 
     ManagedRenderPass renderPass;
     ManagedFramebuffer framebuffer;
+    ManagedRenderPass staticRenderPass;
+    ManagedFramebuffer staticFramebuffer;
     ManagedPipelineLayout pipelineLayout;
     ManagedPipeline pipeline;
 };
@@ -9,26 +9,40 @@
 using namespace render;
 
 SkyboxRenderer::SkyboxRenderer(VkRenderPass renderPass) {
-    skyboxInfoUbo = BufferManager::get().allocateUbo(sizeof(float));
-
-    createPipeline(renderPass);
+    for (auto& skyboxInfoUbo : skyboxInfoUbos)
+        skyboxInfoUbo = BufferManager::get().allocateUbo(sizeof(SkyboxInfoUbo));
+
+    // Shared by the pipelines, which are created in parallel
+    createPipelineLayout();
+
+    Context::get().createPipelineAsync([this, renderPass] {
+        createPipeline(renderPass, false, pipeline);
+    });
+    Context::get().createPipelineAsync([this, renderPass] {
+        createPipeline(renderPass, true, overdrawPipeline);
+    });
 }
 
-void SkyboxRenderer::record(VkCommandBuffer commandBuffer, const Camera& camera,
-                            float ratio, const Skybox& skybox) {
-    skyboxInfoUbo.write(skybox.blend);
+void SkyboxRenderer::record(VkCommandBuffer commandBuffer,
+                            uint32_t frameInFlight, const Camera& camera,
+                            float ratio, const Skybox& skybox,
+                            bool overdraw) {
+    if (!BufferManager::get().isUploaded(skybox.mesh)) return;
+
+    Ubo& skyboxInfoUbo = skyboxInfoUbos[frameInFlight];
+    skyboxInfoUbo.write(SkyboxInfoUbo{skybox.blend, skybox.dayTexture.index,
+                                      skybox.nightTexture.index});
 
     glm::mat4 vp = camera.computeSkyboxVPMat(ratio);
 
     vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                      *pipeline);
+                      overdraw ? *overdrawPipeline : *pipeline);
 
-    VkDescriptorSet descriptorSets[3] = {skybox.dayTexture.descriptor,
-                                         skybox.nightTexture.descriptor,
-                                         skyboxInfoUbo.descriptor};
+    VkDescriptorSet descriptorSets[2] = {
+        BufferManager::get().getTextureTable(), skyboxInfoUbo.descriptor};
 
     vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                            *pipelineLayout, 0, 3, descriptorSets, 0, nullptr);
+                            *pipelineLayout, 0, 2, descriptorSets, 0, nullptr);
 
     skybox.mesh.bind(commandBuffer);
 
@@ -44,9 +58,8 @@ void SkyboxRenderer::record(VkCommandBuffer commandBuffer, const Camera& camera,
     vkCmdDrawIndexed(commandBuffer, skybox.mesh.indexCount, 1, 0, 0, 0);
 }
 
-void SkyboxRenderer::createPipeline(VkRenderPass renderPass) {
-    VkDescriptorSetLayout descriptorSetLayouts[3] = {
-        BufferManager::get().getTextureLayout(),
+void SkyboxRenderer::createPipelineLayout() {
+    VkDescriptorSetLayout descriptorSetLayouts[2] = {
         BufferManager::get().getTextureLayout(),
         BufferManager::get().getUboLayout()};
     VkPushConstantRange pushConstantRange = {};
@@ -56,7 +69,7 @@ void SkyboxRenderer::createPipeline(VkRenderPass renderPass) {
     VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
     pipelineLayoutCreateInfo.sType =
         VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutCreateInfo.setLayoutCount = 3;
+    pipelineLayoutCreateInfo.setLayoutCount = 2;
     pipelineLayoutCreateInfo.pSetLayouts = descriptorSetLayouts;
     pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
     pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
@@ -65,11 +78,14 @@ void SkyboxRenderer::createPipeline(VkRenderPass renderPass) {
                                &pipelineLayoutCreateInfo, nullptr,
                                &*pipelineLayout) != VK_SUCCESS)
         throw std::runtime_error{"failed to create pipeline layout!"};
+}
 
+void SkyboxRenderer::createPipeline(VkRenderPass renderPass, bool overdraw,
+                                    ManagedPipeline& target) {
     ManagedShaderModule vertShaderModule{
         Context::get().loadShaderModule("SkyboxVert.vert.spv")};
-    ManagedShaderModule fragShaderModule{
-        Context::get().loadShaderModule("SkyboxFrag.frag.spv")};
+    ManagedShaderModule fragShaderModule{Context::get().loadShaderModule(
+        overdraw ? "OverdrawFrag.frag.spv" : "SkyboxFrag.frag.spv")};
 
     VkPipelineShaderStageCreateInfo vertStageInfo{};
     vertStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -153,6 +169,13 @@ void SkyboxRenderer::createPipeline(VkRenderPass renderPass) {
     colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
     colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
 
+    // Every fragment shaded adds up
+    if (overdraw) {
+        colorBlendAttachment.blendEnable = VK_TRUE;
+        colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+        colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    }
+
     VkPipelineColorBlendStateCreateInfo colorBlendStateInfo{};
     colorBlendStateInfo.sType =
         VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
@@ -168,9 +191,11 @@ void SkyboxRenderer::createPipeline(VkRenderPass renderPass) {
     VkPipelineDepthStencilStateCreateInfo depthStencilStateInfo{};
     depthStencilStateInfo.sType =
         VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-    depthStencilStateInfo.depthTestEnable = VK_FALSE;
+    // Drawn after the geometry on the far plane, so only the pixels still
+    // holding the cleared depth are shaded
+    depthStencilStateInfo.depthTestEnable = VK_TRUE;
     depthStencilStateInfo.depthWriteEnable = VK_FALSE;
-    depthStencilStateInfo.depthCompareOp = VK_COMPARE_OP_LESS;
+    depthStencilStateInfo.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
     depthStencilStateInfo.depthBoundsTestEnable = VK_FALSE;
     depthStencilStateInfo.minDepthBounds = 0.0f;
     depthStencilStateInfo.maxDepthBounds = 1.0f;
@@ -199,8 +224,9 @@ void SkyboxRenderer::createPipeline(VkRenderPass renderPass) {
     pipelineCreateInfo.basePipelineHandle = VK_NULL_HANDLE;
     pipelineCreateInfo.basePipelineIndex = -1;
 
-    if (vkCreateGraphicsPipelines(Context::get().getDevice(), VK_NULL_HANDLE, 1,
+    if (vkCreateGraphicsPipelines(Context::get().getDevice(),
+                                  Context::get().getPipelineCache(), 1,
                                   &pipelineCreateInfo, nullptr,
-                                  &*pipeline) != VK_SUCCESS)
+                                  &*target) != VK_SUCCESS)
         throw std::runtime_error{"failed to create graphics pipeline"};
 }
\ No newline at end of file
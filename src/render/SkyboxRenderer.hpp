@@ -3,6 +3,7 @@
 #include <vulkan/vulkan.h>
 #include <vulkan/vulkan_core.h>
 
+#include "Context.hpp"
 #include "Managed.hpp"
 #include "Primitives.hpp"
 #include "Skybox.hpp"
@@ -13,20 +14,35 @@ class SkyboxRenderer {
 public:
     SkyboxRenderer(VkRenderPass renderPass);
 
-    void record(VkCommandBuffer commandBuffer, const Camera& camera,
-                float ratio, const Skybox& skybox);
+    // After the opaque geometry, it only fills the pixels left empty.
+    // Counts the fragments it shades instead with overdraw.
+    void record(VkCommandBuffer commandBuffer, uint32_t frameInFlight,
+                const Camera& camera, float ratio, const Skybox& skybox,
+                bool overdraw = false);
 
 private:
     struct PushBuffer {
         glm::mat4 mvp;
     };
 
-    void createPipeline(VkRenderPass renderPass);
+    // Matches the fragment shader, std140
+    struct SkyboxInfoUbo {
+        float blend;
+        // Slots in the texture table
+        uint32_t dayTexture;
+        uint32_t nightTexture;
+    };
+
+    void createPipelineLayout();
+    void createPipeline(VkRenderPass renderPass, bool overdraw,
+                        ManagedPipeline& target);
 
-    Ubo skyboxInfoUbo;
+    // One per frame in flight, so the GPU never reads a half written one
+    Ubo skyboxInfoUbos[Context::FRAMES_IN_FLIGHT];
 
     ManagedPipelineLayout pipelineLayout;
     ManagedPipeline pipeline;
+    ManagedPipeline overdrawPipeline;
 };
 
 }  // namespace render
\ No newline at end of file
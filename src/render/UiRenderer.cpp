@@ -6,38 +6,45 @@
 
 using namespace render;
 
-UiRenderer::UiRenderer(VkRenderPass renderPass) { createPipeline(renderPass); }
+UiRenderer::UiRenderer(VkRenderPass renderPass) {
+    Context::get().createPipelineAsync(
+        [this, renderPass] { createPipeline(renderPass); });
+}
 
 void UiRenderer::record(VkCommandBuffer commandBuffer, VkExtent2D extent,
-                        std::list<UiModel> models) {
+                        const RenderQueue& queue) {
     vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
                       *pipeline);
 
-    for (const auto& model : models) recordSingle(commandBuffer, extent, model);
+    // Every texture is in the table, models only push their slot
+    VkDescriptorSet textureTable = BufferManager::get().getTextureTable();
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            *pipelineLayout, 0, 1, &textureTable, 0, nullptr);
+
+    for (const auto& model : queue.getUi())
+        recordSingle(commandBuffer, extent, model);
 }
 
 void UiRenderer::recordSingle(VkCommandBuffer commandBuffer, VkExtent2D extent,
                               const UiModel& model) {
-    if (model.mesh.isNull()) return;
-
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                            *pipelineLayout, 0, 1, &model.texture.descriptor, 0,
-                            nullptr);
+    if (model.mesh->isNull() || !BufferManager::get().isUploaded(*model.mesh))
+        return;
 
-    model.mesh.bind(commandBuffer);
+    model.mesh->bind(commandBuffer);
 
     float width = static_cast<float>(extent.width);
     float height = static_cast<float>(extent.height);
     glm::vec2 dimension = {width, height};
 
     glm::vec2 anchorPoint = model.anchorPoint;
-    PushBuffer pushBuffer = {model.pos, dimension, anchorPoint};
+    PushBuffer pushBuffer = {model.pos, dimension, anchorPoint,
+                             model.texture->index};
 
     vkCmdPushConstants(commandBuffer, *pipelineLayout,
                        VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushBuffer),
                        &pushBuffer);
 
-    vkCmdDrawIndexed(commandBuffer, model.mesh.indexCount, 1, 0, 0, 0);
+    vkCmdDrawIndexed(commandBuffer, model.mesh->indexCount, 1, 0, 0, 0);
 }
 
 void UiRenderer::createPipeline(VkRenderPass renderPass) {
@@ -194,7 +201,8 @@ void UiRenderer::createPipeline(VkRenderPass renderPass) {
     pipelineCreateInfo.basePipelineHandle = VK_NULL_HANDLE;
     pipelineCreateInfo.basePipelineIndex = -1;
 
-    if (vkCreateGraphicsPipelines(Context::get().getDevice(), VK_NULL_HANDLE, 1,
+    if (vkCreateGraphicsPipelines(Context::get().getDevice(),
+                                  Context::get().getPipelineCache(), 1,
                                   &pipelineCreateInfo, nullptr,
                                   &*pipeline) != VK_SUCCESS)
         throw std::runtime_error{"failed to create UI pipeline"};
@@ -3,10 +3,9 @@
 #include <vulkan/vulkan.h>
 #include <vulkan/vulkan_core.h>
 
-#include <list>
-
 #include "Managed.hpp"
 #include "Primitives.hpp"
+#include "RenderQueue.hpp"
 
 namespace render {
 
@@ -15,13 +14,15 @@ public:
     UiRenderer(VkRenderPass renderPass);
 
     void record(VkCommandBuffer commandBuffer, VkExtent2D extent,
-                std::list<UiModel> models);
+                const RenderQueue& queue);
 
 private:
     struct PushBuffer {
         glm::vec2 pos;
         glm::vec2 dimension;
         glm::vec2 anchorPoint;
+        // Slot in the texture table
+        uint32_t texture;
     };
 
     void cleanup();
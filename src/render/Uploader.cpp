@@ -0,0 +1,243 @@
+#include "Uploader.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+#include "Context.hpp"
+
+using namespace render;
+
+Uploader::Uploader(ManagedBuffer staging) : staging{std::move(staging)} {
+    void* ptr;
+    vmaMapMemory(Context::get().getVma(), this->staging.getMemory(), &ptr);
+    mapped = reinterpret_cast<uint8_t*>(ptr);
+
+    VkCommandPoolCreateInfo poolCreateInfo{};
+    poolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT |
+                           VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolCreateInfo.queueFamilyIndex =
+        Context::get().getDeviceInfo().queues.transferOrGraphics();
+
+    if (vkCreateCommandPool(Context::get().getDevice(), &poolCreateInfo,
+                            nullptr, &*commandPool) != VK_SUCCESS)
+        throw std::runtime_error{"failed to create upload command pool!"};
+
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = *commandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+
+    VkFenceCreateInfo fenceCreateInfo{};
+    fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    for (auto& batch : batches) {
+        if (vkAllocateCommandBuffers(Context::get().getDevice(), &allocInfo,
+                                     &batch.commandBuffer) != VK_SUCCESS)
+            throw std::runtime_error{"failed to create upload command buffer!"};
+
+        if (vkCreateFence(Context::get().getDevice(), &fenceCreateInfo,
+                          nullptr, &*batch.fence) != VK_SUCCESS)
+            throw std::runtime_error{"failed to create upload fence!"};
+    }
+}
+
+Uploader::~Uploader() {
+    while (inFlight > 0) waitOldest();
+
+    if (mapped)
+        vmaUnmapMemory(Context::get().getVma(), staging.getMemory());
+    mapped = nullptr;
+}
+
+uint64_t Uploader::upload(VkBuffer dst, VkDeviceSize dstOffset,
+                          const void* data, VkDeviceSize size) {
+    VkDeviceSize offset = reserve(size);
+    std::memcpy(mapped + offset, data, size);
+
+    Batch& batch = getRecordingBatch();
+    recordCopy(batch, *staging, offset, dst, dstOffset, size);
+
+    batch.ringEnd = head;
+    return batch.id;
+}
+
+uint64_t Uploader::copy(VkBuffer src, VkDeviceSize srcOffset, VkBuffer dst,
+                        VkDeviceSize dstOffset, VkDeviceSize size) {
+    Batch& batch = getRecordingBatch();
+    recordCopy(batch, src, srcOffset, dst, dstOffset, size);
+    return batch.id;
+}
+
+void Uploader::flush() {
+    retire();
+    if (!recording) return;
+
+    Batch& batch = batches[(oldest + inFlight) % MAX_BATCHES];
+    vkEndCommandBuffer(batch.commandBuffer);
+
+    // No-op on coherent memory
+    vmaFlushAllocation(Context::get().getVma(), staging.getMemory(), 0,
+                       VK_WHOLE_SIZE);
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &batch.commandBuffer;
+
+    batch.semaphore = getFreeSemaphore();
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &batch.semaphore;
+
+    if (vkQueueSubmit(Context::get().getTransferQueue(), 1, &submitInfo,
+                      *batch.fence) != VK_SUCCESS)
+        throw std::runtime_error{"failed to submit upload batch!"};
+
+    recording = false;
+    inFlight++;
+    nextBatch++;
+}
+
+std::vector<VkSemaphore> Uploader::takeCompleted() {
+    std::vector<VkSemaphore> ret;
+    ret.swap(completedSemaphores);
+    return ret;
+}
+
+void Uploader::recycle(std::vector<VkSemaphore>& semaphores) {
+    freeSemaphores.insert(freeSemaphores.end(), semaphores.begin(),
+                          semaphores.end());
+    semaphores.clear();
+}
+
+VkDeviceSize Uploader::reserve(VkDeviceSize size) {
+    VkDeviceSize aligned = (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    if (aligned >= STAGING_SIZE)
+        throw std::runtime_error{"upload larger than the staging ring!"};
+
+    while (true) {
+        retire();
+
+        // Nothing left in the ring, start over from the beginning
+        if (inFlight == 0 && !recording) head = tail = 0;
+
+        // The ring is never allowed to fill up completely, so head == tail
+        // always means that it is empty
+        VkDeviceSize offset = head;
+        bool fits = false;
+        if (head >= tail) {
+            if (head + aligned <= STAGING_SIZE) {
+                fits = tail > 0 || head + aligned < STAGING_SIZE;
+            } else if (aligned < tail) {
+                offset = 0;
+                fits = true;
+            }
+        } else {
+            fits = head + aligned < tail;
+        }
+
+        if (fits) {
+            head = (offset + aligned) % STAGING_SIZE;
+            return offset;
+        }
+
+        // Full, push out what is recorded so far and wait for the oldest
+        // batch to free up some space
+        flush();
+        waitOldest();
+    }
+}
+
+Uploader::Batch& Uploader::getRecordingBatch() {
+    if (!recording) {
+        retire();
+        if (inFlight == MAX_BATCHES) waitOldest();
+
+        Batch& batch = batches[(oldest + inFlight) % MAX_BATCHES];
+        batch.id = nextBatch;
+        // Holds nothing in the ring until the first upload
+        batch.ringEnd = head;
+
+        vkResetCommandBuffer(batch.commandBuffer, 0);
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        if (vkBeginCommandBuffer(batch.commandBuffer, &beginInfo) !=
+            VK_SUCCESS)
+            throw std::runtime_error{"failed to begin upload batch!"};
+
+        // Copies within the device buffers read what earlier batches wrote,
+        // the fences only told the CPU that those completed
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask =
+            VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(batch.commandBuffer,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0,
+                             nullptr, 0, nullptr);
+
+        recording = true;
+    }
+
+    return batches[(oldest + inFlight) % MAX_BATCHES];
+}
+
+void Uploader::recordCopy(Batch& batch, VkBuffer src, VkDeviceSize srcOffset,
+                          VkBuffer dst, VkDeviceSize dstOffset,
+                          VkDeviceSize size) {
+    VkBufferCopy copyRegion{};
+    copyRegion.srcOffset = srcOffset;
+    copyRegion.dstOffset = dstOffset;
+    copyRegion.size = size;
+    vkCmdCopyBuffer(batch.commandBuffer, src, dst, 1, &copyRegion);
+}
+
+void Uploader::retire() {
+    while (inFlight > 0) {
+        Batch& batch = batches[oldest];
+        if (vkGetFenceStatus(Context::get().getDevice(), *batch.fence) !=
+            VK_SUCCESS)
+            break;
+
+        vkResetFences(Context::get().getDevice(), 1, &*batch.fence);
+        tail = batch.ringEnd;
+        completedBatch = batch.id;
+        completedSemaphores.push_back(batch.semaphore);
+        batch.semaphore = VK_NULL_HANDLE;
+
+        oldest = (oldest + 1) % MAX_BATCHES;
+        inFlight--;
+    }
+}
+
+void Uploader::waitOldest() {
+    if (inFlight == 0) return;
+
+    vkWaitForFences(Context::get().getDevice(), 1, &*batches[oldest].fence,
+                    VK_TRUE, UINT64_MAX);
+    retire();
+}
+
+VkSemaphore Uploader::getFreeSemaphore() {
+    if (freeSemaphores.empty()) {
+        VkSemaphoreCreateInfo createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+        ManagedSemaphore semaphore;
+        if (vkCreateSemaphore(Context::get().getDevice(), &createInfo,
+                              nullptr, &*semaphore) != VK_SUCCESS)
+            throw std::runtime_error{"failed to create upload semaphore!"};
+
+        freeSemaphores.push_back(*semaphore);
+        semaphores.push_back(std::move(semaphore));
+    }
+
+    VkSemaphore semaphore = freeSemaphores.back();
+    freeSemaphores.pop_back();
+    return semaphore;
+}
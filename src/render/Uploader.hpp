@@ -0,0 +1,102 @@
+#pragma once
+
+#include <vulkan/vulkan_core.h>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "Managed.hpp"
+
+namespace render {
+
+// Streams data into device local buffers without stalling the CPU. Data is
+// written into a persistently mapped staging ring and the copies are
+// submitted in batches to the transfer queue, one batch per flush(). Batches
+// are only ever waited on when the ring or every batch slot is full.
+//
+// Each batch signals a semaphore that the graphics queue waits on before it
+// reads the batch's writes. The destination buffers are shared by both queue
+// families, so no ownership transfer is needed.
+class Uploader {
+public:
+    static constexpr VkDeviceSize STAGING_SIZE = 16 * 1024 * 1024;
+    // Batches submitted and not yet completed, at most
+    static constexpr uint32_t MAX_BATCHES = 4;
+    // Keeps every copy source suitably aligned for any vertex or index type
+    static constexpr VkDeviceSize ALIGNMENT = 16;
+
+    Uploader(ManagedBuffer staging);
+    ~Uploader();
+
+    // Queues a copy of the data into dst and returns the id of the batch
+    // carrying it. The data is copied right away, it can be freed.
+    uint64_t upload(VkBuffer dst, VkDeviceSize dstOffset, const void* data,
+                    VkDeviceSize size);
+    // Queues a copy between two device buffers, or two ranges of one buffer
+    // as long as they don't overlap
+    uint64_t copy(VkBuffer src, VkDeviceSize srcOffset, VkBuffer dst,
+                  VkDeviceSize dstOffset, VkDeviceSize size);
+
+    // Submits the copies queued since the last call and retires the batches
+    // that have completed
+    void flush();
+
+    // Every batch up to this one has completed
+    uint64_t getCompletedBatch() const { return completedBatch; }
+
+    // Semaphores signalled by the batches completed since the last call. The
+    // next graphics submit has to wait on all of them, and hand them back
+    // with recycle() once it has completed.
+    std::vector<VkSemaphore> takeCompleted();
+    void recycle(std::vector<VkSemaphore>& semaphores);
+
+private:
+    struct Batch {
+        VkCommandBuffer commandBuffer{VK_NULL_HANDLE};
+        ManagedFence fence;
+        // Taken from the pool when the batch is submitted
+        VkSemaphore semaphore{VK_NULL_HANDLE};
+
+        uint64_t id{0};
+        // End of the batch data in the ring, everything before it is free
+        // once the batch completes
+        VkDeviceSize ringEnd{0};
+    };
+
+    // Returns the ring offset of size free bytes
+    VkDeviceSize reserve(VkDeviceSize size);
+    Batch& getRecordingBatch();
+    void recordCopy(Batch& batch, VkBuffer src, VkDeviceSize srcOffset,
+                    VkBuffer dst, VkDeviceSize dstOffset, VkDeviceSize size);
+
+    // Never blocks
+    void retire();
+    void waitOldest();
+    VkSemaphore getFreeSemaphore();
+
+    ManagedBuffer staging;
+    uint8_t* mapped{nullptr};
+    // Free space goes from head up to tail, wrapping around
+    VkDeviceSize head{0};
+    VkDeviceSize tail{0};
+
+    ManagedCommandPool commandPool;
+    std::array<Batch, MAX_BATCHES> batches;
+    // Submitted batches are [oldest, oldest + inFlight), in submission order
+    uint32_t oldest{0};
+    uint32_t inFlight{0};
+    // The batch after the submitted ones is being recorded
+    bool recording{false};
+
+    uint64_t nextBatch{1};
+    uint64_t completedBatch{0};
+
+    // A semaphore can't be signalled again before its wait has completed, so
+    // they are pooled instead of tied to the batch slots
+    std::vector<ManagedSemaphore> semaphores;
+    std::vector<VkSemaphore> freeSemaphores;
+    std::vector<VkSemaphore> completedSemaphores;
+};
+
+}  // namespace render
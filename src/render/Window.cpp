@@ -1,6 +1,7 @@
 #include "Window.hpp"
 
 #include <chrono>
+#include <iostream>
 
 #include "BufferManager.hpp"
 #include "Context.hpp"
@@ -13,7 +14,8 @@ void Window::glfwOnResizeCallback(GLFWwindow* window, int width, int height) {
     app->onResize(width, height);
 }
 
-Window::Window(std::string name, size_t uboPoolSize, size_t texturePoolSize) {
+Window::Window(std::string name, size_t uboPoolSize)
+    : createdAt{std::chrono::steady_clock::now()} {
     // Initialize GLFW
     glfwInit();
 
@@ -34,7 +36,7 @@ Window::Window(std::string name, size_t uboPoolSize, size_t texturePoolSize) {
     // Initialize vulkan
     try {
         Context::create(window);
-        BufferManager::create(10, 10);
+        BufferManager::create(10);
         Swapchain::create();
     } catch (...) {
         cleanup();
@@ -55,6 +57,13 @@ void Window::mainLoop() {
     float timeStart = getTime();
     float timeLast = 0.0f;
     input.selected_block = 0;
+    input.depthPrepass = true;
+    input.overdrawView = false;
+    bool firstFrame = true;
+
+    // Debug toggles flip when their key goes down
+    bool prepassKeyDown = false;
+    bool overdrawKeyDown = false;
 
     while (!glfwWindowShouldClose(window)) {
         glfwPollEvents();
@@ -125,11 +134,33 @@ void Window::mainLoop() {
             captureMouse = false;
         }
 
+        bool prepassKey = glfwGetKey(window, GLFW_KEY_F4) == GLFW_PRESS;
+        if (prepassKey && !prepassKeyDown)
+            input.depthPrepass = !input.depthPrepass;
+        prepassKeyDown = prepassKey;
+
+        bool overdrawKey = glfwGetKey(window, GLFW_KEY_F3) == GLFW_PRESS;
+        if (overdrawKey && !overdrawKeyDown)
+            input.overdrawView = !input.overdrawView;
+        overdrawKeyDown = overdrawKey;
+
         input.time = getTime() - timeStart;
         input.deltaTime = input.time - timeLast;
         timeLast = input.time;
 
         onFrame(input);
+
+        // Mostly spent compiling pipelines when the cache is cold
+        if (firstFrame) {
+            firstFrame = false;
+            float ms = std::chrono::duration<float, std::milli>(
+                           std::chrono::steady_clock::now() - createdAt)
+                           .count();
+            std::cout << "[INFO] First frame after " << ms << " ms, "
+                      << (Context::get().isPipelineCacheWarm() ? "warm"
+                                                               : "cold")
+                      << " pipeline cache" << std::endl;
+        }
     }
 
     // Wait for the device to finish rendering before cleaning up!
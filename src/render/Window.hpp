@@ -1,5 +1,6 @@
 #pragma once
 
+#include <chrono>
 #include <string>
 
 #define GLFW_INCLUDE_VULKAN
@@ -24,9 +25,12 @@ public:
         float time;
         float deltaTime;
         int selected_block;
+        // Toggled by F4 and F3
+        bool depthPrepass;
+        bool overdrawView;
     };
 
-    Window(std::string name, size_t uboPoolSize, size_t texturePoolSize);
+    Window(std::string name, size_t uboPoolSize);
     ~Window();
 
     void mainLoop();
@@ -44,6 +48,9 @@ private:
 
     GLFWwindow *window{nullptr};
 
+    // For the time to first frame
+    std::chrono::steady_clock::time_point createdAt;
+
     bool captureMouse{false};
 };
 
@@ -0,0 +1,46 @@
+#version 450
+
+// Depth prepass, places vertices exactly like GeometryVert.vert from the
+// position stream alone
+layout(location = 0) in vec3 inPos;
+layout(location = 4) in vec3 inInstanceOffset;
+layout(location = 5) in vec4 inInstanceRotation;
+layout(location = 6) in uint inJoint;
+layout(location = 7) in uint inInstancePalette;
+
+layout(push_constant) uniform PushConstant {
+    mat4 m;
+    mat4 vp;
+}
+pushConstant;
+
+invariant gl_Position;
+
+const uint NO_PALETTE = 0xFFFFFFFFu;
+
+struct Joint {
+    vec4 pos;
+    vec4 rot;
+};
+
+layout(std430, set = 2, binding = 0) readonly buffer Palette {
+    Joint joints[];
+};
+
+// Rotates v by the unit quaternion q, stored as x, y, z, w
+vec3 rotate(vec4 q, vec3 v) {
+    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+void main() {
+    vec3 pos = inPos;
+    if (inInstancePalette != NO_PALETTE) {
+        Joint joint = joints[inInstancePalette + inJoint];
+        pos = rotate(joint.rot, pos) + joint.pos.xyz;
+    }
+
+    pos = rotate(inInstanceRotation, pos);
+    vec4 worldPos =
+        pushConstant.m * vec4(pos, 1.0) + vec4(inInstanceOffset, 0.0);
+    gl_Position = pushConstant.vp * worldPos;
+}
@@ -1,36 +1,61 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
 layout(location = 0) in vec3 fragNormal;
 layout(location = 1) in vec2 fragTexCoord;
 layout(location = 2) in vec3 fragWorldPos;
 layout(location = 3) in float fragSpecStrength;
+layout(location = 4) flat in uint fragTexture;
 
 layout(location = 0) out vec4 outColor;
 
-layout(set = 0, binding = 0) uniform sampler2D texSampler;
-layout(set = 1, binding = 0) uniform sampler2D depthTexSampler;
-layout(set = 2, binding = 0) uniform Ubo {
-    mat4 shadowVP;
+// The texture table of BufferManager, holding the shadow map too
+layout(set = 0, binding = 0) uniform sampler2D textures[];
+// Cascades of the shadow map, in a 2x2 atlas from near to far
+const int CASCADE_COUNT = 4;
+
+layout(set = 1, binding = 0) uniform Ubo {
+    mat4 cascadeVPs[CASCADE_COUNT];
     vec4 ambientColor;
     vec4 sunDir;
     vec4 sunColor;
     vec4 viewPos;
+    uint shadowMap;
 }
 ubo;
 
+// Whether the point is lit by the sun, in the nearest cascade holding it.
+// Cascades are fitted to slices of the view, but the far ones are drawn
+// every few frames, so their boxes are tested rather than the distance.
+bool isLit(vec3 worldPos) {
+    // Half a texel, so that filtering stays within the cascade
+    const float MARGIN = 0.5 / 1024.0;
+
+    for (int i = 0; i < CASCADE_COUNT; i++) {
+        vec4 shadowPos = ubo.cascadeVPs[i] * vec4(worldPos, 1.0);
+        vec2 uv = (shadowPos.xy + vec2(1.0)) / 2;
+        if (any(lessThan(uv, vec2(MARGIN))) ||
+            any(greaterThan(uv, vec2(1.0 - MARGIN))))
+            continue;
+
+        vec2 cell = vec2(i % 2, i / 2);
+        float shadowDepth =
+            texture(textures[ubo.shadowMap], (uv + cell) / 2).r;
+        return shadowPos.z < (shadowDepth + 0.0001);
+    }
+
+    // Past the last cascade
+    return true;
+}
+
 void main() {
     vec3 sunDir = normalize(ubo.sunDir.xyz);
     vec3 normal = normalize(fragNormal);
     vec3 viewPos = ubo.viewPos.xyz;
 
-    // Shadow stuff
-    vec4 shadowPos = ubo.shadowVP * vec4(fragWorldPos, 1.0);
-    float shadowDepth =
-        texture(depthTexSampler, (shadowPos.xy + vec2(1.0)) / 2).r;
-
     // Always add ambient color
     vec3 lightColor = ubo.ambientColor.rgb;
-    if (shadowPos.z < (shadowDepth + 0.0001)) {
+    if (isLit(fragWorldPos)) {
         // If we are not in shadow, compute diffuse component
         lightColor += ubo.sunColor.rgb * max(dot(sunDir, normal), 0);
 
@@ -42,5 +67,8 @@ void main() {
         lightColor += ubo.sunColor.rgb * spec * fragSpecStrength;
     }
 
-    outColor = vec4(lightColor * texture(texSampler, fragTexCoord).rgb, 1.0);
+    // Draws mix textures, the index may differ within a wave
+    vec3 color =
+        texture(textures[nonuniformEXT(fragTexture)], fragTexCoord).rgb;
+    outColor = vec4(lightColor * color, 1.0);
 }
@@ -4,11 +4,24 @@ layout(location = 0) in vec3 inPos;
 layout(location = 1) in vec3 inNormal;
 layout(location = 2) in vec2 inTexCoord;
 layout(location = 3) in float inSpecStrength;
+// Zero offset and no rotation for meshes drawn on their own, which use m
+// instead
+layout(location = 4) in vec3 inInstanceOffset;
+layout(location = 5) in vec4 inInstanceRotation;
+// Joint of the vertex, from the first joint of the instance
+layout(location = 6) in uint inJoint;
+layout(location = 7) in uint inInstancePalette;
+// Slot of the texture in the texture table
+layout(location = 8) in uint inInstanceTexture;
 
 layout(location = 0) out vec3 fragNormal;
 layout(location = 1) out vec2 fragTexCoord;
 layout(location = 2) out vec3 fragWorldPos;
 layout(location = 3) out float fragSpecStrength;
+layout(location = 4) flat out uint fragTexture;
+
+// Matches the depth prepass to the bit, the shading pass tests for equality
+invariant gl_Position;
 
 layout(push_constant) uniform PushConstant {
     mat4 m;
@@ -16,16 +29,44 @@ layout(push_constant) uniform PushConstant {
 }
 pushConstant;
 
+const uint NO_PALETTE = 0xFFFFFFFFu;
+
+// Model space joints of the skinned meshes, pos.w is unused
+struct Joint {
+    vec4 pos;
+    vec4 rot;
+};
+
+layout(std430, set = 2, binding = 0) readonly buffer Palette {
+    Joint joints[];
+};
+
+// Rotates v by the unit quaternion q, stored as x, y, z, w
+vec3 rotate(vec4 q, vec3 v) {
+    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
 void main() {
-    vec4 worldPos = pushConstant.m * vec4(inPos.xyz, 1.0);
+    vec3 pos = inPos;
+    vec3 normal = inNormal;
+    if (inInstancePalette != NO_PALETTE) {
+        Joint joint = joints[inInstancePalette + inJoint];
+        pos = rotate(joint.rot, pos) + joint.pos.xyz;
+        normal = rotate(joint.rot, normal);
+    }
+
+    pos = rotate(inInstanceRotation, pos);
+    vec4 worldPos =
+        pushConstant.m * vec4(pos, 1.0) + vec4(inInstanceOffset, 0.0);
     gl_Position = pushConstant.vp * worldPos;
 
     mat4 n = pushConstant.m;
     // Zero out translation component
     n[3] = vec4(0.0, 0.0, 0.0, 1.0);
 
-    fragNormal = (n * vec4(inNormal.xyz, 1.0)).xyz;
+    fragNormal = (n * vec4(rotate(inInstanceRotation, normal), 1.0)).xyz;
     fragTexCoord = inTexCoord;
     fragWorldPos = worldPos.xyz;
     fragSpecStrength = inSpecStrength;
+    fragTexture = inInstanceTexture;
 }
\ No newline at end of file
@@ -0,0 +1,6 @@
+#version 450
+
+layout(location = 0) out vec4 outColor;
+
+// Added up for every fragment shaded, eight layers of overdraw saturate
+void main() { outColor = vec4(0.125, 0.0625, 0.0, 1.0); }
@@ -1,11 +1,37 @@
 #version 450
 
 layout(location = 0) in vec3 inPos;
-layout(location = 1) in vec3 inNormal;
-layout(location = 2) in vec2 inTexCoord;
-layout(location = 3) in float inSpecStrength;
+layout(location = 4) in vec3 inInstanceOffset;
+layout(location = 5) in vec4 inInstanceRotation;
+layout(location = 6) in uint inJoint;
+layout(location = 7) in uint inInstancePalette;
 
 layout(push_constant) uniform PushConstant { mat4 mvp; }
 pushConstant;
 
-void main() { gl_Position = pushConstant.mvp * vec4(inPos.xyz, 1.0); }
\ No newline at end of file
+const uint NO_PALETTE = 0xFFFFFFFFu;
+
+struct Joint {
+    vec4 pos;
+    vec4 rot;
+};
+
+layout(std430, set = 0, binding = 0) readonly buffer Palette {
+    Joint joints[];
+};
+
+// Rotates v by the unit quaternion q, stored as x, y, z, w
+vec3 rotate(vec4 q, vec3 v) {
+    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+void main() {
+    vec3 pos = inPos;
+    if (inInstancePalette != NO_PALETTE) {
+        Joint joint = joints[inInstancePalette + inJoint];
+        pos = rotate(joint.rot, pos) + joint.pos.xyz;
+    }
+
+    pos = rotate(inInstanceRotation, pos) + inInstanceOffset;
+    gl_Position = pushConstant.mvp * vec4(pos, 1.0);
+}
\ No newline at end of file
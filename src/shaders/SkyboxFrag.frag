@@ -1,17 +1,22 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
 layout(location = 0) in vec2 fragTexCoord;
 
 layout(location = 0) out vec4 outColor;
 
-layout(set = 0, binding = 0) uniform sampler2D dayTexSampler;
-layout(set = 1, binding = 0) uniform sampler2D nightTexSampler;
-layout(set = 2, binding = 0) uniform Ubo { float blend; }
+// The texture table of BufferManager
+layout(set = 0, binding = 0) uniform sampler2D textures[];
+layout(set = 1, binding = 0) uniform Ubo {
+    float blend;
+    uint dayTexture;
+    uint nightTexture;
+}
 ubo;
 
 void main() {
-    vec3 dayColor = texture(dayTexSampler, fragTexCoord).rgb;
-    vec3 nightColor = texture(nightTexSampler, fragTexCoord).rgb;
+    vec3 dayColor = texture(textures[ubo.dayTexture], fragTexCoord).rgb;
+    vec3 nightColor = texture(textures[ubo.nightTexture], fragTexCoord).rgb;
 
     outColor = vec4(mix(nightColor, dayColor, ubo.blend), 1.0);
-}
+}
\ No newline at end of file
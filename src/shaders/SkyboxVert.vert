@@ -9,6 +9,7 @@ layout(push_constant) uniform PushConstant { mat4 mvp; }
 pushConstant;
 
 void main() {
-    gl_Position = pushConstant.mvp * vec4(inPos.xyz, 1.0);
+    // On the far plane, so that it only shows where no geometry was drawn
+    gl_Position = (pushConstant.mvp * vec4(inPos.xyz, 1.0)).xyww;
     fragTexCoord = inTexCoord;
 }
\ No newline at end of file
@@ -4,11 +4,13 @@ layout(location = 0) in vec2 inPosition;
 layout(location = 1) in vec2 inTexCoord;
 
 layout(location = 0) out vec2 fragTexCoord;
+layout(location = 1) flat out uint fragTexture;
 
 layout(push_constant) uniform PushConstant {
     vec2 pos;
     vec2 dimension;
     vec2 anchor;
+    uint texture;
 }
 pushConstant;
 
@@ -17,4 +19,5 @@ void main() {
                  pushConstant.anchor;
     gl_Position = vec4(coord.xy, 0.0, 1.0);
     fragTexCoord = inTexCoord;
+    fragTexture = pushConstant.texture;
 }
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include "AnimModel.hpp"
 
+#include <algorithm>
+
 #include "../render/BufferManager.hpp"
 #include "../render/Constants.hpp"
 
@@ -10,7 +12,7 @@ AnimModelBlueprint::AnimModelBlueprint(const std::string& path,
                                        VkFormat format) {
     texture = BufferManager::get().allocateTexture(path, format);
 
-    Joint joint{JointId::root(), GeometryMesh{}};
+    Joint joint{JointId::root()};
 
     Transform transform{
         glm::vec3{0.0f, 0.0f, 0.0f},
@@ -84,7 +86,7 @@ AnimModelBlueprint::JointId AnimModelBlueprint::addJoint(
     };
 
     // clang-format off
-    GeometryMesh mesh = BufferManager::get().allocateMesh<GeometryMesh>({
+    const uint16_t jointIndices[] = {
             0,  1,  2,  0,  2,  3,
             4,  5,  6,  4,  6,  7,
     
@@ -93,7 +95,8 @@ AnimModelBlueprint::JointId AnimModelBlueprint::addJoint(
     
             16, 17, 18, 16, 18, 19,
             20, 21, 22, 20, 22, 23,
-        }, {
+        };
+    const GeometryVertex jointVertices[] = {
             // Z- side
             {xPosYNegZNeg, Z_NEG_NORMAL, zNegBounds.getBottomRight(), 0.0f},
             {xNegYNegZNeg, Z_NEG_NORMAL, zNegBounds.getBottomLeft(), 0.0f},
@@ -129,10 +132,17 @@ AnimModelBlueprint::JointId AnimModelBlueprint::addJoint(
             {xPosYNegZNeg, X_POS_NORMAL, xPosBounds.getBottomRight(), 0.0f},
             {xPosYPosZNeg, X_POS_NORMAL, xPosBounds.getTopRight(), 0.0f},
             {xPosYPosZPos, X_POS_NORMAL, xPosBounds.getTopLeft(), 0.0f}
-        });
+        };
     // clang-format on
 
-    Joint joint{parent, std::move(mesh)};
+    uint16_t base = static_cast<uint16_t>(vertices.size());
+    for (uint16_t i : jointIndices) indices.push_back(base + i);
+    for (GeometryVertex vertex : jointVertices) {
+        vertex.joint = static_cast<uint32_t>(index);
+        vertices.push_back(vertex);
+    }
+
+    Joint joint{parent};
 
     Transform transform{
         {
@@ -151,26 +161,240 @@ AnimModelBlueprint::JointId AnimModelBlueprint::addJoint(
     return {index};
 }
 
-AnimModelPose AnimModelBlueprint::newPose() const { return {transforms}; }
+void AnimModelBlueprint::build() {
+    mesh = BufferManager::get().allocateMesh<GeometryMesh>(indices, vertices);
+
+    // The vertices are relative to their joint, so bound the rest pose
+    // instead. Animations only swing the limbs a little, which the bounding
+    // sphere of the box makes up for.
+    std::vector<Transform> rest = transforms;
+    updateJoints(rest);
+    for (auto& vertex : vertices) {
+        const Transform& joint = rest[vertex.joint];
+        vertex.pos = joint.globalPos + joint.globalRot * vertex.pos;
+    }
+    mesh.computeBounds(vertices);
+
+    indices.clear();
+    indices.shrink_to_fit();
+    vertices.clear();
+    vertices.shrink_to_fit();
+}
+
+AnimModelPose AnimModelBlueprint::newPose() {
+    if (poseCount == capacity) growPoses();
+
+    uint32_t slot = poseCount++;
+    for (size_t i = 0; i < joints.size(); i++) {
+        setLocal(slot, i, transforms[i].localPos);
+        setLocal(slot, i, transforms[i].localRot);
+    }
+    // The root transform goes in the instance, so the joints are evaluated
+    // in model space
+    setGlobal(slot, 0, glm::vec3{0.0f}, glm::quat{1.0f, 0.0f, 0.0f, 0.0f});
+
+    return AnimModelPose{this, slot};
+}
 
-void AnimModelBlueprint::addToModelList(
-    std::list<render::GeometryModel>& models, AnimModelPose& pose) {
-    pose.transforms[0].updateGlobal();
+void AnimModelBlueprint::addToRenderQueue(render::RenderQueue& queue) {
+    if (poseCount == 0) return;
+
+    // Every pose shares the skinned mesh, so the queue draws all of them
+    // with one instanced call. Each pose brings its own joints to the
+    // palette, the root included so that the vertices can index them with
+    // their joint index.
+    size_t jointCount = joints.size();
+    uint32_t first =
+        queue.pushJoints(static_cast<uint32_t>(poseCount * jointCount));
+    if (first == GeometryInstance::NO_PALETTE) return;
+
+    // Parents are always added before their children, so every parent is
+    // done by the time its children get evaluated
+    JointTransform* palette = queue.getJoints(first);
+    for (size_t i = 0; i < jointCount; i++) {
+        if (i > 0) evaluateJoint(i);
+        writeJoints(i, palette);
+    }
 
-    for (int i = 1; i < joints.size(); i++) {
-        int parent_idx = joints[i].parent.index;
-        pose.transforms[i].updateGlobal(pose.transforms[parent_idx]);
+    const float* px = getRow(0, LOCAL_POS_X);
+    const float* py = getRow(0, LOCAL_POS_Y);
+    const float* pz = getRow(0, LOCAL_POS_Z);
+    const float* qx = getRow(0, LOCAL_ROT_X);
+    const float* qy = getRow(0, LOCAL_ROT_Y);
+    const float* qz = getRow(0, LOCAL_ROT_Z);
+    const float* qw = getRow(0, LOCAL_ROT_W);
+    for (uint32_t i = 0; i < poseCount; i++) {
+        queue.pushInstance(&mesh, &texture, {px[i], py[i], pz[i]},
+                           glm::quat{qw[i], qx[i], qy[i], qz[i]},
+                           first + static_cast<uint32_t>(i * jointCount));
     }
+}
+
+void AnimModelBlueprint::updateJoints(std::vector<Transform>& pose) const {
+    pose[0].globalPos = glm::vec3{0.0f};
+    pose[0].globalRot = glm::quat{1.0f, 0.0f, 0.0f, 0.0f};
+
+    // Parents are always added before their children
+    for (size_t i = 1; i < joints.size(); i++) {
+        size_t parent = joints[i].parent.index;
+        pose[i].updateGlobal(pose[parent]);
+    }
+}
+
+void AnimModelBlueprint::setLocal(uint32_t slot, size_t joint,
+                                  glm::vec3 pos) {
+    getRow(joint, LOCAL_POS_X)[slot] = pos.x;
+    getRow(joint, LOCAL_POS_Y)[slot] = pos.y;
+    getRow(joint, LOCAL_POS_Z)[slot] = pos.z;
+}
+
+void AnimModelBlueprint::setLocal(uint32_t slot, size_t joint,
+                                  glm::quat rot) {
+    getRow(joint, LOCAL_ROT_X)[slot] = rot.x;
+    getRow(joint, LOCAL_ROT_Y)[slot] = rot.y;
+    getRow(joint, LOCAL_ROT_Z)[slot] = rot.z;
+    getRow(joint, LOCAL_ROT_W)[slot] = rot.w;
+}
+
+void AnimModelBlueprint::setGlobal(uint32_t slot, size_t joint,
+                                   glm::vec3 pos, glm::quat rot) {
+    getRow(joint, GLOBAL_POS_X)[slot] = pos.x;
+    getRow(joint, GLOBAL_POS_Y)[slot] = pos.y;
+    getRow(joint, GLOBAL_POS_Z)[slot] = pos.z;
+    getRow(joint, GLOBAL_ROT_X)[slot] = rot.x;
+    getRow(joint, GLOBAL_ROT_Y)[slot] = rot.y;
+    getRow(joint, GLOBAL_ROT_Z)[slot] = rot.z;
+    getRow(joint, GLOBAL_ROT_W)[slot] = rot.w;
+}
 
-    for (int i = 0; i < joints.size(); i++) {
-        // printf("Yeet: %d %p %p\n", i, *joints[i].mesh.buffer,
-        // *texture.image.image);
-        GeometryModel model{joints[i].mesh, texture,
-                            pose.transforms[i].globalPos,
-                            pose.transforms[i].globalRot};
+void AnimModelBlueprint::freePose(uint32_t slot) {
+    uint32_t last = --poseCount;
+    if (slot == last) return;
 
-        models.push_back(model);
+    for (size_t row = 0; row < joints.size() * FIELD_COUNT; row++) {
+        float* data = poses.data() + row * capacity;
+        data[slot] = data[last];
     }
+
+    owners[slot] = owners[last];
+    owners[slot]->slot = slot;
+}
+
+void AnimModelBlueprint::growPoses() {
+    uint32_t grownCapacity = std::max(capacity * 2, INITIAL_POSES);
+
+    std::vector<float> grown(joints.size() * FIELD_COUNT * grownCapacity);
+    for (size_t row = 0; row < joints.size() * FIELD_COUNT; row++) {
+        std::copy_n(poses.data() + row * capacity, poseCount,
+                    grown.data() + row * grownCapacity);
+    }
+
+    poses.swap(grown);
+    capacity = grownCapacity;
+    owners.resize(capacity);
+}
+
+void AnimModelBlueprint::evaluateJoint(size_t joint) {
+    size_t parent = joints[joint].parent.index;
+    const float* ppx = getRow(parent, GLOBAL_POS_X);
+    const float* ppy = getRow(parent, GLOBAL_POS_Y);
+    const float* ppz = getRow(parent, GLOBAL_POS_Z);
+    const float* pqx = getRow(parent, GLOBAL_ROT_X);
+    const float* pqy = getRow(parent, GLOBAL_ROT_Y);
+    const float* pqz = getRow(parent, GLOBAL_ROT_Z);
+    const float* pqw = getRow(parent, GLOBAL_ROT_W);
+
+    const float* lpx = getRow(joint, LOCAL_POS_X);
+    const float* lpy = getRow(joint, LOCAL_POS_Y);
+    const float* lpz = getRow(joint, LOCAL_POS_Z);
+    const float* lqx = getRow(joint, LOCAL_ROT_X);
+    const float* lqy = getRow(joint, LOCAL_ROT_Y);
+    const float* lqz = getRow(joint, LOCAL_ROT_Z);
+    const float* lqw = getRow(joint, LOCAL_ROT_W);
+
+    float* gpx = getRow(joint, GLOBAL_POS_X);
+    float* gpy = getRow(joint, GLOBAL_POS_Y);
+    float* gpz = getRow(joint, GLOBAL_POS_Z);
+    float* gqx = getRow(joint, GLOBAL_ROT_X);
+    float* gqy = getRow(joint, GLOBAL_ROT_Y);
+    float* gqz = getRow(joint, GLOBAL_ROT_Z);
+    float* gqw = getRow(joint, GLOBAL_ROT_W);
+
+    // Same as Transform::updateGlobal, spelled out so that there are no
+    // branches and every pose goes through the same math. The rows never
+    // overlap, but they all point into poses: told so, the compiler
+    // vectorises the loop instead of giving up on checking every pair of
+    // rows at run time.
+#if defined(__clang__)
+#pragma clang loop vectorize(assume_safety)
+#elif defined(__GNUC__)
+#pragma GCC ivdep
+#endif
+    for (uint32_t i = 0; i < poseCount; i++) {
+        // Local position rotated by the parent: t = 2 * cross(q, v), then
+        // v + w * t + cross(q, t)
+        float tx = 2.0f * (pqy[i] * lpz[i] - pqz[i] * lpy[i]);
+        float ty = 2.0f * (pqz[i] * lpx[i] - pqx[i] * lpz[i]);
+        float tz = 2.0f * (pqx[i] * lpy[i] - pqy[i] * lpx[i]);
+        gpx[i] = ppx[i] + lpx[i] + pqw[i] * tx + (pqy[i] * tz - pqz[i] * ty);
+        gpy[i] = ppy[i] + lpy[i] + pqw[i] * ty + (pqz[i] * tx - pqx[i] * tz);
+        gpz[i] = ppz[i] + lpz[i] + pqw[i] * tz + (pqx[i] * ty - pqy[i] * tx);
+
+        // Parent rotation times local rotation
+        gqw[i] = pqw[i] * lqw[i] - pqx[i] * lqx[i] - pqy[i] * lqy[i] -
+                 pqz[i] * lqz[i];
+        gqx[i] = pqw[i] * lqx[i] + pqx[i] * lqw[i] + pqy[i] * lqz[i] -
+                 pqz[i] * lqy[i];
+        gqy[i] = pqw[i] * lqy[i] - pqx[i] * lqz[i] + pqy[i] * lqw[i] +
+                 pqz[i] * lqx[i];
+        gqz[i] = pqw[i] * lqz[i] + pqx[i] * lqy[i] - pqy[i] * lqx[i] +
+                 pqz[i] * lqw[i];
+    }
+}
+
+void AnimModelBlueprint::writeJoints(size_t joint,
+                                     render::JointTransform* palette) {
+    const float* px = getRow(joint, GLOBAL_POS_X);
+    const float* py = getRow(joint, GLOBAL_POS_Y);
+    const float* pz = getRow(joint, GLOBAL_POS_Z);
+    const float* qx = getRow(joint, GLOBAL_ROT_X);
+    const float* qy = getRow(joint, GLOBAL_ROT_Y);
+    const float* qz = getRow(joint, GLOBAL_ROT_Z);
+    const float* qw = getRow(joint, GLOBAL_ROT_W);
+
+    // The palette holds the joints of a pose together
+    size_t stride = joints.size();
+    for (uint32_t i = 0; i < poseCount; i++) {
+        palette[i * stride + joint] = {{px[i], py[i], pz[i], 0.0f},
+                                       {qx[i], qy[i], qz[i], qw[i]}};
+    }
+}
+
+AnimModelPose::AnimModelPose(AnimModelBlueprint* blueprint, uint32_t slot)
+    : blueprint{blueprint}, slot{slot} {
+    blueprint->owners[slot] = this;
+}
+
+AnimModelPose::AnimModelPose(AnimModelPose&& other) noexcept
+    : blueprint{other.blueprint}, slot{other.slot} {
+    other.blueprint = nullptr;
+    if (blueprint) blueprint->owners[slot] = this;
+}
+
+AnimModelPose& AnimModelPose::operator=(AnimModelPose&& other) noexcept {
+    if (this == &other) return *this;
+
+    if (blueprint) blueprint->freePose(slot);
+    blueprint = other.blueprint;
+    slot = other.slot;
+    other.blueprint = nullptr;
+    if (blueprint) blueprint->owners[slot] = this;
+
+    return *this;
+}
+
+AnimModelPose::~AnimModelPose() {
+    if (blueprint) blueprint->freePose(slot);
 }
 
 AnimModelBlueprint::Bounds AnimModelBlueprint::getBounds(
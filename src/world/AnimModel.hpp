@@ -6,6 +6,7 @@
 #include <vector>
 
 #include "../render/Primitives.hpp"
+#include "../render/RenderQueue.hpp"
 #include "Block.hpp"
 
 namespace world {
@@ -22,14 +23,12 @@ public:
         size_t index;
     };
 
+    // Room for the first poses, doubled whenever it runs out
+    static constexpr uint32_t INITIAL_POSES = 64;
+
 private:
     struct Joint {
         JointId parent;
-        render::GeometryMesh mesh;
-
-        Joint() = default;
-        Joint(Joint&&) = default;
-        Joint& operator=(Joint&&) = default;
     };
 
     struct Transform {
@@ -38,11 +37,6 @@ private:
         glm::vec3 globalPos;
         glm::quat globalRot;
 
-        void updateGlobal() {
-            globalPos = localPos;
-            globalRot = localRot;
-        }
-
         void updateGlobal(const Transform& parent) {
             globalPos = parent.globalPos + parent.globalRot * localPos;
             globalRot = parent.globalRot * localRot;
@@ -51,16 +45,42 @@ private:
 
 public:
     AnimModelBlueprint(const std::string& path, VkFormat format);
+    // Poses point back at their blueprint
+    AnimModelBlueprint(const AnimModelBlueprint&) = delete;
+    AnimModelBlueprint& operator=(const AnimModelBlueprint&) = delete;
 
     JointId addJoint(JointId parent, glm::ivec3 center, glm::ivec3 pos,
                      glm::quat rot, glm::ivec3 size, glm::ivec2 topLeft);
+    // Uploads the joints added so far as a single skinned mesh. Call it once,
+    // after the last joint.
+    void build();
 
-    AnimModelPose newPose() const;
+    // Starts at the rest pose. The blueprint has to outlive it.
+    AnimModelPose newPose();
 
-    void addToModelList(std::list<render::GeometryModel>& models,
-                        AnimModelPose& pose);
+    // Evaluates every pose of the blueprint in one go, and draws them all
+    void addToRenderQueue(render::RenderQueue& queue);
 
 private:
+    // Rows of the pose storage, for each joint
+    enum Field {
+        LOCAL_POS_X,
+        LOCAL_POS_Y,
+        LOCAL_POS_Z,
+        LOCAL_ROT_X,
+        LOCAL_ROT_Y,
+        LOCAL_ROT_Z,
+        LOCAL_ROT_W,
+        GLOBAL_POS_X,
+        GLOBAL_POS_Y,
+        GLOBAL_POS_Z,
+        GLOBAL_ROT_X,
+        GLOBAL_ROT_Y,
+        GLOBAL_ROT_Z,
+        GLOBAL_ROT_W,
+        FIELD_COUNT
+    };
+
     struct Bounds {
         glm::vec2 topLeft;
         glm::vec2 bottomRight;
@@ -75,27 +95,68 @@ private:
     glm::vec2 convertTextureIntCoords(glm::ivec2 coords) const;
     float convertWorldIntCoord(int coord) const;
 
+    // Evaluates the globals of the joints, with the root left out: they end
+    // up in model space, the root transform being applied by the instance
+    void updateJoints(std::vector<Transform>& pose) const;
+
+    float* getRow(size_t joint, Field field) {
+        return poses.data() + (joint * FIELD_COUNT + field) * capacity;
+    }
+    void setLocal(uint32_t slot, size_t joint, glm::vec3 pos);
+    void setLocal(uint32_t slot, size_t joint, glm::quat rot);
+    void setGlobal(uint32_t slot, size_t joint, glm::vec3 pos, glm::quat rot);
+    // Moves the last pose into the slot
+    void freePose(uint32_t slot);
+    void growPoses();
+    // Globals of a joint for every pose, from those of its parent
+    void evaluateJoint(size_t joint);
+    void writeJoints(size_t joint, render::JointTransform* palette);
+
     render::Texture texture;
+    render::GeometryMesh mesh;
     std::vector<Joint> joints;
+    // Rest pose
     std::vector<Transform> transforms;
+
+    // Every pose as a structure of arrays: field f of joint j of pose p is
+    // at poses[(j * FIELD_COUNT + f) * capacity + p]. A field of a joint is
+    // contiguous across poses, so the hierarchy is evaluated one joint at a
+    // time for all of them, with loops the compiler vectorises at -O3.
+    std::vector<float> poses;
+    uint32_t poseCount{0};
+    uint32_t capacity{0};
+    // Handle of each pose, kept up to date as they move around
+    std::vector<AnimModelPose*> owners;
+
+    // Filled by addJoint() until build(), each vertex holds its joint index
+    std::vector<uint16_t> indices;
+    std::vector<render::GeometryVertex> vertices;
 };
 
+// Handle to a pose stored in its blueprint. It can be moved but not copied,
+// and gives its slot back when destroyed.
 class AnimModelPose {
     friend class AnimModelBlueprint;
 
 private:
-    AnimModelPose(const std::vector<AnimModelBlueprint::Transform>& transforms)
-        : transforms{transforms} {}
+    AnimModelPose(AnimModelBlueprint* blueprint, uint32_t slot);
 
 public:
-    void setPos(glm::vec3 pos) { transforms[0].localPos = pos; }
-    void setRot(glm::quat rot) { transforms[0].localRot = rot; }
+    AnimModelPose(AnimModelPose&& other) noexcept;
+    AnimModelPose& operator=(AnimModelPose&& other) noexcept;
+    AnimModelPose(const AnimModelPose&) = delete;
+    AnimModelPose& operator=(const AnimModelPose&) = delete;
+    ~AnimModelPose();
+
+    void setPos(glm::vec3 pos) { blueprint->setLocal(slot, 0, pos); }
+    void setRot(glm::quat rot) { blueprint->setLocal(slot, 0, rot); }
     void setJointRot(AnimModelBlueprint::JointId id, glm::quat rot) {
-        transforms[id.index].localRot = rot;
+        blueprint->setLocal(slot, id.index, rot);
     }
 
 private:
-    std::vector<AnimModelBlueprint::Transform> transforms;
+    AnimModelBlueprint* blueprint;
+    uint32_t slot;
 };
 
 }  // namespace world
\ No newline at end of file
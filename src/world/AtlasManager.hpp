@@ -10,6 +10,9 @@ namespace world {
 
 class AtlasManager {
 public:
+    // Size of an atlas tile, in pixels
+    static constexpr int TILE_SIZE = 16;
+
     AtlasManager();
 
     static std::shared_ptr<AtlasManager> create() {
@@ -28,14 +31,20 @@ public:
 
     const render::Texture& getAtlas() const { return atlas; }
 
-    AtlasBounds getAtlasBounds(Block block, Side side) const;
-    float getBlockSpecularStrength(Block block, Side side) const;
+    const AtlasBounds& getAtlasBounds(Block block, Side side) const {
+        return bounds[static_cast<int>(block)][static_cast<int>(side)];
+    }
+    float getBlockSpecularStrength(Block block, Side side) const {
+        return getBlockInfo(block).specularStrength;
+    }
 
 private:
     glm::vec2 convertIntCoords(glm::ivec2 coords) const;
     AtlasBounds computeAtlasBound(glm::ivec2 coords) const;
 
     render::Texture atlas;
+    // UVs of every block side, built from the block table
+    AtlasBounds bounds[BLOCK_COUNT][SIDE_COUNT];
 };
 
 }  // namespace world
\ No newline at end of file
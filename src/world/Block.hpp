@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdint>
 
 enum class Block {
     AIR = 0,
@@ -8,7 +9,8 @@ enum class Block {
     WOOD_LOG,
     LEAF,
     CHERRY_LEAF,
-    DIAMOND
+    DIAMOND,
+    COUNT
 };
 
 enum class Side {
@@ -18,4 +20,61 @@ enum class Side {
     SIDE_X_POS,
     SIDE_X_NEG,
     SIDE_Y_NEG
-};
\ No newline at end of file
+};
+
+static constexpr int BLOCK_COUNT = static_cast<int>(Block::COUNT);
+static constexpr int SIDE_COUNT = 6;
+
+// Position of a tile in the block atlas, in tiles
+struct AtlasTile {
+    uint8_t x;
+    uint8_t y;
+};
+
+struct BlockInfo {
+    // Stops entities and the block picking ray
+    bool solid;
+    // Hides the faces of the neighbouring blocks touching it
+    bool opaque;
+    // Invisible, no faces are generated for it
+    bool transparent;
+    // Indexed by Side
+    AtlasTile tiles[SIDE_COUNT];
+    float specularStrength;
+};
+
+// Full cube with a different texture on top, sides and bottom
+constexpr BlockInfo cubeBlock(AtlasTile top, AtlasTile side, AtlasTile bottom,
+                              float specularStrength = 0.0f) {
+    return {true,
+            true,
+            false,
+            {top, side, side, side, side, bottom},
+            specularStrength};
+}
+
+// Full cube with the same texture on every side
+constexpr BlockInfo cubeBlock(AtlasTile tile, float specularStrength = 0.0f) {
+    return cubeBlock(tile, tile, tile, specularStrength);
+}
+
+// Adding a block only takes a new entry here, in the same order as the enum
+// clang-format off
+static constexpr BlockInfo BLOCKS[BLOCK_COUNT] = {
+    /* AIR         */ {false, false, true, {}, 0.0f},
+    /* GRASS       */ cubeBlock({2, 0}, {1, 0}, {0, 0}),
+    /* DIRT        */ cubeBlock({0, 0}),
+    /* COBBLESTONE */ cubeBlock({0, 1}, 5.0f),
+    /* WOOD_LOG    */ cubeBlock({2, 1}, {3, 0}, {2, 1}),
+    /* LEAF        */ cubeBlock({4, 0}),
+    /* CHERRY_LEAF */ cubeBlock({5, 0}),
+    /* DIAMOND     */ cubeBlock({1, 1}, 5.0f),
+};
+// clang-format on
+
+constexpr const BlockInfo &getBlockInfo(Block block) {
+    return BLOCKS[static_cast<int>(block)];
+}
+
+constexpr bool isSolid(Block block) { return getBlockInfo(block).solid; }
+constexpr bool isOpaque(Block block) { return getBlockInfo(block).opaque; }
@@ -27,6 +27,8 @@ CaprettaBlueprint::CaprettaBlueprint()
 
     head = blueprint.addJoint(body, {2, 2, 3}, {8, 3, 0}, glm::vec3{0, 0, 0},
                               {6, 6, 6}, {8, 12});
+
+    blueprint.build();
 }
 
 Capretta CaprettaBlueprint::fabricate() {
@@ -1,5 +1,7 @@
 #include "Chunk.hpp"
 
+#include <vector>
+
 #include "../render/BufferManager.hpp"
 #include "../render/Constants.hpp"
 #include "AtlasManager.hpp"
@@ -22,6 +24,9 @@ Chunk::~Chunk() {
     if (!mesh.isNull()) {
         BufferManager::get().deallocateMeshDefer(std::move(mesh));
     }
+    if (!pendingMesh.isNull()) {
+        BufferManager::get().deallocateMeshDefer(std::move(pendingMesh));
+    }
 }
 
 Block Chunk::getBlock(glm::ivec3 pos) {
@@ -34,11 +39,15 @@ Block Chunk::getBlock(glm::ivec3 pos) {
 const render::GeometryMesh &Chunk::getMesh() { return mesh; }
 
 render::GeometryModel Chunk::getModel(glm::ivec3 pos) {
-    return GeometryModel{mesh, atlas->getAtlas(), pos * DIM,
+    swapPendingMesh();
+
+    return GeometryModel{&mesh, &atlas->getAtlas(), pos * DIM,
                          glm::vec3(0.0f, 0.0f, 0.0f)};
 }
 
 void Chunk::updateMesh() {
+    updateConnectivity();
+
     std::vector<uint16_t> indices;
     std::vector<GeometryVertex> vertices;
 
@@ -46,13 +55,13 @@ void Chunk::updateMesh() {
         for (int y = 0; y < DIM.y; y++) {
             for (int z = 0; z < DIM.z; z++) {
                 Block block = blocks[x][y][z];
-                if (block == Block::AIR) continue;
+                const BlockInfo &info = getBlockInfo(block);
+                if (info.transparent) continue;
 
-                if (z == 0 || blocks[x][y][z - 1] == Block::AIR) {
+                if (z == 0 || !isOpaque(blocks[x][y][z - 1])) {
                     auto bounds =
                         atlas->getAtlasBounds(block, Side::SIDE_Z_NEG);
-                    float spec = atlas->getBlockSpecularStrength(
-                        block, Side::SIDE_Z_NEG);
+                    float spec = info.specularStrength;
                     indices.push_back(vertices.size());
                     indices.push_back(vertices.size() + 1);
                     indices.push_back(vertices.size() + 2);
@@ -76,11 +85,10 @@ void Chunk::updateMesh() {
                                         bounds.getTopLeft(),
                                         spec});
                 }
-                if (z == 15 || blocks[x][y][z + 1] == Block::AIR) {
+                if (z == 15 || !isOpaque(blocks[x][y][z + 1])) {
                     auto bounds =
                         atlas->getAtlasBounds(block, Side::SIDE_Z_POS);
-                    float spec = atlas->getBlockSpecularStrength(
-                        block, Side::SIDE_Z_POS);
+                    float spec = info.specularStrength;
                     indices.push_back(vertices.size());
                     indices.push_back(vertices.size() + 1);
                     indices.push_back(vertices.size() + 2);
@@ -105,11 +113,10 @@ void Chunk::updateMesh() {
                                         spec});
                 }
 
-                if (y == 0 || blocks[x][y - 1][z] == Block::AIR) {
+                if (y == 0 || !isOpaque(blocks[x][y - 1][z])) {
                     auto bounds =
                         atlas->getAtlasBounds(block, Side::SIDE_Y_NEG);
-                    float spec = atlas->getBlockSpecularStrength(
-                        block, Side::SIDE_Y_NEG);
+                    float spec = info.specularStrength;
                     indices.push_back(vertices.size());
                     indices.push_back(vertices.size() + 1);
                     indices.push_back(vertices.size() + 2);
@@ -134,11 +141,10 @@ void Chunk::updateMesh() {
                                         spec});
                 }
 
-                if (y == 15 || blocks[x][y + 1][z] == Block::AIR) {
-                    auto bounds = atlas->getAtlasBounds(blocks[x][y][z],
-                                                        Side::SIDE_Y_POS);
-                    float spec = atlas->getBlockSpecularStrength(
-                        block, Side::SIDE_Y_POS);
+                if (y == 15 || !isOpaque(blocks[x][y + 1][z])) {
+                    auto bounds =
+                        atlas->getAtlasBounds(block, Side::SIDE_Y_POS);
+                    float spec = info.specularStrength;
                     indices.push_back(vertices.size());
                     indices.push_back(vertices.size() + 1);
                     indices.push_back(vertices.size() + 2);
@@ -163,11 +169,10 @@ void Chunk::updateMesh() {
                                         spec});
                 }
 
-                if (x == 0 || blocks[x - 1][y][z] == Block::AIR) {
-                    auto bounds = atlas->getAtlasBounds(blocks[x][y][z],
-                                                        Side::SIDE_X_NEG);
-                    float spec = atlas->getBlockSpecularStrength(
-                        block, Side::SIDE_X_NEG);
+                if (x == 0 || !isOpaque(blocks[x - 1][y][z])) {
+                    auto bounds =
+                        atlas->getAtlasBounds(block, Side::SIDE_X_NEG);
+                    float spec = info.specularStrength;
                     indices.push_back(vertices.size());
                     indices.push_back(vertices.size() + 1);
                     indices.push_back(vertices.size() + 2);
@@ -192,11 +197,10 @@ void Chunk::updateMesh() {
                                         spec});
                 }
 
-                if (x == 15 || blocks[x + 1][y][z] == Block::AIR) {
-                    auto bounds = atlas->getAtlasBounds(blocks[x][y][z],
-                                                        Side::SIDE_X_POS);
-                    float spec = atlas->getBlockSpecularStrength(
-                        block, Side::SIDE_X_POS);
+                if (x == 15 || !isOpaque(blocks[x + 1][y][z])) {
+                    auto bounds =
+                        atlas->getAtlasBounds(block, Side::SIDE_X_POS);
+                    float spec = info.specularStrength;
                     indices.push_back(vertices.size());
                     indices.push_back(vertices.size() + 1);
                     indices.push_back(vertices.size() + 2);
@@ -224,111 +228,93 @@ void Chunk::updateMesh() {
         }
     }
 
-    if (!mesh.isNull()) {
-        BufferManager::get().deallocateMeshDefer(std::move(mesh));
+    // A newer mesh makes the pending one useless
+    if (!pendingMesh.isNull()) {
+        BufferManager::get().deallocateMeshDefer(std::move(pendingMesh));
+        pendingMesh = GeometryMesh{};
     }
 
     if (indices.size() > 0 || vertices.size() > 0) {
-        mesh =
-            BufferManager::get().allocateMesh<GeometryMesh>(indices, vertices);
-    } else {
+        pendingMesh = BufferManager::get().allocateHeapMesh(indices, vertices);
+    } else if (!mesh.isNull()) {
+        BufferManager::get().deallocateMeshDefer(std::move(mesh));
         mesh = GeometryMesh{};
     }
 }
 
-float noiseOctave(int worldX, int worldZ) {
-    int octaves = 4;                  // Number of octaves
-    float persistence = 0.7f;         // Controls amplitude reduction per octave
-    float lacunarity = 1.5f;          // Controls frequency increase per octave
-    float frequency = 1.0f / 100.0f;  // Base scale
-    float amplitude = 1.0f;
-    float total = 0.0f;
-    float maxValue = 0.0f;
-
-    for (int i = 0; i < octaves; i++) {
-        total +=
-            glm::simplex(glm::vec2(worldX, worldZ) * frequency) * amplitude;
-        maxValue += amplitude;
-
-        amplitude *= persistence;  // Reduce amplitude each octave
-        frequency *= lacunarity;   // Increase frequency each octave
-    }
+void Chunk::swapPendingMesh() {
+    if (pendingMesh.isNull() || !BufferManager::get().isUploaded(pendingMesh))
+        return;
 
-    // Normalize noise value to [-1, 1]
-    float noiseValue = total / maxValue;
-    return noiseValue;
+    if (!mesh.isNull()) {
+        BufferManager::get().deallocateMeshDefer(std::move(mesh));
+    }
+    mesh = std::move(pendingMesh);
+    pendingMesh = GeometryMesh{};
 }
 
-void Chunk::genTree(glm::ivec3 pos, Chunk &chunk) {
-    int x = pos.x;
-    int y = pos.y;
-    int z = pos.z;
+void Chunk::updateConnectivity() {
+    connectivity = 0;
 
-    if (chunk.blocks[x + 1][y][z] == Block::WOOD_LOG ||
-        chunk.blocks[x][y][z + 1] == Block::WOOD_LOG ||
-        chunk.blocks[x][y][z - 1] == Block::WOOD_LOG ||
-        chunk.blocks[x - 1][y][z] == Block::WOOD_LOG ||
-        chunk.blocks[x - 1][y][z - 1] == Block::WOOD_LOG ||
-        chunk.blocks[x + 1][y][z + 1] == Block::WOOD_LOG ||
-        chunk.blocks[x + 1][y][z - 1] == Block::WOOD_LOG ||
-        chunk.blocks[x - 1][y][z + 1] == Block::WOOD_LOG) {
-        chunk.blocks[x][y][z] = Block::AIR;
-        return;
-    }
+    bool visited[DIM.x][DIM.y][DIM.z] = {};
+    std::vector<glm::ivec3> stack;
 
-    for (int i = 0; i < 5; i++) {
-        chunk.blocks[x][y + i][z] = Block::WOOD_LOG;
-    }
-    y = y + 4;
+    // Flood fill every pocket of non-opaque blocks, all the faces touched by
+    // the same pocket can see each other
+    for (int x = 0; x < DIM.x; x++) {
+        for (int y = 0; y < DIM.y; y++) {
+            for (int z = 0; z < DIM.z; z++) {
+                if (visited[x][y][z] || isOpaque(blocks[x][y][z])) continue;
 
-    for (int k = 0; k < 2; k++) {
-        for (int i = -1; i < 2; i++) {
-            for (int j = -1; j < 2; j++) {
-                chunk.blocks[x + i][y + k][z + j] = Block::LEAF;
-            }
-        }
-    }
-    chunk.blocks[x][y + 2][z] = Block::LEAF;
-}
+                uint32_t faces = 0;
+                visited[x][y][z] = true;
+                stack.push_back({x, y, z});
 
-float whiteNoise(int worldX, int worldZ) {
-    uint32_t hash = std::hash<int>{}(worldX) ^ std::hash<int>{}(worldZ);
-    return static_cast<float>(hash) / static_cast<float>(UINT32_MAX);
-}
+                while (!stack.empty()) {
+                    glm::ivec3 p = stack.back();
+                    stack.pop_back();
 
-Chunk Chunk::genChunk(std::shared_ptr<AtlasManager> atlas, glm::ivec3 pos) {
-    Chunk chunk{atlas};
+                    if (p.y == DIM.y - 1) faces |= 1 << (int)Side::SIDE_Y_POS;
+                    if (p.z == DIM.z - 1) faces |= 1 << (int)Side::SIDE_Z_POS;
+                    if (p.z == 0) faces |= 1 << (int)Side::SIDE_Z_NEG;
+                    if (p.x == DIM.x - 1) faces |= 1 << (int)Side::SIDE_X_POS;
+                    if (p.x == 0) faces |= 1 << (int)Side::SIDE_X_NEG;
+                    if (p.y == 0) faces |= 1 << (int)Side::SIDE_Y_NEG;
 
-    for (int x = 0; x < DIM.x; x++) {
-        for (int z = 0; z < DIM.z; z++) {
-            int worldX = pos.x * DIM.x + x;
-            int worldZ = pos.z * DIM.z + z;
-            // creates a noise value between -1 and 1 based on the global
-            // coordinates of the block
-            float noiseValue = noiseOctave(worldX, worldZ);
-            float treeNoise = glm::simplex(glm::vec2(worldX, worldZ) / 50.0f);
-            float treeProbability = whiteNoise(worldX, worldZ);
-            // maps the value in a range from 0 to 4*DIM.y
-            int height = static_cast<int>((noiseValue + 1.0f) * 2 * DIM.y);
-
-            for (int y = 0; y < DIM.y; y++) {
-                int worldY = pos.y * DIM.y + y;
-                if (worldY < height && worldY > 2 * DIM.y) {
-                    chunk.blocks[x][y][z] = Block::COBBLESTONE;
-                } else if (worldY < (height - 1)) {
-                    chunk.blocks[x][y][z] = Block::DIRT;
-                } else if (worldY == (height - 1)) {
-                    chunk.blocks[x][y][z] = Block::GRASS;
-                    if (treeNoise > treeProbability && treeNoise > 0.4f &&
-                        y < (DIM.y - 8) && x < (DIM.x - 1) && x > 1 &&
-                        z < (DIM.z - 1) && z > 1) {
-                        genTree({x, y + 1, z}, chunk);
+                    static constexpr glm::ivec3 NEIGHBOURS[] = {
+                        {1, 0, 0},  {-1, 0, 0}, {0, 1, 0},
+                        {0, -1, 0}, {0, 0, 1},  {0, 0, -1}};
+                    for (auto offset : NEIGHBOURS) {
+                        glm::ivec3 n = p + offset;
+                        if (n.x < 0 || n.y < 0 || n.z < 0 || n.x >= DIM.x ||
+                            n.y >= DIM.y || n.z >= DIM.z)
+                            continue;
+                        if (visited[n.x][n.y][n.z] ||
+                            isOpaque(blocks[n.x][n.y][n.z]))
+                            continue;
+
+                        visited[n.x][n.y][n.z] = true;
+                        stack.push_back(n);
+                    }
+                }
+
+                for (int from = 0; from < SIDE_COUNT; from++) {
+                    if (!(faces & (1 << from))) continue;
+                    for (int to = 0; to < SIDE_COUNT; to++) {
+                        if (faces & (1 << to))
+                            connectivity |= uint64_t{1}
+                                            << (from * SIDE_COUNT + to);
                     }
                 }
             }
         }
     }
+}
 
+Chunk Chunk::genChunk(std::shared_ptr<AtlasManager> atlas,
+                      const TerrainGenerator &generator, glm::ivec3 pos) {
+    Chunk chunk{atlas};
+    generator.generate(pos, chunk.blocks);
     chunk.updateMesh();
     return chunk;
 }
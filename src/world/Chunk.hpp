@@ -1,26 +1,35 @@
 #pragma once
-#include <glm/gtc/noise.hpp>
+#include <cstdint>
 #include <glm/vec3.hpp>
 #include <memory>
 
 #include "../render/Primitives.hpp"
 #include "AtlasManager.hpp"
 #include "Block.hpp"
+#include "TerrainGenerator.hpp"
 
 namespace world {
 
 class Chunk {
 public:
-    static constexpr glm::ivec3 DIM = glm::ivec3(16, 16, 16);
+    static constexpr glm::ivec3 DIM = TerrainGenerator::DIM;
 
 private:
-    Block blocks[DIM.x][DIM.y][DIM.z];
+    TerrainGenerator::Blocks blocks;
     render::GeometryMesh mesh;
+    // Replaces mesh once its upload is done, so that remeshing never leaves
+    // a hole for a frame
+    render::GeometryMesh pendingMesh;
 
     std::shared_ptr<AtlasManager> atlas;
 
+    // Bit (from * SIDE_COUNT + to) is set if the two faces are linked by
+    // non-opaque blocks
+    uint64_t connectivity{0};
+
     void updateMesh();
-    static void genTree(glm::ivec3 pos, Chunk &chunk);
+    void updateConnectivity();
+    void swapPendingMesh();
 
 public:
     Chunk(std::shared_ptr<AtlasManager> atlas);
@@ -29,13 +38,20 @@ public:
     Chunk(Chunk &&) = default;
     Chunk &operator=(Chunk &&) = default;
 
-    static Chunk genChunk(std::shared_ptr<AtlasManager> atlas, glm::ivec3 pos);
+    static Chunk genChunk(std::shared_ptr<AtlasManager> atlas,
+                          const TerrainGenerator &generator, glm::ivec3 pos);
 
     Block getBlock(glm::ivec3 pos);
     void updateBlock(glm::ivec3 pos, Block newBlock);
 
     const render::GeometryMesh &getMesh();
     render::GeometryModel getModel(glm::ivec3 pos);
+
+    // Whether something entering from a face can leave through the other
+    bool canSeeThrough(Side from, Side to) const {
+        int bit = static_cast<int>(from) * SIDE_COUNT + static_cast<int>(to);
+        return (connectivity >> bit) & 1;
+    }
 };
 
 }  // namespace world
\ No newline at end of file
@@ -0,0 +1,72 @@
+#include "ClimateMap.hpp"
+
+#include <glm/gtc/noise.hpp>
+
+using namespace world;
+
+// Division towards "bottom"
+static int floorDiv(int value, int div) {
+    return value >= 0 ? (value / div) : ((value - div + 1) / div);
+}
+
+Biome Climate::getBiome() const {
+    if (temperature < -0.4f) return Biome::BARREN;
+    if (temperature > 0.3f && humidity > 0.0f) return Biome::CHERRY_GROVE;
+    if (humidity > 0.2f) return Biome::FOREST;
+    return Biome::PLAINS;
+}
+
+ClimateMap::Region::Region(glm::ivec2 origin) : origin{origin} {
+    for (int x = 0; x < SAMPLES; x++) {
+        for (int z = 0; z < SAMPLES; z++) {
+            glm::vec2 pos = glm::vec2(origin + glm::ivec2{x, z} * STEP);
+            // Offset the humidity so the two maps are not correlated
+            samples[x][z] = Climate{
+                glm::simplex(pos / TEMPERATURE_SCALE),
+                glm::simplex(pos / HUMIDITY_SCALE + glm::vec2{100.0f, 100.0f})};
+        }
+    }
+}
+
+Climate ClimateMap::Region::get(int worldX, int worldZ) const {
+    int x = worldX - origin.x;
+    int z = worldZ - origin.y;
+
+    int cx = x / STEP;
+    int cz = z / STEP;
+    float tx = static_cast<float>(x - cx * STEP) / STEP;
+    float tz = static_cast<float>(z - cz * STEP) / STEP;
+
+    auto lerp = [&](float Climate::*field) {
+        float c0 = samples[cx][cz].*field +
+                   (samples[cx + 1][cz].*field - samples[cx][cz].*field) * tx;
+        float c1 =
+            samples[cx][cz + 1].*field +
+            (samples[cx + 1][cz + 1].*field - samples[cx][cz + 1].*field) * tx;
+        return c0 + (c1 - c0) * tz;
+    };
+
+    return Climate{lerp(&Climate::temperature), lerp(&Climate::humidity)};
+}
+
+std::shared_ptr<const ClimateMap::Region> ClimateMap::getRegion(
+    int worldX, int worldZ) const {
+    glm::ivec2 regionPos{floorDiv(worldX, REGION_SIZE),
+                         floorDiv(worldZ, REGION_SIZE)};
+    uint64_t key = (static_cast<uint64_t>(static_cast<uint32_t>(regionPos.x))
+                    << 32) |
+                   static_cast<uint32_t>(regionPos.y);
+
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        auto it = regions.find(key);
+        if (it != regions.end()) return it->second;
+    }
+
+    // Generated outside the lock, two threads may race to build the same
+    // region but they will produce identical data
+    auto region = std::make_shared<const Region>(regionPos * REGION_SIZE);
+
+    std::lock_guard<std::mutex> lock{mutex};
+    return regions.insert({key, region}).first->second;
+}
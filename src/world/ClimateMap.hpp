@@ -0,0 +1,77 @@
+#pragma once
+#include <cstdint>
+#include <glm/vec2.hpp>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "Block.hpp"
+
+namespace world {
+
+enum class Biome { PLAINS = 0, FOREST, CHERRY_GROVE, BARREN, COUNT };
+
+struct BiomeInfo {
+    Block surface;
+    Block leaves;
+    // Tree noise has to be above this for a tree to spawn, > 1 means never
+    float treeThreshold;
+};
+
+// clang-format off
+static constexpr BiomeInfo BIOMES[static_cast<int>(Biome::COUNT)] = {
+    /* PLAINS       */ {Block::GRASS, Block::LEAF,        0.4f},
+    /* FOREST       */ {Block::GRASS, Block::LEAF,        0.1f},
+    /* CHERRY_GROVE */ {Block::GRASS, Block::CHERRY_LEAF, 0.2f},
+    /* BARREN       */ {Block::DIRT,  Block::LEAF,        2.0f},
+};
+// clang-format on
+
+inline const BiomeInfo &getBiomeInfo(Biome biome) {
+    return BIOMES[static_cast<int>(biome)];
+}
+
+// Both in [-1, 1]
+struct Climate {
+    float temperature;
+    float humidity;
+
+    Biome getBiome() const;
+};
+
+// Climate sampled every STEP blocks and cached per region. Sampling a column
+// only costs a bilinear interpolation, the noise is evaluated once per
+// lattice point.
+class ClimateMap {
+public:
+    static constexpr int REGION_SIZE = 256;
+    static constexpr int STEP = 16;
+    static constexpr int SAMPLES = REGION_SIZE / STEP + 1;
+
+    static constexpr float TEMPERATURE_SCALE = 512.0f;
+    static constexpr float HUMIDITY_SCALE = 384.0f;
+
+    static_assert(REGION_SIZE % STEP == 0, "STEP must divide REGION_SIZE");
+
+    class Region {
+    public:
+        Region(glm::ivec2 origin);
+
+        // World coordinates, the column must lie inside the region
+        Climate get(int worldX, int worldZ) const;
+
+    private:
+        glm::ivec2 origin;
+        // Edges included, so no neighbour region is needed to interpolate
+        Climate samples[SAMPLES][SAMPLES];
+    };
+
+    // Region containing the column, generated on first use. Thread safe.
+    std::shared_ptr<const Region> getRegion(int worldX, int worldZ) const;
+
+private:
+    mutable std::mutex mutex;
+    mutable std::unordered_map<uint64_t, std::shared_ptr<const Region>> regions;
+};
+
+}  // namespace world
@@ -0,0 +1,31 @@
+#include "DensityField.hpp"
+
+#include <algorithm>
+
+using namespace world;
+
+float DensityField::get(int x, int y, int z) const {
+    // Pick the lattice cell, the last sample row belongs to the cell before it
+    int cx = std::min(x / STEP, SAMPLES - 2);
+    int cy = std::min(y / STEP, SAMPLES - 2);
+    int cz = std::min(z / STEP, SAMPLES - 2);
+
+    float tx = static_cast<float>(x - cx * STEP) / STEP;
+    float ty = static_cast<float>(y - cy * STEP) / STEP;
+    float tz = static_cast<float>(z - cz * STEP) / STEP;
+
+    float c00 = samples[cx][cy][cz] +
+                (samples[cx + 1][cy][cz] - samples[cx][cy][cz]) * tx;
+    float c01 = samples[cx][cy][cz + 1] +
+                (samples[cx + 1][cy][cz + 1] - samples[cx][cy][cz + 1]) * tx;
+    float c10 = samples[cx][cy + 1][cz] +
+                (samples[cx + 1][cy + 1][cz] - samples[cx][cy + 1][cz]) * tx;
+    float c11 =
+        samples[cx][cy + 1][cz + 1] +
+        (samples[cx + 1][cy + 1][cz + 1] - samples[cx][cy + 1][cz + 1]) * tx;
+
+    float c0 = c00 + (c10 - c00) * ty;
+    float c1 = c01 + (c11 - c01) * ty;
+
+    return c0 + (c1 - c0) * tz;
+}
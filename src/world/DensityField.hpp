@@ -0,0 +1,39 @@
+#pragma once
+#include <glm/vec3.hpp>
+
+namespace world {
+
+// Scalar field over a chunk, sampled on a coarse lattice (one sample every
+// STEP voxels, edges included) and trilinearly interpolated in between.
+class DensityField {
+public:
+    static constexpr int SIZE = 16;
+    static constexpr int STEP = 4;
+    static constexpr int SAMPLES = SIZE / STEP + 1;
+
+    static_assert(SIZE % STEP == 0, "STEP must divide SIZE");
+
+    template <typename F>
+    DensityField(glm::ivec3 origin, const F &f);
+
+    // Valid for every coordinate in [0, SIZE], so the voxel just past the
+    // chunk border can be queried too.
+    float get(int x, int y, int z) const;
+
+private:
+    float samples[SAMPLES][SAMPLES][SAMPLES];
+};
+
+template <typename F>
+DensityField::DensityField(glm::ivec3 origin, const F &f) {
+    for (int x = 0; x < SAMPLES; x++) {
+        for (int y = 0; y < SAMPLES; y++) {
+            for (int z = 0; z < SAMPLES; z++) {
+                samples[x][y][z] =
+                    f(origin + glm::ivec3{x * STEP, y * STEP, z * STEP});
+            }
+        }
+    }
+}
+
+}  // namespace world
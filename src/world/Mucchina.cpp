@@ -26,6 +26,8 @@ MucchinaBlueprint::MucchinaBlueprint()
                                        glm::vec3{0, 0, 0}, {5, 9, 4}, {0, 22});
     head = blueprint.addJoint(body, {2, 2, 4}, {11, 4, 0}, glm::vec3{0, 0, 0},
                               {8, 8, 8}, {18, 22});
+
+    blueprint.build();
 }
 
 Mucchina MucchinaBlueprint::fabricate() {
@@ -23,6 +23,11 @@ public:
 
     Mucchina fabricate();
 
+    // Draws every mucchina at once
+    void addToRenderQueue(render::RenderQueue& queue) {
+        blueprint.addToRenderQueue(queue);
+    }
+
 private:
     AnimModelBlueprint blueprint;
     AnimModelBlueprint::JointId body;
@@ -50,10 +55,6 @@ public:
     glm::vec3 getPos() const { return collider.getPos(); }
     glm::vec3 getSpeed() const { return collider.getSpeed(); }
 
-    void addToModelList(std::list<render::GeometryModel>& models) {
-        blueprint->blueprint.addToModelList(models, pose);
-    }
-
 private:
     Mucchina(std::shared_ptr<MucchinaBlueprint> blueprint,
              AnimModelPose&& pose);
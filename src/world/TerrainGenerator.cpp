@@ -0,0 +1,193 @@
+#include "TerrainGenerator.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <glm/gtc/noise.hpp>
+#include <utility>
+#include <vector>
+
+#include "DensityField.hpp"
+
+using namespace world;
+
+using Clock = std::chrono::steady_clock;
+
+static double elapsed(Clock::time_point &last) {
+    auto now = Clock::now();
+    double seconds = std::chrono::duration<double>(now - last).count();
+    last = now;
+    return seconds;
+}
+
+static float noiseOctave(int worldX, int worldZ) {
+    int octaves = 4;                  // Number of octaves
+    float persistence = 0.7f;         // Controls amplitude reduction per octave
+    float lacunarity = 1.5f;          // Controls frequency increase per octave
+    float frequency = 1.0f / 100.0f;  // Base scale
+    float amplitude = 1.0f;
+    float total = 0.0f;
+    float maxValue = 0.0f;
+
+    for (int i = 0; i < octaves; i++) {
+        total +=
+            glm::simplex(glm::vec2(worldX, worldZ) * frequency) * amplitude;
+        maxValue += amplitude;
+
+        amplitude *= persistence;  // Reduce amplitude each octave
+        frequency *= lacunarity;   // Increase frequency each octave
+    }
+
+    // Normalize noise value to [-1, 1]
+    float noiseValue = total / maxValue;
+    return noiseValue;
+}
+
+static float whiteNoise(int worldX, int worldZ) {
+    uint32_t hash = std::hash<int>{}(worldX) ^ std::hash<int>{}(worldZ);
+    return static_cast<float>(hash) / static_cast<float>(UINT32_MAX);
+}
+
+void TerrainGenerator::generate(glm::ivec3 pos, Blocks &blocks,
+                                Timings *timings) const {
+    static_assert(DIM.x == DensityField::SIZE && DIM.y == DensityField::SIZE &&
+                      DIM.z == DensityField::SIZE,
+                  "density fields must cover exactly one chunk");
+
+    Timings local;
+    auto last = Clock::now();
+
+    glm::ivec3 origin = pos * DIM;
+
+    // Chunks never straddle regions
+    static_assert(ClimateMap::REGION_SIZE % DIM.x == 0 &&
+                      ClimateMap::REGION_SIZE % DIM.z == 0,
+                  "regions must be made of whole chunks");
+    auto region = climate.getRegion(origin.x, origin.z);
+
+    Biome biomes[DIM.x][DIM.z];
+    for (int x = 0; x < DIM.x; x++) {
+        for (int z = 0; z < DIM.z; z++) {
+            biomes[x][z] = region->get(origin.x + x, origin.z + z).getBiome();
+        }
+    }
+    local.climate = elapsed(last);
+
+    int heights[DIM.x][DIM.z];
+    bool treeCandidates[DIM.x][DIM.z];
+
+    for (int x = 0; x < DIM.x; x++) {
+        for (int z = 0; z < DIM.z; z++) {
+            int worldX = origin.x + x;
+            int worldZ = origin.z + z;
+            // creates a noise value between -1 and 1 based on the global
+            // coordinates of the block
+            float noiseValue = noiseOctave(worldX, worldZ);
+            float treeNoise = glm::simplex(glm::vec2(worldX, worldZ) / 50.0f);
+            float treeProbability = whiteNoise(worldX, worldZ);
+            // maps the value in a range from 0 to 4*DIM.y
+            heights[x][z] = static_cast<int>((noiseValue + 1.0f) * 2 * DIM.y);
+            treeCandidates[x][z] =
+                treeNoise > treeProbability &&
+                treeNoise > getBiomeInfo(biomes[x][z]).treeThreshold;
+        }
+    }
+    local.heightmap = elapsed(last);
+
+    // 3D noise is only evaluated on the coarse lattice of the fields, this
+    // keeps caves and overhangs cheap compared to the 2D heightmap
+    DensityField overhangs{origin, [](glm::ivec3 worldPos) {
+                               return glm::simplex(glm::vec3(worldPos) /
+                                                   OVERHANG_SCALE);
+                           }};
+    DensityField caves{origin, [](glm::ivec3 worldPos) {
+                           return glm::simplex(glm::vec3(worldPos) /
+                                               CAVE_SCALE);
+                       }};
+    local.density = elapsed(last);
+
+    std::vector<std::pair<glm::ivec3, Block>> trees;
+
+    for (int x = 0; x < DIM.x; x++) {
+        for (int z = 0; z < DIM.z; z++) {
+            int height = heights[x][z];
+            const BiomeInfo &biome = getBiomeInfo(biomes[x][z]);
+
+            // One extra voxel on top, to know what lies above the chunk
+            bool solid[DIM.y + 1];
+            for (int y = 0; y <= DIM.y; y++) {
+                int worldY = origin.y + y;
+
+                // Positive below the heightmap, perturbed by the 3D noise
+                float density = static_cast<float>(height - worldY) /
+                                    SURFACE_SOFTNESS +
+                                overhangs.get(x, y, z) * OVERHANG_STRENGTH;
+                bool cave = worldY > CAVE_FLOOR &&
+                            std::abs(caves.get(x, y, z)) < CAVE_WIDTH;
+
+                solid[y] = density > 0.0f && !cave;
+            }
+
+            for (int y = 0; y < DIM.y; y++) {
+                int worldY = origin.y + y;
+                if (!solid[y]) {
+                    blocks[x][y][z] = Block::AIR;
+                } else if (worldY > 2 * DIM.y) {
+                    blocks[x][y][z] = Block::COBBLESTONE;
+                } else if (solid[y + 1]) {
+                    blocks[x][y][z] = Block::DIRT;
+                } else {
+                    blocks[x][y][z] = biome.surface;
+                    if (treeCandidates[x][z] && y < (DIM.y - 8) &&
+                        x < (DIM.x - 1) && x > 1 && z < (DIM.z - 1) && z > 1 &&
+                        std::none_of(solid + y + 1, solid + y + 8,
+                                     [](bool s) { return s; })) {
+                        trees.push_back({{x, y + 1, z}, biome.leaves});
+                    }
+                }
+            }
+        }
+    }
+    local.fill = elapsed(last);
+
+    // Trees go in last, so the terrain pass does not carve them out
+    for (auto [treePos, leaves] : trees) genTree(treePos, leaves, blocks);
+    local.decorate = elapsed(last);
+
+    if (timings) *timings += local;
+}
+
+void TerrainGenerator::genTree(glm::ivec3 pos, Block leaves,
+                               Blocks &blocks) {
+    int x = pos.x;
+    int y = pos.y;
+    int z = pos.z;
+
+    if (blocks[x + 1][y][z] == Block::WOOD_LOG ||
+        blocks[x][y][z + 1] == Block::WOOD_LOG ||
+        blocks[x][y][z - 1] == Block::WOOD_LOG ||
+        blocks[x - 1][y][z] == Block::WOOD_LOG ||
+        blocks[x - 1][y][z - 1] == Block::WOOD_LOG ||
+        blocks[x + 1][y][z + 1] == Block::WOOD_LOG ||
+        blocks[x + 1][y][z - 1] == Block::WOOD_LOG ||
+        blocks[x - 1][y][z + 1] == Block::WOOD_LOG) {
+        blocks[x][y][z] = Block::AIR;
+        return;
+    }
+
+    for (int i = 0; i < 5; i++) {
+        blocks[x][y + i][z] = Block::WOOD_LOG;
+    }
+    y = y + 4;
+
+    for (int k = 0; k < 2; k++) {
+        for (int i = -1; i < 2; i++) {
+            for (int j = -1; j < 2; j++) {
+                blocks[x + i][y + k][z + j] = leaves;
+            }
+        }
+    }
+    blocks[x][y + 2][z] = leaves;
+}
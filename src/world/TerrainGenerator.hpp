@@ -0,0 +1,60 @@
+#pragma once
+#include <glm/vec3.hpp>
+#include <memory>
+
+#include "Block.hpp"
+#include "ClimateMap.hpp"
+
+namespace world {
+
+// Fills chunks with blocks. Kept free of any rendering dependency so that it
+// can be used headless (see the pregen tool).
+class TerrainGenerator {
+public:
+    static constexpr glm::ivec3 DIM = glm::ivec3(16, 16, 16);
+    // World height, in chunks
+    static constexpr int HEIGHT = 4;
+
+    // Terrain shape parameters
+    static constexpr float SURFACE_SOFTNESS = 8.0f;
+    static constexpr float OVERHANG_SCALE = 32.0f;
+    static constexpr float OVERHANG_STRENGTH = 0.5f;
+    static constexpr float CAVE_SCALE = 24.0f;
+    static constexpr float CAVE_WIDTH = 0.08f;
+    static constexpr int CAVE_FLOOR = 2;
+
+    using Blocks = Block[DIM.x][DIM.y][DIM.z];
+
+    // Time spent in each generation stage, in seconds
+    struct Timings {
+        double climate{0.0};
+        double heightmap{0.0};
+        double density{0.0};
+        double fill{0.0};
+        double decorate{0.0};
+
+        Timings &operator+=(const Timings &other) {
+            climate += other.climate;
+            heightmap += other.heightmap;
+            density += other.density;
+            fill += other.fill;
+            decorate += other.decorate;
+            return *this;
+        }
+    };
+
+    static std::shared_ptr<TerrainGenerator> create() {
+        return std::make_shared<TerrainGenerator>();
+    }
+
+    // Thread safe, multiple chunks can be generated concurrently
+    void generate(glm::ivec3 pos, Blocks &blocks,
+                  Timings *timings = nullptr) const;
+
+private:
+    static void genTree(glm::ivec3 pos, Block leaves, Blocks &blocks);
+
+    ClimateMap climate;
+};
+
+}  // namespace world
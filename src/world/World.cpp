@@ -1,23 +1,206 @@
 #include "World.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <glm/gtc/constants.hpp>
+
 #include "AtlasManager.hpp"
 
 using namespace world;
 using namespace render;
 
-World::World(std::shared_ptr<AtlasManager> atlas) : atlas{atlas} {}
+World::World(std::shared_ptr<AtlasManager> atlas)
+    : atlas{atlas}, generator{TerrainGenerator::create()} {}
 
 Chunk& World::getChunk(glm::ivec3 pos) {
     // Get an existing chunk or create a new one
     auto it = chunks.find(pos);
     if (it == chunks.end()) {
-        it = chunks.insert({pos, Chunk::genChunk(atlas, pos)}).first;
+        it = chunks.insert({pos, Chunk::genChunk(atlas, *generator, pos)})
+                 .first;
         return it->second;
     } else {
         return it->second;
     }
 }
 
+// Distance of p from the segment going from a to b
+static float distanceToSegment(glm::vec3 p, glm::vec3 a, glm::vec3 b) {
+    glm::vec3 ab = b - a;
+    float len2 = glm::dot(ab, ab);
+    float t = len2 > 0.0f ? glm::clamp(glm::dot(p - a, ab) / len2, 0.0f, 1.0f)
+                          : 0.0f;
+    return glm::length(p - (a + ab * t));
+}
+
+void World::updateLoadQueue(const Camera& camera, glm::vec3 velocity) {
+    loadQueue.clear();
+
+    // Everything below is in chunk units
+    glm::vec3 chunkSize{Chunk::DIM};
+    glm::vec3 pos = camera.pos / chunkSize;
+    // Columns span the whole world height, vertical motion is irrelevant
+    velocity.y = 0.0f;
+    glm::vec3 predicted = pos + velocity * PREFETCH_SECONDS / chunkSize;
+
+    glm::ivec3 posChunk{glm::floor(pos)};
+    glm::ivec3 predictedChunk{glm::floor(predicted)};
+
+    // Cone around the view direction, wide enough to contain the frustum
+    // with the horizontal FOV of a wide window
+    glm::vec3 viewDir = camera.computeViewDir();
+    float halfAngle = std::min(glm::radians(camera.fov), glm::half_pi<float>());
+    float cosA = std::cos(halfAngle);
+    float sinA = std::sin(halfAngle);
+    // Radius of the sphere enclosing a chunk
+    float chunkRadius = std::sqrt(3.0f) / 2.0f;
+
+    glm::ivec3 from = glm::min(posChunk, predictedChunk) - LOAD_RADIUS;
+    glm::ivec3 to = glm::max(posChunk, predictedChunk) + LOAD_RADIUS;
+
+    for (int x = from.x; x <= to.x; x++) {
+        for (int z = from.z; z <= to.z; z++) {
+            bool nearPlayer = std::abs(x - posChunk.x) <= LOAD_RADIUS &&
+                              std::abs(z - posChunk.z) <= LOAD_RADIUS;
+            bool nearPrediction =
+                std::abs(x - predictedChunk.x) <= LOAD_RADIUS &&
+                std::abs(z - predictedChunk.z) <= LOAD_RADIUS;
+            if (!nearPlayer && !nearPrediction) continue;
+
+            for (int y = 0; y < HEIGHT; y++) {
+                glm::ivec3 chunkPos{x, y, z};
+                if (chunks.find(chunkPos) != chunks.end()) continue;
+
+                glm::vec3 center = glm::vec3{chunkPos} + 0.5f;
+                glm::vec3 toCenter = center - pos;
+
+                // Chunks along the predicted path are treated almost as if
+                // they were next to the player
+                float distance = glm::length(toCenter);
+                float pathDistance =
+                    distanceToSegment(center, pos, predicted) +
+                    PREFETCH_PENALTY;
+                float priority = std::min(distance, pathDistance);
+
+                // Signed distance of the chunk center from the cone surface
+                float along = glm::dot(toCenter, viewDir);
+                float across =
+                    std::sqrt(std::max(distance * distance - along * along,
+                                       0.0f));
+                bool inView = distance <= chunkRadius ||
+                              across * cosA - along * sinA <= chunkRadius;
+                if (!inView) priority += OUT_OF_VIEW_PENALTY;
+
+                loadQueue.push_back({priority, chunkPos});
+            }
+        }
+    }
+
+    std::sort(loadQueue.begin(), loadQueue.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
+}
+
+void World::processLoadQueue(int budget) {
+    size_t count = std::min(static_cast<size_t>(std::max(budget, 0)),
+                            loadQueue.size());
+    for (size_t i = 0; i < count; i++) getChunk(loadQueue[i].second);
+
+    loadQueue.erase(loadQueue.begin(), loadQueue.begin() + count);
+}
+
+// Indexed by Side
+static constexpr glm::ivec3 SIDE_OFFSETS[SIDE_COUNT] = {
+    {0, 1, 0}, {0, 0, 1}, {0, 0, -1}, {1, 0, 0}, {-1, 0, 0}, {0, -1, 0}};
+static constexpr int OPPOSITE_SIDES[SIDE_COUNT] = {5, 2, 1, 4, 3, 0};
+
+void World::updateVisibility(const Camera& camera, int radius) {
+    glm::ivec3 cameraChunk =
+        splitWorldCoords(glm::ivec3{glm::floor(camera.pos)}).first;
+
+    // One chunk of margin around the area drawn by getChunkInArea
+    visibilityOrigin = {cameraChunk.x - radius - 1, 0,
+                        cameraChunk.z - radius - 1};
+    visibilitySize = {2 * radius + 3, HEIGHT, 2 * radius + 3};
+    visibility.assign(visibilitySize.x * visibilitySize.y * visibilitySize.z,
+                      0);
+    visibilityQueue.clear();
+
+    glm::vec3 viewDir = camera.computeViewDir();
+    glm::vec3 chunkSize{Chunk::DIM};
+    float chunkRadius = glm::length(chunkSize) * 0.5f;
+
+    auto visit = [&](glm::ivec3 pos, int from, uint8_t directions) {
+        int index = getVisibilityIndex(pos);
+        if (index < 0 || visibility[index]) return;
+
+        // Chunks that are not loaded yet can't be drawn nor walked through
+        auto it = chunks.find(pos);
+        if (it == chunks.end()) return;
+
+        visibility[index] = 1;
+        visibilityQueue.push_back({&it->second, pos, from, directions});
+    };
+
+    if (cameraChunk.y >= HEIGHT) {
+        // Above the world, everything is seen from the top
+        for (int x = 0; x < visibilitySize.x; x++) {
+            for (int z = 0; z < visibilitySize.z; z++) {
+                visit(visibilityOrigin + glm::ivec3{x, HEIGHT - 1, z},
+                      static_cast<int>(Side::SIDE_Y_POS),
+                      1 << static_cast<int>(Side::SIDE_Y_NEG));
+            }
+        }
+    } else {
+        cameraChunk.y = std::max(cameraChunk.y, 0);
+        visit(cameraChunk, -1, 0);
+    }
+
+    // The camera chunk is still loading, don't hide anything meanwhile
+    if (visibilityQueue.empty()) {
+        std::fill(visibility.begin(), visibility.end(), 1);
+        return;
+    }
+
+    // Breadth first, the queue only grows
+    for (size_t i = 0; i < visibilityQueue.size(); i++) {
+        VisibilityNode node = visibilityQueue[i];
+
+        for (int to = 0; to < SIDE_COUNT; to++) {
+            if (node.directions & (1 << OPPOSITE_SIDES[to])) continue;
+            if (node.from >= 0 &&
+                !node.chunk->canSeeThrough(static_cast<Side>(node.from),
+                                           static_cast<Side>(to)))
+                continue;
+
+            glm::ivec3 next = node.pos + SIDE_OFFSETS[to];
+
+            // Nothing behind the camera can be seen
+            glm::vec3 center = (glm::vec3{next} + 0.5f) * chunkSize;
+            if (glm::dot(center - camera.pos, viewDir) < -chunkRadius)
+                continue;
+
+            visit(next, OPPOSITE_SIDES[to], node.directions | (1 << to));
+        }
+    }
+}
+
+bool World::isChunkVisible(glm::ivec3 pos) const {
+    int index = getVisibilityIndex(pos);
+    return index >= 0 && visibility[index];
+}
+
+int World::getVisibilityIndex(glm::ivec3 pos) const {
+    glm::ivec3 local = pos - visibilityOrigin;
+    if (local.x < 0 || local.y < 0 || local.z < 0 ||
+        local.x >= visibilitySize.x || local.y >= visibilitySize.y ||
+        local.z >= visibilitySize.z)
+        return -1;
+
+    return (local.x * visibilitySize.y + local.y) * visibilitySize.z + local.z;
+}
+
 Block World::getBlock(glm::ivec3 pos) {
     auto [chunkPos, inChunkPos] = splitWorldCoords(pos);
     if (chunkPos.y < 0 || chunkPos.y >= HEIGHT) return Block::AIR;
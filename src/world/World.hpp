@@ -1,10 +1,15 @@
 #pragma once
+#include <cstdint>
 #include <glm/vec3.hpp>
 #include <memory>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
+#include "../render/Primitives.hpp"
 #include "AtlasManager.hpp"
 #include "Chunk.hpp"
+#include "TerrainGenerator.hpp"
 
 namespace world {
 
@@ -24,11 +29,45 @@ struct IVec3Hash {
 
 class World {
 public:
-    static constexpr int HEIGHT = 4;
+    static constexpr int HEIGHT = TerrainGenerator::HEIGHT;
+
+    // Chunks queued around the player and around the predicted position,
+    // in chunks. Keep it above the render radius so that chunks are ready
+    // before they come into view.
+    static constexpr int LOAD_RADIUS = 4;
+    // How far ahead the player's position is predicted, in seconds
+    static constexpr float PREFETCH_SECONDS = 3.0f;
+    // Priority penalties, in chunks of distance
+    static constexpr float PREFETCH_PENALTY = 1.0f;
+    static constexpr float OUT_OF_VIEW_PENALTY = 3.0f;
 
 private:
     std::unordered_map<glm::ivec3, Chunk, IVec3Hash> chunks;
     std::shared_ptr<AtlasManager> atlas;
+    std::shared_ptr<TerrainGenerator> generator;
+
+    // Missing chunks, sorted by priority (lower first). Rebuilt every frame,
+    // the storage is reused.
+    std::vector<std::pair<float, glm::ivec3>> loadQueue;
+
+    struct VisibilityNode {
+        const Chunk* chunk;
+        glm::ivec3 pos;
+        // Face the chunk was entered from, -1 for the camera chunk
+        int from;
+        // Bitmask of the sides walked through to get here
+        uint8_t directions;
+    };
+
+    // Result of the last visibility search, a flat box of flags starting at
+    // visibilityOrigin
+    glm::ivec3 visibilityOrigin{0};
+    glm::ivec3 visibilitySize{0};
+    std::vector<uint8_t> visibility;
+    std::vector<VisibilityNode> visibilityQueue;
+
+    // -1 if outside of the searched box
+    int getVisibilityIndex(glm::ivec3 pos) const;
 
 public:
     World(std::shared_ptr<AtlasManager> atlas);
@@ -37,9 +76,24 @@ public:
         return std::make_unique<World>(atlas);
     }
 
+    // Visits the loaded chunks in the area, missing ones are left to the
+    // load queue
     template <typename F>
     void getChunkInArea(glm::ivec3 pos, int radius, const F& f);
 
+    // Reprioritises the missing chunks around the camera, velocity is in
+    // blocks per second
+    void updateLoadQueue(const render::Camera& camera, glm::vec3 velocity);
+    // Generates at most budget chunks from the front of the queue
+    void processLoadQueue(int budget);
+    size_t getLoadQueueSize() const { return loadQueue.size(); }
+
+    // Walks the chunk visibility graph from the camera, only going through
+    // faces that are linked inside each chunk and never turning back
+    void updateVisibility(const render::Camera& camera, int radius);
+    // Whether the last visibility search reached the chunk
+    bool isChunkVisible(glm::ivec3 pos) const;
+
     Chunk& getChunk(glm::ivec3 pos);
     Block getBlock(glm::ivec3 pos);
     void updateBlock(glm::ivec3 pos, Block newBlock);
@@ -55,8 +109,8 @@ void World::getChunkInArea(glm::ivec3 pos, int radius, const F& f) {
         for (int z = -radius; z < radius; z++) {
             for (int y = 0; y < HEIGHT; y++) {
                 glm::ivec3 pos2{pos.x + x, y, pos.z + z};
-                Chunk& chunk = getChunk(pos2);
-                f(pos2, chunk);
+                auto it = chunks.find(pos2);
+                if (it != chunks.end()) f(pos2, it->second);
             }
         }
     }